@@ -0,0 +1,231 @@
+#define _DEFAULT_SOURCE // wait4
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * CCRP benchmark runner (make bench)
+ *
+ * Runs each script through the interpreter a few times unmeasured (page cache,
+ * library .crhc caches), then times every repetition and takes its peak RSS
+ * from wait4. Script output goes to /dev/null and stdin is empty, so demos
+ * that ask for input get end of input.
+ *
+ * Results are printed as a table and written as JSON with one benchmark per
+ * line, so the files of two commits can be diffed directly. --baseline reads
+ * such a file and adds the change in median time to the table.
+ *
+ * Usage: ccrp_bench [--runs N] [--warmup N] [--engine vm|tree] [--label TEXT]
+ *                   [--output FILE] [--baseline FILE] INTERPRETER SCRIPT...
+ */
+
+#define MAX_BASELINE 256
+
+typedef struct {
+    const char *name;
+    double median_ms;
+    double p95_ms;
+    double min_ms;
+    double max_ms;
+    long peak_rss_kb;
+    int status;         // exit status of the last failing run, 0 if all passed
+} Result;
+
+typedef struct {
+    char name[256];
+    double median_ms;
+} Baseline;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// Run the interpreter on script once; returns the exit status (-1 if it could not run)
+static int run_once(const char *interpreter, const char *engine_flag, const char *script,
+                    double *ms, long *rss_kb) {
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            dup2(null, 0);
+            dup2(null, 1);
+            dup2(null, 2);
+        }
+        char *argv[4];
+        int argc = 0;
+        argv[argc++] = (char*)interpreter;
+        if (engine_flag) argv[argc++] = (char*)engine_flag;
+        argv[argc++] = (char*)script;
+        argv[argc] = NULL;
+        execv(interpreter, argv);
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    *ms = now_ms() - start;
+    *rss_kb = usage.ru_maxrss; // kilobytes on Linux
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench(Result *r, const char *interpreter, const char *engine_flag, int runs, int warmup) {
+    double *times = malloc((size_t)runs * sizeof(double));
+    long rss = 0;
+    r->status = 0;
+    for (int i = 0; i < warmup + runs; i++) {
+        double ms = 0;
+        long run_rss = 0;
+        int status = run_once(interpreter, engine_flag, r->name, &ms, &run_rss);
+        if (status != 0) r->status = status;
+        if (i < warmup) continue;
+        times[i - warmup] = ms;
+        if (run_rss > rss) rss = run_rss;
+    }
+    qsort(times, (size_t)runs, sizeof(double), compare_double);
+    r->median_ms = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    int rank = (95 * runs + 99) / 100; // nearest rank
+    r->p95_ms = times[rank > 0 ? rank - 1 : 0];
+    r->min_ms = times[0];
+    r->max_ms = times[runs - 1];
+    r->peak_rss_kb = rss;
+    free(times);
+}
+
+// ------------------------ JSON ------------------------
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json(FILE *out, const char *label, const char *interpreter, const char *engine,
+                       int runs, int warmup, const Result *results, int count) {
+    fprintf(out, "{\n  \"label\": ");
+    json_string(out, label);
+    fprintf(out, ",\n  \"interpreter\": ");
+    json_string(out, interpreter);
+    fprintf(out, ",\n  \"engine\": \"%s\",\n  \"runs\": %d,\n  \"warmup\": %d,\n  \"benchmarks\": [\n",
+            engine, runs, warmup);
+    for (int i = 0; i < count; i++) {
+        const Result *r = &results[i];
+        fprintf(out, "    {\"name\": ");
+        json_string(out, r->name);
+        fprintf(out, ", \"median_ms\": %.3f, \"p95_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f, "
+                     "\"peak_rss_kb\": %ld, \"status\": %d}%s\n",
+                r->median_ms, r->p95_ms, r->min_ms, r->max_ms, r->peak_rss_kb, r->status,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Medians of a previous run, read back from the one-line-per-benchmark layout above
+static int read_baseline(const char *path, Baseline *out, int max) {
+    FILE *in = fopen(path, "r");
+    if (!in) return -1;
+    char line[1024];
+    int count = 0;
+    while (count < max && fgets(line, sizeof(line), in)) {
+        const char *name = strstr(line, "{\"name\": \"");
+        const char *median = strstr(line, "\"median_ms\": ");
+        if (!name || !median) continue;
+        name += strlen("{\"name\": \"");
+        const char *end = strchr(name, '"');
+        if (!end || (size_t)(end - name) >= sizeof(out[count].name)) continue;
+        memcpy(out[count].name, name, (size_t)(end - name));
+        out[count].name[end - name] = '\0';
+        out[count].median_ms = strtod(median + strlen("\"median_ms\": "), NULL);
+        count++;
+    }
+    fclose(in);
+    return count;
+}
+
+static const Baseline* find_baseline(const Baseline *base, int count, const char *name) {
+    for (int i = 0; i < count; i++) if (strcmp(base[i].name, name) == 0) return &base[i];
+    return NULL;
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--runs N] [--warmup N] [--engine vm|tree] [--label TEXT]\n"
+                    "          [--output FILE] [--baseline FILE] INTERPRETER SCRIPT...\n", prog);
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    int runs = 10, warmup = 2;
+    const char *engine = "vm", *label = "", *output = NULL, *baseline_path = NULL;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (i + 1 >= argc) return usage(argv[0]);
+        if (strcmp(argv[i], "--runs") == 0) runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0) warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--engine") == 0) engine = argv[++i];
+        else if (strcmp(argv[i], "--label") == 0) label = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0) output = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0) baseline_path = argv[++i];
+        else return usage(argv[0]);
+    }
+    if (argc - i < 2 || runs < 1 || warmup < 0) return usage(argv[0]);
+    if (strcmp(engine, "vm") != 0 && strcmp(engine, "tree") != 0) return usage(argv[0]);
+    const char *interpreter = argv[i++];
+    const char *engine_flag = strcmp(engine, "vm") == 0 ? "--vm" : NULL;
+
+    Baseline base[MAX_BASELINE];
+    int base_count = baseline_path ? read_baseline(baseline_path, base, MAX_BASELINE) : 0;
+    if (base_count < 0) {
+        fprintf(stderr, "Error: could not read baseline %s\n", baseline_path);
+        base_count = 0;
+    }
+
+    int count = argc - i, failed = 0;
+    Result *results = calloc((size_t)count, sizeof(Result));
+    printf("%-32s %12s %12s %12s %10s\n", "benchmark", "median ms", "p95 ms", "peak RSS KB", "vs base");
+    for (int k = 0; k < count; k++) {
+        Result *r = &results[k];
+        r->name = argv[i + k];
+        bench(r, interpreter, engine_flag, runs, warmup);
+        const Baseline *b = find_baseline(base, base_count, r->name);
+        char change[32] = "";
+        if (b && b->median_ms > 0) snprintf(change, sizeof(change), "%+.1f%%", (r->median_ms / b->median_ms - 1) * 100);
+        printf("%-32s %12.3f %12.3f %12ld %10s%s\n", r->name, r->median_ms, r->p95_ms, r->peak_rss_kb, change,
+               r->status ? "  FAILED" : "");
+        fflush(stdout);
+        if (r->status) failed = 1;
+    }
+
+    if (output) {
+        FILE *out = fopen(output, "w");
+        if (!out) {
+            fprintf(stderr, "Error: could not write %s\n", output);
+            return 1;
+        }
+        write_json(out, label, interpreter, engine, runs, warmup, results, count);
+        fclose(out);
+        printf("Results written to %s\n", output);
+    } else {
+        write_json(stdout, label, interpreter, engine, runs, warmup, results, count);
+    }
+    free(results);
+    return failed;
+}
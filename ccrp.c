@@ -3,66 +3,57 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
-#include <math.h>
 #include <gtk/gtk.h>
 
 /*
  * CCRP Interpreter core
  *
  * Features:
- * - Variables: int and string
+ * - Variables: 64-bit int, double and string
  * - Control: if/else, while
  * - I/O: print, input, input_text
  * - Libraries: [src]lib loads src/lib.crh (Crypton), supports Rust-like `fn name(args) {}`
  */
 
-Variable vars[MAX_VARS];
-int var_count = 0;
-
-Function functions[MAX_FUNCTIONS];
-int function_count = 0;
-
-char active_libs[MAX_LIBS][50];
-int lib_count = 0;
-
-ControlState control_state = {0};
-char **current_lines = NULL;
-int current_line_count = 0;
-int current_line_index = 0;
+__thread CcrpVM *ccrp_vm = NULL;
 
 int (*get_input_from_gui)(const char *prompt) = NULL;
 char* (*get_text_input_from_gui)(const char *prompt) = NULL;
 
 // ------------------------ GTK lightweight runtime ------------------------
-static int gtk_initialized = 0;
-static GHashTable *gtk_objects = NULL; // name -> GtkWidget*
-static GtkWidget *gtk_main_window = NULL;
-static GPtrArray *css_providers = NULL; // keep providers alive
+static int gtk_initialized = 0; // GTK itself is process-wide and single-threaded
 
 static void ensure_gtk_initialized(void) {
     if (!gtk_initialized) {
         int argc = 0; char **argv = NULL;
         gtk_init(&argc, &argv);
-        gtk_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-        css_providers = g_ptr_array_new();
         gtk_initialized = 1;
     }
+    if (!ccrp_vm->gtk_objects) {
+        ccrp_vm->gtk_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        ccrp_vm->css_providers = g_ptr_array_new_with_free_func(g_object_unref); // keep providers alive
+    }
 }
 
 static GtkWidget* gtk_get(const char *name) {
-    if (!gtk_initialized || !gtk_objects) return NULL;
-    return GTK_WIDGET(g_hash_table_lookup(gtk_objects, name));
+    if (!ccrp_vm->gtk_objects) return NULL;
+    return GTK_WIDGET(g_hash_table_lookup(ccrp_vm->gtk_objects, name));
 }
 
 static void gtk_put(const char *name, GtkWidget *w) {
     ensure_gtk_initialized();
-    g_hash_table_insert(gtk_objects, g_strdup(name), w);
+    g_hash_table_insert(ccrp_vm->gtk_objects, g_strdup(name), w);
+}
+
+static void on_window_destroy(GtkWidget *w, gpointer data) {
+    (void)w;
+    ((CcrpVM*)data)->gtk_closed = 1;
 }
 
 static void handle_gtk_command(const char *line) {
     // Requires gtk library enabled
     if (!lib_enabled("gtk")) {
-        printf("Error: 'gtk' library not imported. Add #[gtk] first.\n");
+        ccrp_out_printf("Error: 'gtk' library not imported. Add #[gtk] first.\n");
         return;
     }
     ensure_gtk_initialized();
@@ -74,8 +65,8 @@ static void handle_gtk_command(const char *line) {
             GtkWidget *w = NULL;
             if (strcmp(type, "window") == 0) {
                 w = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-                g_signal_connect(w, "destroy", G_CALLBACK(gtk_main_quit), NULL);
-                if (!gtk_main_window) gtk_main_window = w;
+                g_signal_connect(w, "destroy", G_CALLBACK(on_window_destroy), ccrp_vm);
+                if (!ccrp_vm->gtk_main_window) ccrp_vm->gtk_main_window = w;
             } else if (strcmp(type, "button") == 0) {
                 w = gtk_button_new();
             } else if (strcmp(type, "input") == 0 || strcmp(type, "entry") == 0) {
@@ -92,7 +83,7 @@ static void handle_gtk_command(const char *line) {
             if (w) {
                 gtk_put(name, w);
             } else {
-                printf("Error: unknown gtk create type '%s'\n", type);
+                ccrp_out_printf("Error: unknown gtk create type '%s'\n", type);
             }
             return;
         }
@@ -103,7 +94,7 @@ static void handle_gtk_command(const char *line) {
         char dummy[8], name[64], prop[32];
         if (sscanf(line, "gtk %7s %63s %31s", dummy, name, prop) >= 3 && strcmp(dummy, "set") == 0) {
             GtkWidget *w = gtk_get(name);
-            if (!w) { printf("Error: gtk object '%s' not found\n", name); return; }
+            if (!w) { ccrp_out_printf("Error: gtk object '%s' not found\n", name); return; }
             if (strcmp(prop, "title") == 0) {
                 char title[256];
                 if (sscanf(line, "gtk set %*s title \"%255[^\"]\"", title) == 1) {
@@ -123,7 +114,7 @@ static void handle_gtk_command(const char *line) {
                     else if (GTK_IS_ENTRY(w)) gtk_entry_set_text(GTK_ENTRY(w), text);
                 }
             } else {
-                printf("Error: unknown gtk property '%s'\n", prop);
+                ccrp_out_printf("Error: unknown gtk property '%s'\n", prop);
             }
             return;
         }
@@ -135,7 +126,7 @@ static void handle_gtk_command(const char *line) {
         if (sscanf(line, "gtk add %63s %63s", parent, child) == 2) {
             GtkWidget *pw = gtk_get(parent);
             GtkWidget *cw = gtk_get(child);
-            if (!pw || !cw) { printf("Error: gtk add missing widgets\n"); return; }
+            if (!pw || !cw) { ccrp_out_printf("Error: gtk add missing widgets\n"); return; }
             if (GTK_IS_WINDOW(pw)) {
                 GtkWidget *existing = gtk_bin_get_child(GTK_BIN(pw));
                 if (existing) gtk_container_remove(GTK_CONTAINER(pw), existing);
@@ -145,7 +136,7 @@ static void handle_gtk_command(const char *line) {
             } else if (GTK_IS_CONTAINER(pw)) {
                 gtk_container_add(GTK_CONTAINER(pw), cw);
             } else {
-                printf("Error: parent '%s' not a container\n", parent);
+                ccrp_out_printf("Error: parent '%s' not a container\n", parent);
             }
             return;
         }
@@ -156,23 +147,26 @@ static void handle_gtk_command(const char *line) {
         char name[64];
         if (sscanf(line, "gtk show %63s", name) == 1) {
             GtkWidget *w = gtk_get(name);
-            if (!w) { printf("Error: gtk object '%s' not found\n", name); return; }
+            if (!w) { ccrp_out_printf("Error: gtk object '%s' not found\n", name); return; }
             gtk_widget_show_all(w);
-            if (GTK_IS_WINDOW(w)) gtk_main_window = w;
+            if (GTK_IS_WINDOW(w)) ccrp_vm->gtk_main_window = w;
             return;
         }
     }
 
     // Parse run
     if (strncmp(line, "gtk run", 7) == 0) {
-        if (gtk_main_window) {
-            gtk_widget_show_all(gtk_main_window);
+        if (ccrp_vm->gtk_main_window) {
+            gtk_widget_show_all(ccrp_vm->gtk_main_window);
         }
-        gtk_main();
+        ccrp_out_flush();
+        // the main loop, with the script's tasks running alongside the UI
+        ccrp_vm->gtk_closed = 0;
+        ccrp_tasks_wait_flag(&ccrp_vm->gtk_closed);
         return;
     }
 
-    printf("Error: unknown gtk command.\n");
+    ccrp_out_printf("Error: unknown gtk command.\n");
 }
 
 // Apply CSS from a style block
@@ -189,10 +183,10 @@ static void handle_style_block(const char *first_line) {
         sscanf(header, " %*s %63s", target);
     }
     // Collect inner CSS lines between matching braces
-    int depth = 0; int start_i = current_line_index; int end_i = -1;
+    int depth = 0; int start_i = ccrp_vm->current_line_index; int end_i = -1;
     GString *css_inner = g_string_new("");
-    for (int i = start_i; i < current_line_count; i++) {
-        const char *ln = current_lines[i];
+    for (int i = start_i; i < ccrp_vm->current_line_count; i++) {
+        const char *ln = ccrp_vm->current_lines[i];
         const char *p = ln;
         while (*p) {
             if (*p == '{') { depth++; if (depth == 1) {
@@ -227,7 +221,7 @@ static void handle_style_block(const char *first_line) {
             GtkCssProvider *prov = gtk_css_provider_new();
             gtk_css_provider_load_from_data(prov, css->str, -1, NULL);
             gtk_style_context_add_provider(gtk_widget_get_style_context(w), GTK_STYLE_PROVIDER(prov), GTK_STYLE_PROVIDER_PRIORITY_USER);
-            g_ptr_array_add(css_providers, prov);
+            g_ptr_array_add(ccrp_vm->css_providers, prov);
         } else {
             // Treat as type selector (e.g., button, entry, label, window)
             g_string_append_printf(css, "%s {\n%s}\n", target, css_inner->str);
@@ -235,7 +229,7 @@ static void handle_style_block(const char *first_line) {
             gtk_css_provider_load_from_data(prov, css->str, -1, NULL);
             GdkScreen *screen = gdk_screen_get_default();
             gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER(prov), GTK_STYLE_PROVIDER_PRIORITY_USER);
-            g_ptr_array_add(css_providers, prov);
+            g_ptr_array_add(ccrp_vm->css_providers, prov);
         }
     } else {
         // Global * selector
@@ -244,47 +238,16 @@ static void handle_style_block(const char *first_line) {
         gtk_css_provider_load_from_data(prov, css->str, -1, NULL);
         GdkScreen *screen = gdk_screen_get_default();
         gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER(prov), GTK_STYLE_PROVIDER_PRIORITY_USER);
-        g_ptr_array_add(css_providers, prov);
+        g_ptr_array_add(ccrp_vm->css_providers, prov);
     }
 
     g_string_free(css_inner, TRUE);
     g_string_free(css, TRUE);
     // Advance interpreter to end of block
-    current_line_index = end_i;
-}
-
-// ------------------------ Utility: split/join lines ------------------------
-char** split_lines(const char *code, int *line_count) {
-    char *code_copy = g_strdup(code);
-    char **lines = NULL;
-    int count = 0;
-    int capacity = 10;
-    
-    lines = malloc(capacity * sizeof(char*));
-    
-    char *line = strtok(code_copy, "\n");
-    while (line != NULL) {
-        if (count >= capacity) {
-            capacity *= 2;
-            lines = realloc(lines, capacity * sizeof(char*));
-        }
-        lines[count] = g_strdup(line);
-        count++;
-        line = strtok(NULL, "\n");
-    }
-    
-    g_free(code_copy);
-    *line_count = count;
-    return lines;
-}
-
-void free_lines(char **lines, int line_count) {
-    for (int i = 0; i < line_count; i++) {
-        g_free(lines[i]);
-    }
-    free(lines);
+    ccrp_vm->current_line_index = end_i;
 }
 
+// ------------------------ Utility: blocks ------------------------
 int find_matching_end(char **lines, int line_count, int start_line, const char *start_keyword, const char *end_keyword) {
     int depth = 1;
     for (int i = start_line + 1; i < line_count; i++) {
@@ -304,435 +267,391 @@ int find_matching_end(char **lines, int line_count, int start_line, const char *
 }
 
 // ------------------------ Variables ------------------------
-int get_var(const char *name) {
-    for (int i = 0; i < var_count; i++)
-        if (strcmp(vars[i].name, name) == 0) return vars[i].value;
-    return 0;
+// Identifiers are interned in an open-addressing hash table (linear probing,
+// power-of-two capacity, grown at 70% load) that maps each name to its slot in
+// vars[]. The compiler resolves variable references to slots once, so hot
+// paths index vars[] directly and only name-based callers hash.
+typedef struct SymbolEntry {
+    const char *name;   // interned copy, shared with var_names[slot]
+    guint32 hash;
+    int slot;
+} SymbolEntry;
+
+static guint32 hash_name(const char *name) {
+    guint32 h = 2166136261u; // FNV-1a
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++) { h ^= *p; h *= 16777619u; }
+    return h;
 }
 
-void set_var(const char *name, int value) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            vars[i].value = value;
-            vars[i].is_string = 0;
-            return;
-        }
-    }
-    if (var_count < MAX_VARS) {
-        strcpy(vars[var_count].name, name);
-        vars[var_count].value = value;
-        vars[var_count].is_string = 0;
-        var_count++;
-    } else {
-        printf("Error: Max variables reached.\n");
+static SymbolEntry* symbol_probe(SymbolEntry *table, int capacity, const char *name, guint32 hash) {
+    int mask = capacity - 1;
+    for (int i = (int)(hash & (guint32)mask); ; i = (i + 1) & mask) {
+        SymbolEntry *e = &table[i];
+        if (!e->name || (e->hash == hash && strcmp(e->name, name) == 0)) return e;
     }
 }
 
-char* get_string_var(const char *name) {
-    for (int i = 0; i < var_count; i++)
-        if (strcmp(vars[i].name, name) == 0 && vars[i].is_string)
-            return vars[i].string_value;
-    return "";
+static void symbols_grow(void) {
+    CcrpVM *vm = ccrp_vm;
+    int capacity = vm->symbol_capacity ? vm->symbol_capacity * 2 : 256;
+    SymbolEntry *table = calloc(capacity, sizeof(SymbolEntry));
+    for (int i = 0; i < vm->symbol_capacity; i++) {
+        if (vm->symbols[i].name) *symbol_probe(table, capacity, vm->symbols[i].name, vm->symbols[i].hash) = vm->symbols[i];
+    }
+    free(vm->symbols);
+    vm->symbols = table;
+    vm->symbol_capacity = capacity;
 }
 
-void set_string_var(const char *name, const char *value) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            strncpy(vars[i].string_value, value, MAX_STRING_LENGTH - 1);
-            vars[i].string_value[MAX_STRING_LENGTH - 1] = '\0';
-            vars[i].is_string = 1;
-            return;
-        }
-    }
-    if (var_count < MAX_VARS) {
-        strcpy(vars[var_count].name, name);
-        strncpy(vars[var_count].string_value, value, MAX_STRING_LENGTH - 1);
-        vars[var_count].string_value[MAX_STRING_LENGTH - 1] = '\0';
-        vars[var_count].is_string = 1;
-        var_count++;
-    } else {
-        printf("Error: Max variables reached.\n");
-    }
+int find_var_slot(const char *name) {
+    if (!ccrp_vm->symbols) return -1;
+    SymbolEntry *e = symbol_probe(ccrp_vm->symbols, ccrp_vm->symbol_capacity, name, hash_name(name));
+    return e->name ? e->slot : -1;
 }
 
-// ------------------------ Function table ------------------------
-void define_function(const char *name, const char *body, int start_line, int end_line) {
-    if (function_count < MAX_FUNCTIONS) {
-        strcpy(functions[function_count].name, name);
-        strncpy(functions[function_count].body, body, MAX_FUNCTION_BODY - 1);
-        functions[function_count].body[MAX_FUNCTION_BODY - 1] = '\0';
-        functions[function_count].start_line = start_line;
-        functions[function_count].end_line = end_line;
-        functions[function_count].param_count = 0;
-        function_count++;
-    } else {
-        printf("Error: Max functions reached.\n");
+int var_slot(const char *name) {
+    CcrpVM *vm = ccrp_vm;
+    if ((vm->var_count + 1) * 10 > vm->symbol_capacity * 7) symbols_grow();
+    guint32 hash = hash_name(name);
+    SymbolEntry *e = symbol_probe(vm->symbols, vm->symbol_capacity, name, hash);
+    if (e->name) return e->slot;
+    if (vm->var_count >= vm->var_capacity) {
+        vm->var_capacity = vm->var_capacity ? vm->var_capacity * 2 : 128;
+        vm->vars = realloc(vm->vars, vm->var_capacity * sizeof(Value));
+        vm->var_names = realloc(vm->var_names, vm->var_capacity * sizeof(char*));
     }
+    e->name = g_strdup(name);
+    e->hash = hash;
+    e->slot = vm->var_count;
+    vm->vars[vm->var_count] = value_int(0);
+    vm->var_names[vm->var_count] = e->name;
+    return vm->var_count++;
 }
 
-Function* get_function(const char *name) {
-    for (int i = 0; i < function_count; i++) {
-        if (strcmp(functions[i].name, name) == 0) return &functions[i];
-    }
-    return NULL;
+int64_t get_var(const char *name) {
+    int slot = find_var_slot(name);
+    return slot < 0 ? 0 : value_to_int(ccrp_vm->vars[slot]);
 }
 
-// ------------------------ Library loader ------------------------
-static int has_prefix_word(const char *line, const char *word) {
-    char first[256];
-    if (sscanf(line, " %255s", first) != 1) return 0;
-    return strncmp(first, word, strlen(word)) == 0;
-}
-
-char* read_library_file(const char *lib_name) {
-    char filename[256];
-    snprintf(filename, sizeof(filename), "src/%s.crh", lib_name);
-    FILE *file = fopen(filename, "r");
-    if (!file) return NULL;
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char *content = malloc(file_size + 1);
-    if (!content) { fclose(file); return NULL; }
-    size_t bytes_read = fread(content, 1, file_size, file);
-    content[bytes_read] = '\0';
-    fclose(file);
-    return content;
-}
-
-void load_library(const char *lib_name) {
-    char *lib_content = read_library_file(lib_name);
-    if (!lib_content) return;
-
-    int line_count;
-    char **lines = split_lines(lib_content, &line_count);
-
-    for (int i = 0; i < line_count; i++) {
-        // Accept both `function` and Rust-like `fn`
-        if (has_prefix_word(lines[i], "function") || has_prefix_word(lines[i], "fn")) {
-            char func_def[256];
-            if (sscanf(lines[i], "%*s %[^{]", func_def) == 1) {
-                // Extract name up to '('
-                char func_name[MAX_FUNCTION_NAME] = {0};
-                const char *paren = strchr(func_def, '(');
-                if (paren) {
-                    size_t name_len = (size_t)(paren - func_def);
-                    if (name_len >= sizeof(func_name)) name_len = sizeof(func_name) - 1;
-                    strncpy(func_name, func_def, name_len);
-                    func_name[name_len] = '\0';
-
-                    // Find closing '}' matching this block
-                    int body_start = i + 1;
-                    int depth = 1;
-                    int body_end = -1;
-                    for (int j = body_start; j < line_count; j++) {
-                        if (strstr(lines[j], "{") != NULL) depth++;
-                        if (strstr(lines[j], "}") != NULL) {
-                            depth--;
-                            if (depth == 0) { body_end = j; break; }
-                        }
-                    }
-                    if (body_end > body_start) {
-                        char body[MAX_FUNCTION_BODY] = "";
-                        for (int j = body_start; j < body_end; j++) {
-                            strcat(body, lines[j]);
-                            strcat(body, "\n");
-                        }
-                        define_function(func_name, body, body_start, body_end);
-                        i = body_end;
-                    }
-                }
-            }
-        }
-    }
+void set_var(const char *name, int64_t value) {
+    set_value(name, value_int(value));
+}
 
-    free_lines(lines, line_count);
-    free(lib_content);
-}
-
-// ------------------------ Math builtins (guarded by [src] math) ------------------------
-int math_function(const char *func_name, int arg) {
-    if (!lib_enabled("math")) {
-        printf("Error: 'math' library not imported for %s.\n", func_name);
-        return 0;
-    }
-    if (strcmp(func_name, "sqrt") == 0) return (int)sqrt((double)arg);
-    if (strcmp(func_name, "abs") == 0) return abs(arg);
-    if (strcmp(func_name, "sin") == 0) return (int)(sin((double)arg) * 1000);
-    if (strcmp(func_name, "cos") == 0) return (int)(cos((double)arg) * 1000);
-    if (strcmp(func_name, "tan") == 0) return (int)(tan((double)arg) * 1000);
-    if (strcmp(func_name, "log") == 0) return (int)log((double)arg);
-    if (strcmp(func_name, "exp") == 0) return (int)exp((double)arg);
-    printf("Error: Unknown math function '%s'.\n", func_name);
-    return 0;
+const char* get_string_var(const char *name) {
+    int slot = find_var_slot(name);
+    return slot < 0 ? "" : value_cstr(ccrp_vm->vars[slot]);
 }
 
-int math_function_two_args(const char *func_name, int arg1, int arg2) {
-    if (!lib_enabled("math")) {
-        printf("Error: 'math' library not imported for %s.\n", func_name);
-        return 0;
-    }
-    if (strcmp(func_name, "pow") == 0) return (int)pow((double)arg1, (double)arg2);
-    if (strcmp(func_name, "mod") == 0) return arg1 % arg2;
-    if (strcmp(func_name, "max") == 0) return (arg1 > arg2) ? arg1 : arg2;
-    if (strcmp(func_name, "min") == 0) return (arg1 < arg2) ? arg1 : arg2;
-    printf("Error: Unknown two-argument math function '%s'.\n", func_name);
-    return 0;
+void set_string_var(const char *name, const char *value) {
+    set_value(name, value_string(value));
 }
 
-// ------------------------ Expression evaluation ------------------------
-int eval_expr(const char *expr) {
-    char temp_expr[256];
-    strcpy(temp_expr, expr);
+int is_string_var(const char *name) {
+    int slot = find_var_slot(name);
+    return slot >= 0 && ccrp_vm->vars[slot].type == VAL_STR;
+}
 
-    // Support chained additions like x + y + z by summing parts outside parentheses
-    {
-        int plus_count = 0;
-        int depth = 0;
-        for (const char *p = temp_expr; *p; ++p) {
-            if (*p == '(') depth++;
-            else if (*p == ')') depth--;
-            else if (*p == '+' && depth == 0) plus_count++;
-        }
-        if (plus_count >= 2) {
-            int sum = 0;
-            int depth2 = 0;
-            const char *start = temp_expr;
-            for (const char *p = temp_expr; ; ++p) {
-                if (*p == '(') depth2++;
-                else if (*p == ')') depth2--;
-                if (*p == '+' && depth2 == 0) {
-                    // evaluate segment [start, p)
-                    char segment[256];
-                    int len = (int)(p - start);
-                    if (len > 255) len = 255;
-                    strncpy(segment, start, len);
-                    segment[len] = '\0';
-                    // trim leading/trailing spaces
-                    char *s = segment; while (*s == ' ') s++;
-                    char *e = s + strlen(s) - 1; while (e >= s && *e == ' ') { *e = '\0'; e--; }
-                    sum += eval_expr(s);
-                    start = p + 1;
-                } else if (*p == '\0') {
-                    // last segment
-                    char segment[256];
-                    int len = (int)(p - start);
-                    if (len > 255) len = 255;
-                    strncpy(segment, start, len);
-                    segment[len] = '\0';
-                    char *s = segment; while (*s == ' ') s++;
-                    char *e = s + strlen(s) - 1; while (e >= s && *e == ' ') { *e = '\0'; e--; }
-                    if (*s) sum += eval_expr(s);
-                    return sum;
-                }
-            }
-        }
-    }
+// Returns a new reference; release it when done
+Value get_value(const char *name) {
+    int slot = find_var_slot(name);
+    if (slot < 0) return value_int(0);
+    value_retain(ccrp_vm->vars[slot]);
+    return ccrp_vm->vars[slot];
+}
 
-    // Function call: try user-defined functions first (Rust-like or built-in names)
-    char func_name[50];
-    char *open_paren = strchr(temp_expr, '(');
-    if (open_paren) {
-        char *close_paren = strrchr(temp_expr, ')');
-        if (close_paren && close_paren > open_paren) {
-            int name_len = (int)(open_paren - temp_expr);
-            if (name_len > 49) name_len = 49;
-            strncpy(func_name, temp_expr, name_len);
-            func_name[name_len] = '\0';
-
-            Function *user_func = get_function(func_name);
-            if (!user_func) {
-                // Fall through to built-in math paths below
-            } else {
-                // NOTE: For simplicity, user-defined functions return 0 (stub). Extend as needed.
-                return 0;
-            }
-        }
-    }
+// Takes ownership of value
+void set_value(const char *name, Value value) {
+    int slot = var_slot(name); // may grow vars[]
+    value_assign(&ccrp_vm->vars[slot], value);
+}
 
-    // Built-in math parsing (existing logic)
-    char func[50];
-    int arg1, arg2;
-    if (sscanf(temp_expr, "%49[^(](%d,%d)", func, &arg1, &arg2) == 3) {
-        return math_function_two_args(func, arg1, arg2);
-    }
-
-    // Handle function calls with two arguments (variables or mixed)
-    char arg1_str[50], arg2_str[50];
-    if (sscanf(temp_expr, "%49[^(](%49[^,],%49[^)])", func_name, arg1_str, arg2_str) == 3) {
-        // Trim whitespace using pointers
-        char *arg1p = arg1_str;
-        char *arg2p = arg2_str;
-        while (*arg1p == ' ') arg1p++;
-        while (*arg2p == ' ') arg2p++;
-        
-        // Parse first argument
-        int val1;
-        if (sscanf(arg1p, "%d", &val1) == 1) {
-            // number
-        } else {
-            val1 = get_var(arg1p);
-        }
-        
-        // Parse second argument
-        int val2;
-        if (sscanf(arg2p, "%d", &val2) == 1) {
-            // number
-        } else {
-            val2 = get_var(arg2p);
+// ------------------------ Function table ------------------------
+char** parse_function_parameters(const char *param_list, int *param_count) {
+    char **params = NULL;
+    int count = 0;
+    const char *p = param_list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t') p++;
+        const char *start = p;
+        while (*p && *p != ',') p++;
+        const char *end = p;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (end > start) {
+            params = realloc(params, (count + 1) * sizeof(char*));
+            params[count++] = g_strndup(start, (gsize)(end - start));
         }
-        
-        return math_function_two_args(func_name, val1, val2);
-    }
-
-    int arg;
-    if (sscanf(temp_expr, "%49[^(](%d)", func_name, &arg) == 2) {
-        return math_function(func_name, arg);
+        if (*p == ',') p++;
     }
+    *param_count = count;
+    return params;
+}
 
-    char var_arg[50];
-    if (sscanf(temp_expr, "%49[^(](%49[^)])", func_name, var_arg) == 2) {
-        if (strchr(var_arg, ',') != NULL) return 0;
-        int num_val; if (sscanf(var_arg, "%d", &num_val) == 1) return math_function(func_name, num_val);
-        return math_function(func_name, get_var(var_arg));
+// Allocate a function record without making it visible by name
+Function* ccrp_function_new(const char *name, const char *params, const char *body, int start_line, int end_line) {
+    CcrpVM *vm = ccrp_vm;
+    if (vm->function_count >= vm->function_capacity) {
+        vm->function_capacity = vm->function_capacity ? vm->function_capacity * 2 : 64;
+        vm->functions = realloc(vm->functions, vm->function_capacity * sizeof(Function*));
     }
+    Function *fn = calloc(1, sizeof(Function));
+    g_strlcpy(fn->name, name, sizeof(fn->name));
+    fn->lines = split_lines(body, &fn->line_count);
+    fn->start_line = start_line;
+    fn->end_line = end_line;
+    fn->params = parse_function_parameters(params, &fn->param_count);
+    vm->functions[vm->function_count++] = fn;
+    return fn;
+}
 
-    // Parentheses
-    if (open_paren) {
-        char *close_paren = strrchr(temp_expr, ')');
-        if (close_paren && close_paren > open_paren) {
-            *close_paren = '\0';
-            int paren_result = eval_expr(open_paren + 1);
-            char new_expr[256];
-            *open_paren = '\0';
-            sprintf(new_expr, "%s%d%s", temp_expr, paren_result, close_paren + 1);
-            return eval_expr(new_expr);
-        }
-    }
+// The first definition of a name wins, including one from an imported library
+void define_function(const char *name, const char *params, const char *body, int start_line, int end_line) {
+    Function *fn = ccrp_function_new(name, params, body, start_line, end_line);
+    if (!ccrp_vm->function_table) ccrp_vm->function_table = g_hash_table_new(g_str_hash, g_str_equal);
+    if (!get_function(fn->name)) g_hash_table_insert(ccrp_vm->function_table, fn->name, fn);
+}
 
-    // Arithmetic or single value/var
-    int val1, val2; char var1[50], var2[50]; char op;
-    if (sscanf(temp_expr, "%d %c %d", &val1, &op, &val2) == 3) {
-        // numbers
-    } else if (sscanf(temp_expr, "%49s %c %49s", var1, &op, var2) == 3) {
-        val1 = get_var(var1); val2 = get_var(var2);
-    } else if (sscanf(temp_expr, "%49s %c %d", var1, &op, &val2) == 3) {
-        val1 = get_var(var1);
-    } else if (sscanf(temp_expr, "%d %c %49s", &val1, &op, var2) == 3) {
-        val2 = get_var(var2);
-    } else if (sscanf(temp_expr, "%d", &val1) == 1) {
-        return val1;
-    } else if (sscanf(temp_expr, "%49s", var1) == 1) {
-        return get_var(var1);
-    } else {
-        return 0;
-    }
-    switch (op) {
-        case '+': return val1 + val2;
-        case '-': return val1 - val2;
-        case '*': return val1 * val2;
-        case '/': return val2 != 0 ? val1 / val2 : 0;
-        case '%': return val2 != 0 ? val1 % val2 : 0;
-        default: return 0;
-    }
-}
-
-// ------------------------ Conditions ------------------------
-int eval_condition(const char *condition) {
-    char temp_condition[256];
-    strcpy(temp_condition, condition);
-    char *operators[] = {"==", "!=", "<=", ">=", "<", ">"};
-    int op_count = 6;
-    for (int i = 0; i < op_count; i++) {
-        char *op_pos = strstr(temp_condition, operators[i]);
-        if (op_pos) {
-            *op_pos = '\0';
-            char *left_expr = temp_condition;
-            char *right_expr = op_pos + strlen(operators[i]);
-            while (*left_expr == ' ') left_expr++;
-            while (*right_expr == ' ') right_expr++;
-            int left_val = eval_expr(left_expr);
-            int right_val = eval_expr(right_expr);
-            if (strcmp(operators[i], "==") == 0) return left_val == right_val;
-            if (strcmp(operators[i], "!=") == 0) return left_val != right_val;
-            if (strcmp(operators[i], "<=") == 0) return left_val <= right_val;
-            if (strcmp(operators[i], ">=") == 0) return left_val >= right_val;
-            if (strcmp(operators[i], "<") == 0) return left_val < right_val;
-            if (strcmp(operators[i], ">") == 0) return left_val > right_val;
-        }
-    }
-    return eval_expr(condition) != 0;
+Function* get_function(const char *name) {
+    Function *fn = ccrp_vm->function_table ? g_hash_table_lookup(ccrp_vm->function_table, name) : NULL;
+    return fn ? fn : ccrp_library_lookup(name);
+}
+
+// User function a call with arg_count arguments runs, or NULL for a builtin:
+// a user function wins unless it takes a different number of arguments and a
+// builtin takes this many (math.crh's max(a, b) next to the array max(a))
+Function* ccrp_call_target(const char *name, int arg_count) {
+    Function *fn = get_function(name);
+    if (fn && fn->param_count != arg_count && ccrp_builtin_find(name, arg_count)) return NULL;
+    return fn;
+}
+
+// Define a function from its header (`name(a, b) `) and the body lines between the braces
+static void define_function_block(const char *func_def, char **lines, int body_start, int body_end) {
+    const char *paren = strchr(func_def, '(');
+    if (!paren) return;
+    char func_name[MAX_FUNCTION_NAME] = {0};
+    size_t name_len = (size_t)(paren - func_def);
+    if (name_len >= sizeof(func_name)) name_len = sizeof(func_name) - 1;
+    memcpy(func_name, func_def, name_len);
+    while (name_len > 0 && func_name[name_len - 1] == ' ') func_name[--name_len] = '\0';
+    const char *close = strchr(paren, ')');
+    char *params = g_strndup(paren + 1, close ? (gsize)(close - paren - 1) : strlen(paren + 1));
+    GString *body = g_string_new("");
+    for (int j = body_start; j < body_end; j++) {
+        g_string_append(body, lines[j]);
+        g_string_append(body, "\n");
+    }
+    define_function(func_name, params, body->str, body_start, body_end);
+    g_string_free(body, TRUE);
+    g_free(params);
 }
 
 // ------------------------ Control flow ------------------------
-void handle_if_statement(const char *condition) {
-    control_state.in_if_block = 1;
-    control_state.if_condition_true = eval_condition(condition);
-    control_state.skip_to_end = !control_state.if_condition_true;
+// Open blocks are kept on a stack, so blocks nest. A false condition skips
+// lines until the block's own else or end keyword: skip_depth counts the
+// blocks opened among the skipped lines, and the end keyword of the skipped
+// block itself runs its handler with skip_depth 1.
+
+static ControlBlock* push_block(BlockKind kind) {
+    ControlState *cs = &ccrp_vm->control_state;
+    if (cs->depth >= MAX_BLOCK_DEPTH) {
+        ccrp_out_printf("Error: blocks nested deeper than %d.\n", MAX_BLOCK_DEPTH);
+        return NULL;
+    }
+    ControlBlock *b = &cs->blocks[cs->depth++];
+    memset(b, 0, sizeof(*b));
+    b->kind = kind;
+    b->line = ccrp_vm->current_line_index;
+    return b;
+}
+
+// The innermost open block if it is of the given kind
+static ControlBlock* top_block(BlockKind kind) {
+    ControlState *cs = &ccrp_vm->control_state;
+    return cs->depth > 0 && cs->blocks[cs->depth - 1].kind == kind ? &cs->blocks[cs->depth - 1] : NULL;
+}
+
+// Leave the block an end keyword closes; unmatched end keywords are ignored
+static void pop_block(BlockKind kind) {
+    ControlState *cs = &ccrp_vm->control_state;
+    if (top_block(kind)) cs->depth--;
+    cs->skip_depth = 0;
+}
+
+// While skipping: 1 if the line is skipped, 0 if it must run (the skipped
+// block's else or end keyword)
+static int skip_line(const char *word) {
+    CcrpVM *vm = ccrp_vm;
+    ControlState *cs = &vm->control_state;
+    if (strncmp(word, "endif", 5) == 0 || strncmp(word, "endwhile", 8) == 0 || strncmp(word, "endfor", 6) == 0) {
+        if (cs->skip_depth == 1) return 0;
+        cs->skip_depth--;
+    } else if (strncmp(word, "else", 4) == 0) {
+        return cs->skip_depth > 1;
+    } else if (strcmp(word, "parallel") == 0) {
+        int end = ccrp_parallel_end(vm->current_lines, vm->current_line_count, vm->current_line_index);
+        if (end >= 0) vm->current_line_index = end;
+    } else if (strncmp(word, "if", 2) == 0 || strncmp(word, "while", 5) == 0 || strcmp(word, "for") == 0) {
+        cs->skip_depth++;
+    }
+    return 1;
 }
 
-void handle_else_statement(void) {
-    if (control_state.in_if_block) {
-        control_state.skip_to_end = control_state.if_condition_true;
+void handle_if_statement(const char *condition) {
+    ControlState *cs = &ccrp_vm->control_state;
+    ControlBlock *b = push_block(BLOCK_IF);
+    if (!b) return;
+    b->taken = eval_condition(condition);
+    cs->skip_depth = !b->taken;
+}
+
+// `else` or `else if COND`: after a branch that ran, skip to endif;
+// otherwise run this branch if its condition holds
+void handle_else_statement(const char *line) {
+    ControlState *cs = &ccrp_vm->control_state;
+    ControlBlock *b = top_block(BLOCK_IF);
+    if (!b) return;
+    if (!cs->skip_depth || b->taken) {
+        cs->skip_depth = 1;
+        return;
     }
+    char condition[256];
+    b->taken = sscanf(line, " else if %255[^\n]", condition) == 1 ? eval_condition(condition) : 1;
+    cs->skip_depth = !b->taken;
 }
 
 void handle_endif_statement(void) {
-    control_state.in_if_block = 0;
-    control_state.if_condition_true = 0;
-    control_state.skip_to_end = 0;
+    pop_block(BLOCK_IF);
 }
 
 void handle_while_statement(const char *condition) {
-    control_state.in_while_loop = 1;
-    control_state.while_condition_true = eval_condition(condition);
-    control_state.loop_start_line = current_line_index;
-    control_state.skip_to_end = !control_state.while_condition_true;
+    ControlState *cs = &ccrp_vm->control_state;
+    if (!push_block(BLOCK_WHILE)) return;
+    cs->skip_depth = !eval_condition(condition);
 }
 
+// The while line is run again, so its condition is evaluated (and cached) in one place
 void handle_endwhile_statement(void) {
-    if (control_state.in_while_loop && control_state.while_condition_true) {
-        char *while_line = current_lines[control_state.loop_start_line];
-        char condition[256];
-        if (sscanf(while_line, "while %255[^\n]", condition) == 1) {
-            control_state.while_condition_true = eval_condition(condition);
-            if (control_state.while_condition_true) {
-                current_line_index = control_state.loop_start_line;
-            } else {
-                control_state.in_while_loop = 0;
-                control_state.while_condition_true = 0;
-                control_state.loop_start_line = 0;
-                control_state.skip_to_end = 0;
-            }
+    CcrpVM *vm = ccrp_vm;
+    ControlBlock *b = top_block(BLOCK_WHILE);
+    if (b && !vm->control_state.skip_depth) vm->current_line_index = b->line - 1;
+    pop_block(BLOCK_WHILE);
+}
+
+// `for NAME in START..END`: fills the three parts (caller frees), 0 if malformed
+int parse_for_header(const char *line, char **var, char **start, char **end) {
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (strncmp(p, "for", 3) != 0 || (p[3] != ' ' && p[3] != '\t')) return 0;
+    p += 3;
+    while (*p == ' ' || *p == '\t') p++;
+    const char *name = p;
+    while (isalnum((unsigned char)*p) || *p == '_') p++;
+    const char *name_end = p;
+    while (*p == ' ' || *p == '\t') p++;
+    if (name_end == name || strncmp(p, "in", 2) != 0 || (p[2] != ' ' && p[2] != '\t')) return 0;
+    p += 2;
+    // split the range at the first `..` outside quotes and parentheses
+    const char *dots = NULL;
+    int depth = 0, in_str = 0;
+    for (const char *q = p; *q && !dots; q++) {
+        if (*q == '"') in_str = !in_str;
+        else if (!in_str && *q == '(') depth++;
+        else if (!in_str && *q == ')') depth--;
+        else if (!in_str && depth == 0 && q[0] == '.' && q[1] == '.') dots = q;
+    }
+    if (!dots) return 0;
+    *var = g_strndup(name, (gsize)(name_end - name));
+    *start = g_strstrip(g_strndup(p, (gsize)(dots - p)));
+    *end = g_strstrip(g_strdup(dots + 2));
+    return 1;
+}
+
+// `NAME[INDEX] = RHS`: fills the three parts (caller frees), 0 if the line is
+// anything else
+int parse_index_assignment(const char *line, char **var, char **index, char **rhs) {
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    const char *name = p;
+    while (isalnum((unsigned char)*p) || *p == '_') p++;
+    if (p == name || *p != '[') return 0;
+    const char *name_end = p, *open = p;
+    int depth = 0, in_str = 0;
+    for (; *p; p++) {
+        if (*p == '"') in_str = !in_str;
+        else if (!in_str && *p == '[') depth++;
+        else if (!in_str && *p == ']' && --depth == 0) break;
+    }
+    if (*p != ']') return 0;
+    const char *close = p++;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p != '=' || p[1] == '=') return 0;
+    p++;
+    while (*p == ' ' || *p == '\t') p++;
+    if (!*p) return 0;
+    *var = g_strndup(name, (gsize)(name_end - name));
+    *index = g_strndup(open + 1, (gsize)(close - open - 1));
+    *rhs = g_strdup(p);
+    return 1;
+}
+
+// `name(args)` on its own line, run for its effects (push(a, x), a user function)
+int is_call_statement(const char *line) {
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    const char *name = p;
+    while (isalnum((unsigned char)*p) || *p == '_') p++;
+    if (p == name || isdigit((unsigned char)*name)) return 0;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p != '(') return 0;
+    const char *end = p + strlen(p);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return end[-1] == ')';
+}
+
+void handle_for_statement(const char *line) {
+    CcrpVM *vm = ccrp_vm;
+    char *var, *start, *end;
+    if (!parse_for_header(line, &var, &start, &end)) {
+        ccrp_out_printf("Error: expected 'for NAME in START..END'\n");
+        return;
+    }
+    Value from = eval_value_at(start, 1), to = eval_value_at(end, 2);
+    ControlBlock *b = push_block(BLOCK_FOR);
+    if (b) {
+        b->for_slot = var_slot(var);
+        b->for_end = value_to_int(to);
+        value_assign(&vm->vars[b->for_slot], value_int(value_to_int(from)));
+        vm->control_state.skip_depth = value_to_int(from) >= b->for_end;
+    }
+    value_release(from);
+    value_release(to);
+    g_free(var); g_free(start); g_free(end);
+}
+
+void handle_endfor_statement(void) {
+    CcrpVM *vm = ccrp_vm;
+    ControlBlock *b = top_block(BLOCK_FOR);
+    if (b && !vm->control_state.skip_depth) {
+        Value *v = &vm->vars[b->for_slot];
+        int64_t next = value_to_int(*v) + 1;
+        value_assign(v, value_int(next));
+        if (next < b->for_end) {
+            vm->current_line_index = b->line;
+            return;
         }
-    } else {
-        control_state.in_while_loop = 0;
-        control_state.while_condition_true = 0;
-        control_state.loop_start_line = 0;
-        control_state.skip_to_end = 0;
     }
+    pop_block(BLOCK_FOR);
 }
 
 static void handle_function_definition_line(const char *line) {
+    CcrpVM *vm = ccrp_vm;
     char func_def[256];
-    if (sscanf(line, "%*s %[^{]", func_def) == 1) {
-        char func_name[MAX_FUNCTION_NAME] = {0};
-        const char *paren = strchr(func_def, '(');
-        if (!paren) return;
-        size_t name_len = (size_t)(paren - func_def);
-        if (name_len >= sizeof(func_name)) name_len = sizeof(func_name) - 1;
-        strncpy(func_name, func_def, name_len);
-        func_name[name_len] = '\0';
-        int body_start = current_line_index + 1;
-        int body_end = find_matching_end(current_lines, current_line_count, current_line_index, "{", "}");
+    if (sscanf(line, "%*s %255[^{]", func_def) == 1) {
+        int body_start = vm->current_line_index + 1;
+        int body_end = find_matching_end(vm->current_lines, vm->current_line_count, vm->current_line_index, "{", "}");
         if (body_end > body_start) {
-            char body[MAX_FUNCTION_BODY] = "";
-            for (int j = body_start; j < body_end; j++) {
-                strcat(body, current_lines[j]);
-                strcat(body, "\n");
-            }
-            define_function(func_name, body, body_start, body_end);
-            current_line_index = body_end;
+            define_function_block(func_def, vm->current_lines, body_start, body_end);
+            vm->current_line_index = body_end;
         }
     }
 }
@@ -744,11 +663,14 @@ void handle_input_statement(const char *line) {
     } else if (sscanf(line, "input %49s", var) == 1) {
         sprintf(prompt, "Enter value for %s: ", var);
     } else { return; }
+    ccrp_out_flush(); // everything printed so far is visible before waiting for input
     if (get_input_from_gui) {
         int val = get_input_from_gui(prompt);
         set_var(var, val);
     } else {
-        printf("%s", prompt); fflush(stdout);
+        ccrp_out_str(prompt);
+        ccrp_out_flush();
+        ccrp_tasks_wait_input(0);
         int val; if (scanf("%d", &val) == 1) set_var(var, val);
         int c; while ((c = getchar()) != '\n' && c != EOF);
     }
@@ -760,43 +682,60 @@ void handle_input_text_statement(const char *line) {
     } else if (sscanf(line, "input_text %49s", var) == 1) {
         sprintf(prompt, "Enter text for %s: ", var);
     } else { return; }
+    ccrp_out_flush();
     if (get_text_input_from_gui) {
         char *text = get_text_input_from_gui(prompt);
         if (text) { set_string_var(var, text); free(text); }
     } else {
-        printf("%s", prompt); fflush(stdout);
-        char text[MAX_STRING_LENGTH];
-        if (fgets(text, MAX_STRING_LENGTH, stdin) != NULL) {
-            text[strcspn(text, "\n")] = 0;
-            set_string_var(var, text);
-        }
+        ccrp_out_str(prompt);
+        ccrp_out_flush();
+        ccrp_tasks_wait_input(0);
+        GString *text = g_string_new(NULL);
+        int c;
+        while ((c = getchar()) != EOF && c != '\n') g_string_append_c(text, (gchar)c);
+        if (c != EOF || text->len > 0) set_value(var, value_string_len(text->str, text->len));
+        g_string_free(text, TRUE);
     }
 }
 
 // ------------------------ Dispatcher ------------------------
-void run_line(const char *line) {
+// First ',' outside quotes and brackets, so `print "a", max(1, 2)` splits in two
+static char* find_top_level_comma(char *s) {
+    int depth = 0, in_str = 0;
+    for (; *s; s++) {
+        if (*s == '"') in_str = !in_str;
+        else if (!in_str && (*s == '(' || *s == '[' || *s == '{')) depth++;
+        else if (!in_str && (*s == ')' || *s == ']' || *s == '}')) depth--;
+        else if (!in_str && depth == 0 && *s == ',') return s;
+    }
+    return NULL;
+}
+
+static void run_line_raw(char *raw) {
+    // Indentation is not significant
+    while (*raw == ' ' || *raw == '\t') raw++;
+
     // Strip '//' comments
-    char raw[512]; strncpy(raw, line, sizeof(raw)-1); raw[sizeof(raw)-1] = '\0';
     char *cpos = strstr(raw, "//");
     if (cpos) *cpos = '\0';
 
     char trimmed_line[256];
     if (sscanf(raw, " %255s", trimmed_line) != 1) return;
 
-    if (control_state.skip_to_end &&
-        strncmp(trimmed_line, "else", 4) != 0 &&
-        strncmp(trimmed_line, "endif", 5) != 0 &&
-        strncmp(trimmed_line, "endwhile", 8) != 0) return;
+    if (ccrp_vm->control_state.skip_depth && skip_line(trimmed_line)) return;
 
     // Style block
     if (strncmp(trimmed_line, "style", 5) == 0 && strchr(raw, '{')) { handle_style_block(raw); return; }
 
-    // Pragma-based library import: #[lib]
+    // Pragma-based library import: #[lib], or #[use lib] for qualified names only
     if (trimmed_line[0] == '#' && trimmed_line[1] == '[') {
         char lib[50];
-        if (sscanf(raw, " #[%49[^]]]", lib) == 1 || sscanf(raw, "#[%49[^]]]", lib) == 1) {
+        if (sscanf(raw, " #[use %49[^]]]", lib) == 1) {
             import_lib(lib);
-            load_library(lib);
+            load_library(lib, 1);
+        } else if (sscanf(raw, " #[%49[^]]]", lib) == 1) {
+            import_lib(lib);
+            load_library(lib, 0);
         }
         return;
     }
@@ -804,7 +743,7 @@ void run_line(const char *line) {
     // Library import: [src] math
     if (strncmp(trimmed_line, "[src]", 5) == 0) {
         char lib[50];
-        if (sscanf(raw, "[src] %49s", lib) == 1 || sscanf(raw, " [src] %49s", lib) == 1) { import_lib(lib); load_library(lib); }
+        if (sscanf(raw, "[src] %49s", lib) == 1 || sscanf(raw, " [src] %49s", lib) == 1) { import_lib(lib); load_library(lib, 0); }
         return;
     }
 
@@ -895,12 +834,15 @@ void run_line(const char *line) {
     if (strncmp(trimmed_line, "if", 2) == 0) {
         char condition[256]; if (sscanf(raw, "if %255[^\n]", condition) == 1) handle_if_statement(condition); return;
     }
-    if (strncmp(trimmed_line, "else", 4) == 0) { handle_else_statement(); return; }
+    if (strncmp(trimmed_line, "else", 4) == 0) { handle_else_statement(raw); return; }
     if (strncmp(trimmed_line, "endif", 5) == 0) { handle_endif_statement(); return; }
     if (strncmp(trimmed_line, "while", 5) == 0) {
         char condition[256]; if (sscanf(raw, "while %255[^\n]", condition) == 1) handle_while_statement(condition); return;
     }
     if (strncmp(trimmed_line, "endwhile", 8) == 0) { handle_endwhile_statement(); return; }
+    if (strcmp(trimmed_line, "for") == 0) { handle_for_statement(raw); return; }
+    if (strncmp(trimmed_line, "endfor", 6) == 0) { handle_endfor_statement(); return; }
+    if (strcmp(trimmed_line, "parallel") == 0) { handle_parallel_for(raw); return; }
 
     // Input
     if (strncmp(raw, "input_text ", 11) == 0) { handle_input_text_statement(raw); return; }
@@ -908,60 +850,57 @@ void run_line(const char *line) {
 
     // Print: supports comma-separated items
     if (strncmp(raw, "print ", 6) == 0) {
-        char expr[256];
-        if (sscanf(raw, "print %255[^\n]", expr) == 1) {
-            if (expr[0] == '"' && expr[strlen(expr)-1] == '"') {
-                expr[strlen(expr)-1] = '\0'; printf("%s\n", expr + 1);
-            } else {
-                char *current = expr;
-                int has_comma = strchr(expr, ',') != NULL;
-                if (!has_comma) {
-                    // single item: try string var else eval
-                    for (int i = 0; i < var_count; i++) {
-                        if (strcmp(vars[i].name, expr) == 0 && vars[i].is_string) { printf("%s\n", vars[i].string_value); return; }
-                    }
-                    printf("%d\n", eval_expr(expr));
-                } else {
-                    while (current && *current) {
-                        while (*current == ' ') current++;
-                        if (!*current) break;
-                        char temp[256];
-                        char *next_comma = strchr(current, ',');
-                        if (next_comma) {
-                            int len = (int)(next_comma - current);
-                            if (len > 255) len = 255;
-                            strncpy(temp, current, len); temp[len] = '\0';
-                            current = next_comma + 1;
-                        } else {
-                            strncpy(temp, current, 255); temp[255] = '\0';
-                            current = NULL;
-                        }
-                        char *t = temp; while (*t == ' ') t++;
-                        char *e = t + strlen(t) - 1; while (e > t && *e == ' ') e--; *(e+1)='\0';
-                        if (t[0] == '"' && t[strlen(t)-1] == '"') { t[strlen(t)-1] = '\0'; printf("%s", t+1); }
-                        else {
-                            int printed = 0;
-                            for (int i = 0; i < var_count; i++) {
-                                if (strcmp(vars[i].name, t) == 0 && vars[i].is_string) { printf("%s", vars[i].string_value); printed=1; break; }
-                            }
-                            if (!printed) printf("%d", eval_expr(t));
-                        }
-                    }
-                    printf("\n");
-                }
+        char *current = raw + 6;
+        while (current && *current) {
+            while (*current == ' ') current++;
+            if (!*current) break;
+            char *t = current;
+            char *next_comma = find_top_level_comma(current);
+            if (next_comma) { *next_comma = '\0'; current = next_comma + 1; }
+            else current = NULL;
+            char *e = t + strlen(t) - 1; while (e > t && *e == ' ') e--; *(e+1)='\0';
+            size_t len = strlen(t);
+            if (len >= 2 && t[0] == '"' && t[len-1] == '"') ccrp_out_write(t + 1, len - 2);
+            else {
+                Value v = eval_value_at(t, (int)(t - raw));
+                value_print(v);
+                value_release(v);
             }
         }
+        ccrp_out_char('\n');
+        return;
+    }
+    if (strcmp(trimmed_line, "flush") == 0) { ccrp_out_flush(); return; }
+
+    // Tasks: spawn f(args), await t, sleep ms
+    if (ccrp_task_statement(raw)) return;
+
+    // Element assignment: a[i] = value
+    char *target, *index, *rhs;
+    if (parse_index_assignment(raw, &target, &index, &rhs)) {
+        const Expr *ie = ccrp_expr_cached(ccrp_vm->current_line_index, -2, index);
+        const Expr *re = ccrp_expr_cached(ccrp_vm->current_line_index, -1, rhs);
+        Value x = ccrp_expr_eval(ie), v = ccrp_expr_eval(re);
+        ccrp_index_store(&ccrp_vm->vars[var_slot(target)], target, x, v);
+        value_release(x);
+        value_release(v);
+        g_free(target);
+        g_free(index);
+        g_free(rhs);
         return;
     }
 
-    // Assignment: string or numeric
-    char var[50], rhs[256];
-    if (sscanf(raw, "%49[^ ] = %255[^\n]", var, rhs) == 2) {
-        if (rhs[0] == '"' && rhs[strlen(rhs)-1] == '"') {
-            rhs[strlen(rhs)-1] = '\0'; set_string_var(var, rhs + 1);
-        } else {
-            set_var(var, eval_expr(rhs));
-        }
+    // Assignment: any expression, string literals included
+    char var[50]; int rhs_at = 0;
+    if (sscanf(raw, "%49[^ ] = %n", var, &rhs_at) == 1 && rhs_at > 0 && raw[rhs_at]) {
+        Expr *e = ccrp_expr_cached(ccrp_vm->current_line_index, -1, raw + rhs_at);
+        ccrp_expr_assign(e, 0, var_slot(var));
+        return;
+    }
+
+    // Call statement
+    if (is_call_statement(raw)) {
+        value_release(ccrp_expr_eval(ccrp_expr_cached(ccrp_vm->current_line_index, -1, raw)));
         return;
     }
 
@@ -971,35 +910,113 @@ void run_line(const char *line) {
     }
 }
 
+void run_line(const char *line) {
+    // Work on a writable copy; long lines spill to the heap instead of truncating
+    char small[512];
+    size_t n = strlen(line);
+    char *raw = n < sizeof(small) ? small : malloc(n + 1);
+    memcpy(raw, line, n + 1);
+    run_line_raw(raw);
+    if (raw != small) free(raw);
+}
+
 // ------------------------ Libraries table ------------------------
 void import_lib(const char *lib) {
-    if (lib_count < MAX_LIBS) {
-        strcpy(active_libs[lib_count++], lib);
+    if (ccrp_vm->lib_count < MAX_LIBS) {
+        strcpy(ccrp_vm->active_libs[ccrp_vm->lib_count++], lib);
     } else {
-        printf("Error: Max libraries reached.\n");
+        ccrp_out_printf("Error: Max libraries reached.\n");
     }
 }
 
 int lib_enabled(const char *lib) {
-    for (int i = 0; i < lib_count; i++) if (strcmp(active_libs[i], lib) == 0) return 1;
+    for (int i = 0; i < ccrp_vm->lib_count; i++) if (strcmp(ccrp_vm->active_libs[i], lib) == 0) return 1;
     return 0;
 }
 
 // ------------------------ Interpreter driver ------------------------
 void interpret_lines(char **lines, int line_count, int start_line) {
-    current_lines = lines; current_line_count = line_count;
-    for (current_line_index = start_line; current_line_index < line_count; current_line_index++) {
-        run_line(lines[current_line_index]);
-        if (current_line_index < start_line) start_line = current_line_index;
+    CcrpVM *vm = ccrp_vm;
+    vm->current_lines = lines; vm->current_line_count = line_count;
+    for (vm->current_line_index = start_line; vm->current_line_index < line_count; vm->current_line_index++) {
+        if (g_atomic_int_get(vm->interrupt)) break;
+        if (vm->profiling) ccrp_profile_line(NULL, lines, line_count, vm->current_line_index);
+        run_line(lines[vm->current_line_index]);
+        if (vm->current_line_index < start_line) start_line = vm->current_line_index;
     }
 }
 
+void interpret_source(char **lines, int line_count) {
+    ControlState *cs = &ccrp_vm->control_state;
+    cs->depth = 0; cs->skip_depth = 0;
+    cs->in_function = 0; cs->should_return = 0; cs->function_return_value = 0;
+    interpret_lines(lines, line_count, 0);
+    ccrp_tasks_finish();
+    ccrp_vm->current_lines = NULL; ccrp_vm->current_line_count = 0;
+}
+
 void interpret(const gchar *code) {
     int line_count; char **lines = split_lines(code, &line_count);
-    control_state.in_if_block = 0; control_state.if_condition_true = 0;
-    control_state.in_while_loop = 0; control_state.while_condition_true = 0;
-    control_state.loop_start_line = 0; control_state.skip_to_end = 0;
-    control_state.in_function = 0; control_state.should_return = 0; control_state.function_return_value = 0;
-    interpret_lines(lines, line_count, 0);
-    free_lines(lines, line_count); current_lines = NULL; current_line_count = 0;
-}
\ No newline at end of file
+    interpret_source(lines, line_count);
+    free_lines(lines, line_count);
+}
+// ------------------------ VM lifecycle ------------------------
+CcrpVM* ccrp_vm_new(void) {
+    CcrpVM *vm = calloc(1, sizeof(CcrpVM));
+    vm->out_fd = 1;
+    vm->interrupt = &vm->interrupt_flag;
+    return vm;
+}
+
+// Ask the run on vm to stop: loops, calls and waiting tasks check the flag and
+// unwind. An embedder whose script may be sleeping should also wake the
+// thread's main context (g_main_context_wakeup).
+void ccrp_vm_interrupt(CcrpVM *vm) {
+    g_atomic_int_set(&vm->interrupt_flag, 1);
+}
+
+// Run a script on vm, which is the current VM of this thread until it returns.
+// Globals, functions and imports stay in vm for the next run.
+void ccrp_vm_run(CcrpVM *vm, char **lines, int line_count, CcrpRunMode mode) {
+    CcrpVM *outer = ccrp_vm;
+    ccrp_vm = vm;
+    if (mode == CCRP_RUN_DUMP) dump_optimized_source(lines, line_count);
+    else if (mode == CCRP_RUN_BYTECODE) interpret_vm_source(lines, line_count);
+    else interpret_source(lines, line_count);
+    ccrp_out_flush();
+    g_atomic_int_set(&vm->interrupt_flag, 0);
+    ccrp_vm = outer;
+}
+
+static void function_free(Function *fn) {
+    free_lines(fn->lines, fn->line_count);
+    for (int i = 0; i < fn->param_count; i++) g_free(fn->params[i]);
+    free(fn->params);
+    for (int i = 0; i < fn->local_count; i++) g_free(fn->local_names[i]);
+    free(fn->local_names);
+    free(fn->local_int);
+    ccrp_program_free(fn->program);
+    free(fn);
+}
+
+void ccrp_vm_free(CcrpVM *vm) {
+    if (!vm) return;
+    for (int i = 0; i < vm->var_count; i++) value_release(vm->vars[i]);
+    free(vm->vars);
+    free(vm->var_names);
+    for (int i = 0; i < vm->symbol_capacity; i++) g_free((char*)vm->symbols[i].name);
+    free(vm->symbols);
+    // expressions hold interned literals, so they go before the arena
+    if (vm->expr_cache) g_hash_table_destroy(vm->expr_cache);
+    for (int i = 0; i < vm->function_count; i++) function_free(vm->functions[i]);
+    free(vm->functions);
+    if (vm->function_table) g_hash_table_destroy(vm->function_table);
+    ccrp_libraries_free(vm);
+    ccrp_stacks_free(vm);
+    ccrp_interned_free(vm);
+    if (vm->gtk_objects) g_hash_table_destroy(vm->gtk_objects);
+    if (vm->css_providers) g_ptr_array_free(vm->css_providers, TRUE);
+    ccrp_output_free(vm); // flushes what is left
+    if (ccrp_vm == vm) ccrp_vm = NULL;
+    free(vm);
+}
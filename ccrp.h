@@ -2,82 +2,336 @@
 #define CCRP_H
 
 #include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
 
-#define MAX_VARS 100
 #define MAX_LIBS 10
-#define MAX_STACK_DEPTH 100
-#define MAX_STRING_LENGTH 256
-#define MAX_FUNCTIONS 50
+#define MAX_STACK_DEPTH 10000000  // interpreter frames, kept on the heap
+#define MAX_NATIVE_DEPTH 1000     // nested entries into the VM from C (run_line, builtins)
 #define MAX_FUNCTION_NAME 50
-#define MAX_FUNCTION_BODY 1000
 
+// Reference-counted string. Shared strings are immutable; a string with a
+// single owner may be appended to in place (see value_concat).
 typedef struct {
-    char name[50];
-    int value;
-    char string_value[MAX_STRING_LENGTH];
-    int is_string;
-} Variable;
+    int refcount;
+    size_t length;
+    size_t capacity;    // bytes available in data, excluding the terminator
+    char data[];
+} CcrpString;
+
+// Starting refcount of interned strings: never reaches zero, never unique
+#define CCRP_STRING_PINNED (1 << 30)
+
+// Reference-counted array of 64-bit numbers in one contiguous block. All
+// elements are ints or all are doubles; storing a double into an int array
+// converts it. Arrays are shared by reference: `b = a` aliases, `a[:]` copies.
+typedef struct {
+    int refcount;
+    int is_double;
+    size_t length;
+    size_t capacity;
+    union {
+        int64_t *i;
+        double *d;
+    } data;
+} CcrpArray;
+
+typedef struct CcrpMap CcrpMap;
+typedef struct CcrpVM CcrpVM;
+
+typedef enum {
+    VAL_INT,
+    VAL_DOUBLE,
+    VAL_STR,
+    VAL_ARRAY,
+    VAL_MAP
+} ValueType;
+
+// 16-byte tagged value used for variables, locals and expression results
+typedef struct {
+    ValueType type;
+    union {
+        int64_t i;
+        double d;
+        CcrpString *s;
+        CcrpArray *a;
+        CcrpMap *m;
+    } as;
+} Value;
+
+// Reference-counted hash map from int or string keys to any value, iterated
+// in insertion order. Entries live in one dense array; the index is a Robin
+// Hood open-addressing table of (entry, hash) pairs, so a probe compares
+// hashes in one cache line before touching an entry. Shared by reference
+// like arrays.
+typedef struct {
+    Value key;
+    Value value;
+    uint32_t hash;
+    uint32_t deleted;
+} CcrpMapEntry;
+
+typedef struct {
+    uint32_t entry;     // index into entries, CCRP_MAP_EMPTY when free
+    uint32_t hash;
+} CcrpMapSlot;
+
+struct CcrpMap {
+    int refcount;
+    size_t count;       // live entries
+    size_t used;        // entries[] in use, including deleted ones
+    size_t capacity;    // entries[] allocated
+    CcrpMapEntry *entries;
+    CcrpMapSlot *slots;
+    size_t mask;        // slot count - 1 (a power of two)
+};
+
+CcrpString* ccrp_string_new(const char *text, size_t length);
+CcrpString* ccrp_string_sized(size_t length);
+void ccrp_string_free(CcrpString *s);
+Value value_string(const char *text);
+Value value_string_len(const char *text, size_t length);
+Value value_string_intern(const char *text, size_t length);
+void ccrp_interned_free(CcrpVM *vm);
+Value value_concat(Value left, Value right);
+Value value_to_string(Value v);
+int64_t value_to_int(Value v);
+double value_to_double(Value v);
+int value_truthy(Value v);
+const char* value_cstr(Value v);
+void value_print(Value v);
+
+static inline Value value_int(int64_t i) { Value v; v.type = VAL_INT; v.as.i = i; return v; }
+static inline Value value_double(double d) { Value v; v.type = VAL_DOUBLE; v.as.d = d; return v; }
+void ccrp_array_free(CcrpArray *a);
+void ccrp_map_free(CcrpMap *m);
+
+static inline Value value_retain(Value v) {
+    if (v.type == VAL_STR) v.as.s->refcount++;
+    else if (v.type == VAL_ARRAY) v.as.a->refcount++;
+    else if (v.type == VAL_MAP) v.as.m->refcount++;
+    return v;
+}
+static inline void value_release(Value v) {
+    if (v.type == VAL_STR) { if (--v.as.s->refcount == 0) ccrp_string_free(v.as.s); }
+    else if (v.type == VAL_ARRAY) { if (--v.as.a->refcount == 0) ccrp_array_free(v.as.a); }
+    else if (v.type == VAL_MAP && --v.as.m->refcount == 0) ccrp_map_free(v.as.m);
+}
+// Store v (already owned by the caller) into *dst, dropping the old value
+static inline void value_assign(Value *dst, Value v) { Value old = *dst; *dst = v; value_release(old); }
+// Int in a slot the type inference proved int; the tag check keeps a wrong
+// proof from reading a pointer as a number
+static inline int64_t value_as_int(const Value *v) { return v->type == VAL_INT ? v->as.i : value_to_int(*v); }
+
+typedef struct Program Program;
 
 typedef struct {
     char name[MAX_FUNCTION_NAME];
-    char body[MAX_FUNCTION_BODY];
+    char **lines;       // body source lines
+    int line_count;
     int start_line;
     int end_line;
     int param_count;
-    char params[10][50]; // Support up to 10 parameters
+    char **params;
+    int local_count;    // params first, then names assigned in the body
+    char **local_names;
+    char *local_int;    // per local: provably always an int (set by ccrp_infer_types)
+    int returns_int;    // every return yields an int
+    Program *program;   // compiled on first call
+    const char *source; // library file the body comes from, NULL for the script
 } Function;
 
-// Control flow state
+// Control flow state of the line interpreter: the blocks open at the current line
+#define MAX_BLOCK_DEPTH 256
+
+typedef enum { BLOCK_IF, BLOCK_WHILE, BLOCK_FOR } BlockKind;
+
 typedef struct {
-    int in_if_block;
-    int if_condition_true;
-    int in_while_loop;
-    int while_condition_true;
-    int loop_start_line;
-    int skip_to_end;
+    BlockKind kind;
+    int line;           // the if/while/for line
+    int taken;          // if: some branch has run
+    int for_slot;       // loop variable in vars[]
+    int64_t for_end;    // exclusive upper bound, evaluated once
+} ControlBlock;
+
+typedef struct {
+    ControlBlock blocks[MAX_BLOCK_DEPTH];
+    int depth;
+    int skip_depth;     // > 0: skipping lines; 1 + the blocks opened since skipping began
     int in_function;
     char current_function[MAX_FUNCTION_NAME];
     int function_return_value;
     int should_return;
 } ControlState;
 
-// Function pointer for getting GUI input
+// ------------------------ Interpreter instances ------------------------
+// Everything one script run owns. Each thread has a current VM (ccrp_vm),
+// which ccrp_vm_run sets for the length of the run, so VMs on different
+// threads share only read-only tables and can run at the same time. A VM
+// must not run on two threads at once, and values must not be handed from one
+// VM to another: reference counts are not atomic.
+
+// Receives script output instead of a file descriptor (ccrp_output_sink); it
+// is called on the VM's thread and, during a parallel for, on worker threads
+typedef void (*CcrpOutputSink)(const char *data, size_t length, void *user_data);
+
+struct CcrpVM {
+    // Globals: values by slot, names in an open-addressing symbol table (ccrp.c)
+    Value *vars;
+    const char **var_names;
+    int var_count;
+    int var_capacity;
+    struct SymbolEntry *symbols;
+    int symbol_capacity;
+
+    // Every function definition, in order; see get_function for lookup
+    Function **functions;
+    int function_count;
+    int function_capacity;
+    GHashTable *function_table; // name -> first Function* of that name
+
+    char active_libs[MAX_LIBS][50];
+    int lib_count;
+    GHashTable *libraries;      // ccrp_library.c: library name -> Library*
+    GHashTable *library_index;  // function name -> LibraryFunction*
+
+    // Tree-walker state
+    ControlState control_state;
+    char **current_lines;
+    int current_line_count;
+    int current_line_index;
+    GHashTable *expr_cache;     // ccrp_expr.c: parsed expressions by line and column
+
+    // Bytecode VM stacks (ccrp_vm.c)
+    struct Frame *frames;
+    int frame_count;
+    int frame_capacity;
+    Value *local_stack;
+    int local_top;
+    int local_capacity;
+    Value *stack;
+    int sp;
+    int stack_capacity;
+    int native_depth;
+    Value *frame_locals;        // locals of the executing function call
+
+    // Coroutine tasks (ccrp_task.c); the stacks above belong to the running task
+    struct TaskScheduler *scheduler; // NULL until the first spawn or suspension
+    int task_resumable;         // the next vm_run starts or resumes a task and may suspend it
+
+    // Interned string literals (ccrp_value.c)
+    struct ArenaBlock *arena;
+    GHashTable *interned;       // text -> CcrpString*, keys point into the strings
+
+    // Script output (ccrp_output.c)
+    char *out_buf;
+    size_t out_len;
+    size_t out_size;
+    int out_fd;
+    int out_line_flush;
+    int out_owns_fd;
+    CcrpOutputSink out_sink;    // when set, replaces out_fd
+    void *out_sink_data;
+
+    // Widgets and CSS providers created by the script (ccrp.c)
+    GHashTable *gtk_objects;
+    GPtrArray *css_providers;
+    void *gtk_main_window;
+    int gtk_closed;             // a window was destroyed: ends `gtk run`
+
+    int profiling;              // ccrp_profile.c hooks are live
+    int parallel_worker;        // runs a parallel for body: nested ones stay on this thread
+    gint interrupt_flag;        // set by ccrp_vm_interrupt
+    gint *interrupt;            // flag polled while running: interrupt_flag, or the parent's in a worker
+};
+
+typedef enum {
+    CCRP_RUN_TREE,      // line-by-line interpreter
+    CCRP_RUN_BYTECODE,  // compile and run on the bytecode VM (--vm)
+    CCRP_RUN_DUMP       // compile and list the optimized bytecode (--dump-optimized)
+} CcrpRunMode;
+
+extern __thread CcrpVM *ccrp_vm;   // VM running on this thread, NULL outside ccrp_vm_run
+
+CcrpVM* ccrp_vm_new(void);
+void ccrp_vm_run(CcrpVM *vm, char **lines, int line_count, CcrpRunMode mode);
+void ccrp_vm_free(CcrpVM *vm);
+void ccrp_vm_interrupt(CcrpVM *vm);    // from any thread: stop the current run soon
+
+// Variable named by a resolved slot: a local of the current call or a global
+#define CCRP_VAR(is_local, slot) ((is_local) ? &ccrp_vm->frame_locals[slot] : &ccrp_vm->vars[slot])
+
+// Function pointer for getting GUI input (process-wide)
 extern int (*get_input_from_gui)(const char *prompt);
 extern char* (*get_text_input_from_gui)(const char *prompt);
 
 // Core interpreter functions
 void interpret(const gchar *code);
+void interpret_source(char **lines, int line_count);
 void interpret_lines(char **lines, int line_count, int start_line);
-int get_var(const char *name);
-void set_var(const char *name, int value);
-char* get_string_var(const char *name);
+int64_t get_var(const char *name);
+void set_var(const char *name, int64_t value);
+const char* get_string_var(const char *name);
 void set_string_var(const char *name, const char *value);
-int eval_expr(const char *expr);
+int is_string_var(const char *name);
+Value get_value(const char *name);
+void set_value(const char *name, Value value);
+int find_var_slot(const char *name);
+int var_slot(const char *name);
+int64_t eval_expr(const char *expr);
 int eval_condition(const char *condition);
 void run_line(const char *line);
 void import_lib(const char *lib);
 int lib_enabled(const char *lib);
 
 // Function management
-void define_function(const char *name, const char *body, int start_line, int end_line);
+void define_function(const char *name, const char *params, const char *body, int start_line, int end_line);
+Function* ccrp_function_new(const char *name, const char *params, const char *body, int start_line, int end_line);
 Function* get_function(const char *name);
-int call_function(const char *name, char **args, int arg_count);
-void parse_function_parameters(const char *func_def, char *name, char params[10][50], int *param_count);
+Function* ccrp_call_target(const char *name, int arg_count);
+Value call_function(const char *name, char **args, int arg_count);
+Value ccrp_call(Function *fn, const Value *args, int arg_count);
+char** parse_function_parameters(const char *param_list, int *param_count);
 
 // Library loading
-void load_library(const char *lib_name);
+void load_library(const char *lib_name, int qualified_only);
 char* read_library_file(const char *lib_name);
+char** ccrp_library_function_names(const char *lib_name);
+Function* ccrp_library_lookup(const char *name);
+void ccrp_libraries_free(CcrpVM *vm);
+void ccrp_libraries_copy(const CcrpVM *from);
 
-// Math functions
-int math_function(const char *func_name, int arg);
-int math_function_two_args(const char *func_name, int arg1, int arg2);
+// ------------------------ Builtins ------------------------
+// Native function: borrows exactly arity arguments, returns a new reference
+typedef Value (*BuiltinFn)(const Value *args);
+
+#define BUILTIN_PURE 1  // result depends only on the arguments: folded when they are literals
+#define BUILTIN_INT  2  // always returns an int
+
+typedef struct {
+    const char *name;
+    const char *library; // must be imported before scripts can call it
+    int arity;
+    int flags;
+    BuiltinFn fn;
+} Builtin;
+
+const Builtin* ccrp_builtin_find(const char *name, int arg_count);
+const Builtin* ccrp_builtin_at(int i);
+const Builtin* ccrp_builtin_resolve(const char *name, int arg_count);
 
 // Control flow functions
 void handle_if_statement(const char *condition);
-void handle_else_statement(void);
+void handle_else_statement(const char *line);
 void handle_endif_statement(void);
 void handle_while_statement(const char *condition);
 void handle_endwhile_statement(void);
+int parse_for_header(const char *line, char **var, char **start, char **end);
+int parse_index_assignment(const char *line, char **var, char **index, char **rhs);
+int split_assignment(const char *s, char **name, char **rhs);
+int is_call_statement(const char *line);
+void handle_for_statement(const char *line);
+void handle_endfor_statement(void);
 void handle_function_definition(const char *line);
 void handle_return_statement(const char *line);
 
@@ -86,8 +340,283 @@ void handle_input_statement(const char *line);
 void handle_input_text_statement(const char *line);
 
 // Utility functions
-char** split_lines(const char *code, int *line_count);
+char** split_lines(const char *code, int *line_count);  // one allocation; keeps blank lines
 void free_lines(char **lines, int line_count);
 int find_matching_end(char **lines, int line_count, int start_line, const char *start_keyword, const char *end_keyword);
 
+// ------------------------ Arrays ------------------------
+CcrpArray* ccrp_array_new(int is_double, size_t capacity);
+Value value_array(CcrpArray *a);
+int ccrp_array_push(CcrpArray *a, Value v);
+int ccrp_array_equal(const CcrpArray *a, const CcrpArray *b);
+void ccrp_array_format(const CcrpArray *a, GString *out);
+Value ccrp_index_get(Value container, Value index);
+Value ccrp_slice(Value container, const Value *start, const Value *end);
+void ccrp_index_store(Value *target, const char *name, Value index, Value v);
+
+// Kernels (SSE2/AVX2 where available); map ops are BIN_ADD..BIN_MOD
+#if defined(__x86_64__) && defined(__SSE2__) && defined(__GNUC__)
+#define CCRP_X86_SIMD 1
+#endif
+int ccrp_simd_level(void);  // 2: AVX2, 1: SSE2, 0: scalar or CCRP_NO_SIMD set
+Value ccrp_array_sum(const CcrpArray *a);
+Value ccrp_array_min(const CcrpArray *a);
+Value ccrp_array_max(const CcrpArray *a);
+Value ccrp_array_dot(const CcrpArray *a, const CcrpArray *b);
+CcrpArray* ccrp_array_map(const CcrpArray *a, int op, Value b);
+
+// ------------------------ Profiler ------------------------
+void ccrp_profile_start(CcrpVM *vm, const char *script, const char *prefix);
+void ccrp_profile_line(const Function *fn, char **lines, int line_count, int line);
+void ccrp_profile_enter(const Function *fn);
+void ccrp_profile_leave(void);
+void ccrp_profile_finish(void);
+
+// ------------------------ String kernels ------------------------
+Value ccrp_str_case(const char *s, size_t n, int upper);
+size_t ccrp_str_count_byte(const char *s, size_t n, char c);
+int64_t ccrp_str_find(const char *s, size_t n, const char *needle, size_t m, size_t from);
+size_t ccrp_str_count(const char *s, size_t n, const char *needle, size_t m);
+Value ccrp_str_replace(const char *s, size_t n, const char *from, size_t from_len, const char *to, size_t to_len);
+Value ccrp_str_split(const char *s, size_t n, const char *sep, size_t sep_len);
+Value ccrp_str_join(Value parts, const char *sep, size_t sep_len);
+
+// ------------------------ Maps ------------------------
+#define CCRP_MAP_EMPTY UINT32_MAX
+
+CcrpMap* ccrp_map_new(size_t capacity);
+Value value_map(CcrpMap *m);
+int ccrp_map_key_ok(Value key);
+const Value* ccrp_map_find(const CcrpMap *m, Value key);
+void ccrp_map_set(CcrpMap *m, Value key, Value v);
+int ccrp_map_delete(CcrpMap *m, Value key);
+const CcrpMapEntry* ccrp_map_entry(CcrpMap *m, int64_t position);
+void ccrp_map_format(const CcrpMap *m, GString *out);
+
+// ------------------------ Parallel loops ------------------------
+#define MAX_REDUCTIONS 8
+
+// `parallel for NAME in START..END [reduce OP into NAME, ...]`
+typedef struct {
+    char *var;
+    char *start;
+    char *end;
+    int reduction_count;
+    int reduce_op[MAX_REDUCTIONS];      // BIN_ADD (sum), BIN_MUL (product), BIN_LT (min), BIN_GT (max)
+    char *reduce_into[MAX_REDUCTIONS];
+} ParallelHeader;
+
+int ccrp_parallel_parse(const char *line, ParallelHeader *h);
+void ccrp_parallel_header_free(ParallelHeader *h);
+int ccrp_parallel_end(char **lines, int line_count, int header_line);
+void handle_parallel_for(const char *line);
+
+// ------------------------ Source text ------------------------
+typedef struct {
+    size_t offset;
+    size_t length;      // excluding the newline (and a CR before it)
+} LineSpan;
+
+// A script: its text and a line index
+typedef struct {
+    char *text;
+    size_t length;
+    LineSpan *spans;
+    int line_count;
+    char **lines;       // lines[i] = text + spans[i].offset, terminated in place
+} Source;
+
+Source* ccrp_source_open(const char *path);
+Source* ccrp_source_read(int fd);
+void ccrp_source_free(Source *src);
+
+// ------------------------ Output ------------------------
+#define CCRP_OUTPUT_BUFFER (64 * 1024)          // stdout
+#define CCRP_OUTPUT_FILE_BUFFER (1024 * 1024)   // --output FILE
+
+void ccrp_output_init(CcrpVM *vm, int fd, size_t buffer_size);  // 0: default size
+int ccrp_output_open(CcrpVM *vm, const char *path, size_t buffer_size);
+void ccrp_output_sink(CcrpVM *vm, CcrpOutputSink sink, void *user_data, size_t buffer_size);
+void ccrp_output_free(CcrpVM *vm);
+void ccrp_out_write(const char *data, size_t length);
+void ccrp_out_str(const char *text);
+void ccrp_out_char(char c);
+void ccrp_out_printf(const char *fmt, ...);
+void ccrp_out_flush(void);
+
+// ------------------------ Expressions ------------------------
+typedef enum {
+    EXPR_NUM,
+    EXPR_STR,
+    EXPR_VAR,
+    EXPR_NEG,
+    EXPR_NOT,
+    EXPR_BINARY,
+    EXPR_CALL,
+    EXPR_ARRAY,         // [args...]
+    EXPR_MAP,           // {args[0]: args[1], ...}
+    EXPR_INDEX,         // left[right]
+    EXPR_SLICE          // left[args[0]:args[1]], either bound may be NULL
+} ExprKind;
+
+typedef enum {
+    BIN_ADD, BIN_SUB, BIN_MUL, BIN_DIV, BIN_MOD,
+    BIN_EQ, BIN_NE, BIN_LT, BIN_LE, BIN_GT, BIN_GE,
+    BIN_AND, BIN_OR,
+    BIN_CONCAT
+} BinOp;
+
+typedef struct Expr {
+    ExprKind kind;
+    int op;             // BinOp for EXPR_BINARY
+    Value value;        // EXPR_NUM / EXPR_STR constant
+    char *name;         // variable or function name
+    int slot;           // EXPR_VAR: index into vars[] (or the frame locals) once resolved, -1 before
+    int local;          // EXPR_VAR: slot refers to the current call's locals
+    Function *fn;       // EXPR_CALL: user function, looked up on first call
+    const Builtin *builtin; // EXPR_CALL: otherwise the builtin, resolved on first call
+    struct Expr *left;
+    struct Expr *right;
+    struct Expr **args; // EXPR_CALL arguments, EXPR_ARRAY elements, EXPR_MAP keys and values, EXPR_SLICE bounds
+    int arg_count;
+    int int_only;       // the whole tree evaluates on ints (set by ccrp_infer_types)
+} Expr;
+
+Expr* ccrp_expr_parse(const char *src);
+Expr* ccrp_expr_try_parse(const char *src);
+void ccrp_expr_free(Expr *e);
+Value ccrp_expr_eval(const Expr *e);
+int64_t ccrp_expr_eval_int(const Expr *e);
+Value ccrp_apply_unary(ExprKind kind, Value v);
+Value ccrp_apply_binary(int op, Value l, Value r);
+Expr* ccrp_expr_cached(int line, int column, const char *src);
+void ccrp_expr_assign(const Expr *e, int local, int slot);
+void ccrp_expr_cache_clear(void);
+void ccrp_resolve_expr(Expr *e);
+void ccrp_resolve_expr_in(Expr *e, const Function *fn);
+Value eval_value_at(const char *expr, int column);
+
+// ------------------------ Optimizer ------------------------
+int ccrp_expr_is_const(const Expr *e);
+void ccrp_expr_fold(Expr *e);
+
+// ------------------------ Bytecode VM ------------------------
+typedef enum {
+    OP_LINE,            // fall back to run_line for statements without a dedicated op
+    OP_PRINT,
+    OP_ASSIGN,
+    OP_ASSIGN_INT,      // int target, int_only right-hand side
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_FALSE_INT, // int_only condition
+    OP_CMP_JUMP_INT,    // if a <cmp> b on int_only operands; jumps when false
+    OP_ADD_INT,         // x = x + k / x = x - k on an int x
+    OP_FOR_INIT,        // for x in start..limit: set x, jump past the loop if empty
+    OP_FOR_NEXT,        // x += 1, jump back while x < limit
+    OP_RETURN,
+    OP_HALT,
+    // Stack code for expressions that call user functions (see ccrp_lower)
+    OP_PUSH,            // push the value of a call-free expr
+    OP_CALL,            // call callee with imm arguments from the stack, push the result
+    OP_TAILCALL,        // return callee(args): reuses the current frame
+    OP_BUILTIN,         // builtin a with imm arguments from the stack
+    OP_UNARY,           // imm: EXPR_NEG or EXPR_NOT
+    OP_BINARY,          // imm: non-logical BinOp
+    OP_AND_JUMP,        // false top becomes 0 and jumps, otherwise popped
+    OP_OR_JUMP,         // true top becomes 1 and jumps, otherwise popped
+    OP_TRUTHY,          // top becomes 0 or 1
+    OP_STORE,           // pop into the assignment target
+    OP_JUMP_IF_FALSE_POP,
+    OP_PRINT_POP,       // print the popped value without a newline
+    OP_RETURN_POP,
+    OP_STORE_INDEX,     // target[limit] = expr
+    OP_STORE_INDEX_POP, // target[index] = value, both popped (index pushed first)
+    OP_EVAL,            // call statement: evaluate expr and drop it (pop when lowered)
+    OP_SPAWN,           // [target =] spawn expr (a call); imm: 1 with a target
+    OP_AWAIT,           // [target =] await expr; imm: 1 with a target
+    OP_SLEEP,           // sleep expr milliseconds
+    OP_COUNT
+} OpCode;
+
+typedef struct {
+    int is_literal;     // 1: text is printed verbatim, 0: text is an expression
+    char *text;
+    Expr *expr;
+} PrintItem;
+
+typedef struct {
+    const void *handler; // direct-threaded dispatch target, filled in by the VM
+    OpCode op;
+    int line;           // source line index
+    int target;         // jump target (instruction index)
+    int slot;           // assignment target in vars[] (or the frame locals)
+    int local;          // slot refers to the current call's locals
+    char *a;            // variable name, condition or statement text
+    char *b;            // right-hand side or return expression
+    Expr *expr;         // parsed condition or right-hand side (for loops: the start)
+    Expr *limit;        // OP_FOR_INIT: exclusive upper bound; OP_STORE_INDEX: the index
+    int limit_slot;     // OP_FOR_*: hidden variable holding the evaluated bound, same scope as slot
+    int64_t imm;        // OP_ADD_INT: addend; OP_CMP_JUMP_INT: comparison BinOp;
+                        // OP_PRINT: 1 to omit the newline; OP_FOR_INIT: 1 when the bounds are on the stack;
+                        // stack ops: argument count or operator
+    Function *callee;   // OP_CALL / OP_TAILCALL
+    const Builtin *builtin; // OP_BUILTIN, resolved on first execution
+    PrintItem *items;
+    int item_count;
+} Instr;
+
+struct Program {
+    Instr *code;
+    int count;
+    int capacity;
+    char **lines;
+    int line_count;
+    int threaded;       // handlers filled in
+    int lowered;        // user calls rewritten into stack code
+};
+
+Program* ccrp_compile(char **lines, int line_count);
+Program* ccrp_compile_function(Function *fn);
+void ccrp_program_free(Program *prog);
+void ccrp_instr_free(Instr *in);
+void ccrp_optimize(Program *prog);
+void ccrp_infer_types(Program *main);
+void ccrp_lower(Program *prog);
+void ccrp_program_dump(const Program *prog, const char *title, FILE *out);
+Value ccrp_execute(Program *prog);
+Value ccrp_resume(Instr *resume);
+int ccrp_push_call(Function *fn, const Value *args, int arg_count);
+Function* ccrp_current_function(void);
+void ccrp_stacks_free(CcrpVM *vm);
+void interpret_vm(const gchar *code);
+void interpret_vm_source(char **lines, int line_count);
+void dump_optimized_vm(const gchar *code);
+void dump_optimized_source(char **lines, int line_count);
+
+// ------------------------ Tasks ------------------------
+// `[t =] spawn f(args)`, `[x =] await t` and `sleep ms`: coroutines scheduled
+// on the thread-default GLib main context (ccrp_task.c)
+int ccrp_task_parse(const char *line, char **target, char **operand);
+int ccrp_task_statement(const char *line);
+Value ccrp_spawn(const Expr *call);
+int ccrp_await(Value handle, Value *result, Instr *resume);  // 1: the caller suspended
+int ccrp_sleep(int64_t ms, Instr *resume);                   // 1: the caller suspended
+void ccrp_tasks_wait_flag(const int *flag);
+void ccrp_tasks_wait_input(int fd);
+void ccrp_tasks_finish(void);
+
+// ------------------------ Diagnostics ------------------------
+// Incremental checks of a buffer for editors (ccrp_check.c): report an edit,
+// parse the dirty lines it leaves, then update to learn which lines' messages changed
+typedef struct CcrpChecker CcrpChecker;
+
+CcrpChecker* ccrp_checker_new(void);
+void ccrp_checker_free(CcrpChecker *c);
+int ccrp_checker_line_count(const CcrpChecker *c);
+void ccrp_checker_edit(CcrpChecker *c, int first, int removed, int added);
+int ccrp_checker_next_dirty(const CcrpChecker *c, int from);
+void ccrp_checker_set_line(CcrpChecker *c, int line, const char *text);
+const GArray* ccrp_checker_update(CcrpChecker *c);
+const char* ccrp_checker_message(const CcrpChecker *c, int line);
+
 #endif // CCRP_H
\ No newline at end of file
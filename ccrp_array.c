@@ -0,0 +1,534 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+
+#ifdef CCRP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * CCRP arrays
+ *
+ * An array is one contiguous block of int64 or double elements behind a
+ * refcount, so indexing is a bounds check and a load. Indices may be negative
+ * to count from the end; slices clamp their bounds and always copy.
+ *
+ * The reductions and elementwise ops run on SSE2 (always present on x86-64)
+ * or AVX2 when the CPU has it, with plain C loops elsewhere. Double sums and
+ * dot products keep four partial sums combined in a fixed order in every
+ * version, so results do not depend on the machine. CCRP_NO_SIMD=1 in the
+ * environment forces the scalar code.
+ */
+
+// ------------------------ Storage ------------------------
+CcrpArray* ccrp_array_new(int is_double, size_t capacity) {
+    CcrpArray *a = malloc(sizeof(CcrpArray));
+    a->refcount = 1;
+    a->is_double = is_double;
+    a->length = 0;
+    a->capacity = capacity;
+    a->data.i = capacity ? malloc(capacity * sizeof(int64_t)) : NULL;
+    return a;
+}
+
+void ccrp_array_free(CcrpArray *a) {
+    free(a->data.i);
+    free(a);
+}
+
+Value value_array(CcrpArray *a) {
+    Value v;
+    v.type = VAL_ARRAY;
+    v.as.a = a;
+    return v;
+}
+
+// Convert an int array to doubles in place (both are 8 bytes)
+static void promote(CcrpArray *a) {
+    for (size_t k = 0; k < a->length; k++) a->data.d[k] = (double)a->data.i[k];
+    a->is_double = 1;
+}
+
+static int is_number(Value v) {
+    return v.type == VAL_INT || v.type == VAL_DOUBLE;
+}
+
+static void put(CcrpArray *a, size_t k, Value v) {
+    if (v.type == VAL_DOUBLE && !a->is_double) promote(a);
+    if (a->is_double) a->data.d[k] = value_to_double(v);
+    else a->data.i[k] = v.as.i;
+}
+
+static Value get(const CcrpArray *a, size_t k) {
+    return a->is_double ? value_double(a->data.d[k]) : value_int(a->data.i[k]);
+}
+
+// Append v, growing by doubling; 0 if v is not a number
+int ccrp_array_push(CcrpArray *a, Value v) {
+    if (!is_number(v)) return 0;
+    if (a->length == a->capacity) {
+        a->capacity = a->capacity ? a->capacity * 2 : 8;
+        a->data.i = realloc(a->data.i, a->capacity * sizeof(int64_t));
+    }
+    put(a, a->length++, v);
+    return 1;
+}
+
+int ccrp_array_equal(const CcrpArray *a, const CcrpArray *b) {
+    if (a->length != b->length) return 0;
+    for (size_t k = 0; k < a->length; k++) {
+        if (a->is_double || b->is_double) {
+            double x = a->is_double ? a->data.d[k] : (double)a->data.i[k];
+            double y = b->is_double ? b->data.d[k] : (double)b->data.i[k];
+            if (x != y) return 0;
+        } else if (a->data.i[k] != b->data.i[k]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void ccrp_array_format(const CcrpArray *a, GString *out) {
+    g_string_append_c(out, '[');
+    for (size_t k = 0; k < a->length; k++) {
+        if (k) g_string_append(out, ", ");
+        if (a->is_double) g_string_append_printf(out, "%g", a->data.d[k]);
+        else g_string_append_printf(out, "%" PRId64, a->data.i[k]);
+    }
+    g_string_append_c(out, ']');
+}
+
+// ------------------------ Indexing ------------------------
+// Position of index in a sequence of length n, counting from the end when
+// negative; -1 when out of range
+static int64_t position(Value index, size_t length) {
+    int64_t k = value_to_int(index);
+    if (k < 0) k += (int64_t)length;
+    return k >= 0 && (uint64_t)k < length ? k : -1;
+}
+
+// Slice bound: defaulted when missing, negative counts from the end, clamped
+static size_t bound(const Value *v, size_t fallback, size_t length) {
+    if (!v) return fallback;
+    int64_t k = value_to_int(*v);
+    if (k < 0) k += (int64_t)length;
+    if (k < 0) return 0;
+    return (uint64_t)k > length ? length : (size_t)k;
+}
+
+// container[index]; borrows both. Strings yield one-character strings; a key
+// missing from a map reads as 0, so counters need no initialization.
+Value ccrp_index_get(Value container, Value index) {
+    if (container.type == VAL_MAP) {
+        const Value *v = ccrp_map_find(container.as.m, index);
+        return v ? value_retain(*v) : value_int(0);
+    }
+    if (container.type == VAL_ARRAY) {
+        const CcrpArray *a = container.as.a;
+        int64_t k = position(index, a->length);
+        if (k >= 0) return get(a, (size_t)k);
+        ccrp_out_printf("Error: index %" PRId64 " out of range (length %zu).\n", value_to_int(index), a->length);
+        return value_int(0);
+    }
+    if (container.type == VAL_STR) {
+        int64_t k = position(index, container.as.s->length);
+        if (k >= 0) return value_string_len(container.as.s->data + k, 1);
+        ccrp_out_printf("Error: index %" PRId64 " out of range (length %zu).\n",
+                        value_to_int(index), container.as.s->length);
+        return value_string_len("", 0);
+    }
+    ccrp_out_printf("Error: only arrays, strings and maps can be indexed.\n");
+    return value_int(0);
+}
+
+// container[start:end] as a new array or string; borrows its arguments
+Value ccrp_slice(Value container, const Value *start, const Value *end) {
+    size_t length = container.type == VAL_ARRAY ? container.as.a->length :
+                    container.type == VAL_STR ? container.as.s->length : 0;
+    size_t from = bound(start, 0, length), to = bound(end, length, length);
+    if (to < from) to = from;
+    if (container.type == VAL_STR) return value_string_len(container.as.s->data + from, to - from);
+    if (container.type != VAL_ARRAY) {
+        ccrp_out_printf("Error: only arrays and strings can be sliced.\n");
+        return value_int(0);
+    }
+    const CcrpArray *a = container.as.a;
+    CcrpArray *out = ccrp_array_new(a->is_double, to - from);
+    if (to > from) memcpy(out->data.i, a->data.i + from, (to - from) * sizeof(int64_t));
+    out->length = to - from;
+    return value_array(out);
+}
+
+// name[index] = v for the variable at target; borrows index and v
+void ccrp_index_store(Value *target, const char *name, Value index, Value v) {
+    if (target->type == VAL_MAP) {
+        ccrp_map_set(target->as.m, index, v);
+        return;
+    }
+    if (target->type != VAL_ARRAY) {
+        ccrp_out_printf("Error: '%s' is not an array or a map.\n", name);
+        return;
+    }
+    CcrpArray *a = target->as.a;
+    int64_t k = position(index, a->length);
+    if (k < 0) {
+        ccrp_out_printf("Error: index %" PRId64 " out of range (length %zu).\n", value_to_int(index), a->length);
+    } else if (!is_number(v)) {
+        ccrp_out_printf("Error: arrays hold only numbers.\n");
+    } else {
+        put(a, (size_t)k, v);
+    }
+}
+
+// ------------------------ Kernels ------------------------
+// 2: AVX2, 1: SSE2, 0: scalar
+int ccrp_simd_level(void) {
+    static int state = -1; // detected once; every thread computes the same value
+    int level = g_atomic_int_get(&state);
+#ifdef CCRP_X86_SIMD
+    if (level < 0) {
+        const char *off = getenv("CCRP_NO_SIMD");
+        level = (off && *off && strcmp(off, "0") != 0) ? 0 : __builtin_cpu_supports("avx2") ? 2 : 1;
+        g_atomic_int_set(&state, level);
+    }
+#else
+    level = 0;
+#endif
+    return level;
+}
+
+#ifdef CCRP_X86_SIMD
+__attribute__((target("avx2")))
+static int64_t sum_i64_avx2(const int64_t *x, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i*)(x + k)));
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    uint64_t s = (uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lanes[2] + (uint64_t)lanes[3];
+    for (; k < n; k++) s += (uint64_t)x[k];
+    return (int64_t)s;
+}
+
+__attribute__((target("avx2")))
+static int64_t extreme_i64_avx2(const int64_t *x, size_t n, int want_max) {
+    __m256i best = _mm256_set1_epi64x(x[0]);
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(x + k));
+        __m256i gt = want_max ? _mm256_cmpgt_epi64(v, best) : _mm256_cmpgt_epi64(best, v);
+        best = _mm256_blendv_epi8(best, v, gt);
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, best);
+    int64_t r = lanes[0];
+    for (int j = 1; j < 4; j++) if (want_max ? lanes[j] > r : lanes[j] < r) r = lanes[j];
+    for (; k < n; k++) if (want_max ? x[k] > r : x[k] < r) r = x[k];
+    return r;
+}
+
+// Wrapping int64 dot product. AVX2 has no 64-bit multiply, so each product is
+// built from 32x32->64 multiplies: lo*lo + ((hi*lo + lo*hi) << 32)
+__attribute__((target("avx2")))
+static int64_t dot_i64_avx2(const int64_t *x, const int64_t *y, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(x + k));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(y + k));
+        __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                         _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    uint64_t s = (uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lanes[2] + (uint64_t)lanes[3];
+    for (; k < n; k++) s += (uint64_t)x[k] * (uint64_t)y[k];
+    return (int64_t)s;
+}
+
+// Four partial sums: sum (and dot when y is non-NULL) of doubles
+__attribute__((target("avx2")))
+static double sum_f64_avx2(const double *x, const double *y, size_t n) {
+    __m256d acc = _mm256_setzero_pd();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d v = _mm256_loadu_pd(x + k);
+        if (y) v = _mm256_mul_pd(v, _mm256_loadu_pd(y + k));
+        acc = _mm256_add_pd(acc, v);
+    }
+    __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    double lanes[2];
+    _mm_storeu_pd(lanes, pair);
+    double s = lanes[0] + lanes[1];
+    for (; k < n; k++) s += y ? x[k] * y[k] : x[k];
+    return s;
+}
+
+static double sum_f64_sse2(const double *x, const double *y, size_t n) {
+    __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m128d a = _mm_loadu_pd(x + k), b = _mm_loadu_pd(x + k + 2);
+        if (y) {
+            a = _mm_mul_pd(a, _mm_loadu_pd(y + k));
+            b = _mm_mul_pd(b, _mm_loadu_pd(y + k + 2));
+        }
+        lo = _mm_add_pd(lo, a);
+        hi = _mm_add_pd(hi, b);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(lo, hi));
+    double s = lanes[0] + lanes[1];
+    for (; k < n; k++) s += y ? x[k] * y[k] : x[k];
+    return s;
+}
+
+__attribute__((target("avx2")))
+static double extreme_f64_avx2(const double *x, size_t n, int want_max) {
+    __m256d best = _mm256_set1_pd(x[0]);
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d v = _mm256_loadu_pd(x + k);
+        best = want_max ? _mm256_max_pd(best, v) : _mm256_min_pd(best, v);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    double r = lanes[0];
+    for (int j = 1; j < 4; j++) if (want_max ? lanes[j] > r : lanes[j] < r) r = lanes[j];
+    for (; k < n; k++) if (want_max ? x[k] > r : x[k] < r) r = x[k];
+    return r;
+}
+
+static double extreme_f64_sse2(const double *x, size_t n, int want_max) {
+    __m128d best = _mm_set1_pd(x[0]);
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d v = _mm_loadu_pd(x + k);
+        best = want_max ? _mm_max_pd(best, v) : _mm_min_pd(best, v);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, best);
+    double r = want_max ? (lanes[1] > lanes[0] ? lanes[1] : lanes[0]) : (lanes[1] < lanes[0] ? lanes[1] : lanes[0]);
+    for (; k < n; k++) if (want_max ? x[k] > r : x[k] < r) r = x[k];
+    return r;
+}
+#endif
+
+// Wrapping int64 sum
+static int64_t sum_i64(const int64_t *x, size_t n) {
+    size_t k = 0;
+    uint64_t s = 0;
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) return sum_i64_avx2(x, n);
+    if (ccrp_simd_level() == 1) {
+        __m128i acc = _mm_setzero_si128();
+        for (; k + 2 <= n; k += 2) acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i*)(x + k)));
+        int64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        s = (uint64_t)lanes[0] + (uint64_t)lanes[1];
+    }
+#endif
+    for (; k < n; k++) s += (uint64_t)x[k];
+    return (int64_t)s;
+}
+
+static int64_t dot_i64(const int64_t *x, const int64_t *y, size_t n) {
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) return dot_i64_avx2(x, y, n);
+#endif
+    uint64_t s = 0;
+    for (size_t k = 0; k < n; k++) s += (uint64_t)x[k] * (uint64_t)y[k];
+    return (int64_t)s;
+}
+
+static double sum_f64(const double *x, const double *y, size_t n) {
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) return sum_f64_avx2(x, y, n);
+    if (ccrp_simd_level() == 1) return sum_f64_sse2(x, y, n);
+#endif
+    double lane[4] = { 0, 0, 0, 0 };
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4)
+        for (int j = 0; j < 4; j++) lane[j] += y ? x[k + j] * y[k + j] : x[k + j];
+    double s = (lane[0] + lane[2]) + (lane[1] + lane[3]);
+    for (; k < n; k++) s += y ? x[k] * y[k] : x[k];
+    return s;
+}
+
+static int64_t extreme_i64(const int64_t *x, size_t n, int want_max) {
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) return extreme_i64_avx2(x, n, want_max);
+#endif
+    int64_t r = x[0];
+    for (size_t k = 1; k < n; k++) if (want_max ? x[k] > r : x[k] < r) r = x[k];
+    return r;
+}
+
+static double extreme_f64(const double *x, size_t n, int want_max) {
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) return extreme_f64_avx2(x, n, want_max);
+    if (ccrp_simd_level() == 1) return extreme_f64_sse2(x, n, want_max);
+#endif
+    double r = x[0];
+    for (size_t k = 1; k < n; k++) if (want_max ? x[k] > r : x[k] < r) r = x[k];
+    return r;
+}
+
+Value ccrp_array_sum(const CcrpArray *a) {
+    if (a->is_double) return value_double(sum_f64(a->data.d, NULL, a->length));
+    return value_int(sum_i64(a->data.i, a->length));
+}
+
+static Value extreme(const CcrpArray *a, int want_max) {
+    if (a->length == 0) {
+        ccrp_out_printf("Error: %s of an empty array.\n", want_max ? "max" : "min");
+        return value_int(0);
+    }
+    if (a->is_double) return value_double(extreme_f64(a->data.d, a->length, want_max));
+    return value_int(extreme_i64(a->data.i, a->length, want_max));
+}
+
+Value ccrp_array_min(const CcrpArray *a) { return extreme(a, 0); }
+Value ccrp_array_max(const CcrpArray *a) { return extreme(a, 1); }
+
+// Elements of a as doubles: the array itself or a converted copy to free
+static const double* as_doubles(const CcrpArray *a, double **copy) {
+    *copy = NULL;
+    if (a->is_double) return a->data.d;
+    *copy = malloc((a->length ? a->length : 1) * sizeof(double));
+    for (size_t k = 0; k < a->length; k++) (*copy)[k] = (double)a->data.i[k];
+    return *copy;
+}
+
+Value ccrp_array_dot(const CcrpArray *a, const CcrpArray *b) {
+    size_t n = a->length < b->length ? a->length : b->length;
+    if (a->length != b->length) ccrp_out_printf("Error: dot of arrays of different lengths.\n");
+    if (!a->is_double && !b->is_double) return value_int(dot_i64(a->data.i, b->data.i, n));
+    double *ca, *cb;
+    const double *x = as_doubles(a, &ca), *y = as_doubles(b, &cb);
+    double s = sum_f64(x, y, n);
+    free(ca);
+    free(cb);
+    return value_double(s);
+}
+
+// ------------------------ Elementwise ops ------------------------
+static inline double apply_f64(int op, double x, double y) {
+    switch (op) {
+        case BIN_ADD: return x + y;
+        case BIN_SUB: return x - y;
+        case BIN_MUL: return x * y;
+        case BIN_DIV: return y != 0.0 ? x / y : 0.0;
+        default: return y != 0.0 ? fmod(x, y) : 0.0;
+    }
+}
+
+static inline int64_t apply_i64(int op, int64_t x, int64_t y) {
+    uint64_t a = (uint64_t)x, b = (uint64_t)y;
+    switch (op) {
+        case BIN_ADD: return (int64_t)(a + b);
+        case BIN_SUB: return (int64_t)(a - b);
+        case BIN_MUL: return (int64_t)(a * b);
+        case BIN_DIV: return y == 0 ? 0 : y == -1 ? (int64_t)(0 - a) : x / y;
+        default: return y == 0 || y == -1 ? 0 : x % y;
+    }
+}
+
+#ifdef CCRP_X86_SIMD
+// out[k] = x[k] op (y ? y[k] : c) for + - * on doubles; returns how many were done
+__attribute__((target("avx2")))
+static size_t map_f64_avx2(int op, const double *x, const double *y, double c, double *out, size_t n) {
+    __m256d vc = _mm256_set1_pd(c);
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d a = _mm256_loadu_pd(x + k), b = y ? _mm256_loadu_pd(y + k) : vc;
+        __m256d r = op == BIN_ADD ? _mm256_add_pd(a, b) : op == BIN_SUB ? _mm256_sub_pd(a, b) : _mm256_mul_pd(a, b);
+        _mm256_storeu_pd(out + k, r);
+    }
+    return k;
+}
+
+static size_t map_f64_sse2(int op, const double *x, const double *y, double c, double *out, size_t n) {
+    __m128d vc = _mm_set1_pd(c);
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d a = _mm_loadu_pd(x + k), b = y ? _mm_loadu_pd(y + k) : vc;
+        __m128d r = op == BIN_ADD ? _mm_add_pd(a, b) : op == BIN_SUB ? _mm_sub_pd(a, b) : _mm_mul_pd(a, b);
+        _mm_storeu_pd(out + k, r);
+    }
+    return k;
+}
+
+// + and - on int64 (no 64-bit multiply before AVX-512)
+__attribute__((target("avx2")))
+static size_t map_i64_avx2(int op, const int64_t *x, const int64_t *y, int64_t c, int64_t *out, size_t n) {
+    __m256i vc = _mm256_set1_epi64x(c);
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(x + k));
+        __m256i b = y ? _mm256_loadu_si256((const __m256i*)(y + k)) : vc;
+        __m256i r = op == BIN_ADD ? _mm256_add_epi64(a, b) : _mm256_sub_epi64(a, b);
+        _mm256_storeu_si256((__m256i*)(out + k), r);
+    }
+    return k;
+}
+
+static size_t map_i64_sse2(int op, const int64_t *x, const int64_t *y, int64_t c, int64_t *out, size_t n) {
+    __m128i vc = _mm_set1_epi64x(c);
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(x + k));
+        __m128i b = y ? _mm_loadu_si128((const __m128i*)(y + k)) : vc;
+        __m128i r = op == BIN_ADD ? _mm_add_epi64(a, b) : _mm_sub_epi64(a, b);
+        _mm_storeu_si128((__m128i*)(out + k), r);
+    }
+    return k;
+}
+#endif
+
+// New array of a[k] op b, where b is a number or an array of the same length
+CcrpArray* ccrp_array_map(const CcrpArray *a, int op, Value b) {
+    const CcrpArray *other = b.type == VAL_ARRAY ? b.as.a : NULL;
+    if (!other && !is_number(b)) {
+        ccrp_out_printf("Error: map needs a number or an array as its third argument.\n");
+        return NULL;
+    }
+    size_t n = a->length;
+    if (other && other->length != n) {
+        ccrp_out_printf("Error: map of arrays of different lengths.\n");
+        if (other->length < n) n = other->length;
+    }
+    int is_double = a->is_double || (other ? other->is_double : b.type == VAL_DOUBLE);
+    CcrpArray *out = ccrp_array_new(is_double, n);
+    out->length = n;
+    size_t k = 0;
+    if (is_double) {
+        double *ca, *cb = NULL;
+        const double *x = as_doubles(a, &ca), *y = other ? as_doubles(other, &cb) : NULL;
+        double c = other ? 0.0 : value_to_double(b);
+#ifdef CCRP_X86_SIMD
+        if (op == BIN_ADD || op == BIN_SUB || op == BIN_MUL) {
+            if (ccrp_simd_level() == 2) k = map_f64_avx2(op, x, y, c, out->data.d, n);
+            else if (ccrp_simd_level() == 1) k = map_f64_sse2(op, x, y, c, out->data.d, n);
+        }
+#endif
+        for (; k < n; k++) out->data.d[k] = apply_f64(op, x[k], y ? y[k] : c);
+        free(ca);
+        free(cb);
+    } else {
+        const int64_t *x = a->data.i, *y = other ? other->data.i : NULL;
+        int64_t c = other ? 0 : b.as.i;
+#ifdef CCRP_X86_SIMD
+        if (op == BIN_ADD || op == BIN_SUB) {
+            if (ccrp_simd_level() == 2) k = map_i64_avx2(op, x, y, c, out->data.i, n);
+            else if (ccrp_simd_level() == 1) k = map_i64_sse2(op, x, y, c, out->data.i, n);
+        }
+#endif
+        for (; k < n; k++) out->data.i[k] = apply_i64(op, x[k], y ? y[k] : c);
+    }
+    return out;
+}
@@ -0,0 +1,471 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+
+/*
+ * CCRP native builtins
+ *
+ * Every builtin is one row of a static table sorted by (name, arity): the C
+ * function, its arity, flags for the optimizer and type inference, and the
+ * library that has to be imported before scripts can call it (NULL for core
+ * builtins). The same name may appear with different arities, e.g. the math
+ * max(a, b) and the array max(a). Call sites
+ * resolve their row once (Expr.builtin, Instr.builtin) and afterwards call
+ * through the function pointer directly, so the table lookup and the library
+ * check are paid on the first call only. Libraries are never unloaded, so a
+ * resolved call site stays valid.
+ */
+
+// ------------------------ Math ------------------------
+static Value math_sin(const Value *a) { return value_int((int64_t)(sin((double)value_to_int(a[0])) * 1000)); }
+static Value math_cos(const Value *a) { return value_int((int64_t)(cos((double)value_to_int(a[0])) * 1000)); }
+static Value math_tan(const Value *a) { return value_int((int64_t)(tan((double)value_to_int(a[0])) * 1000)); }
+static Value math_log(const Value *a) { return value_int((int64_t)log((double)value_to_int(a[0]))); }
+static Value math_exp(const Value *a) { return value_int((int64_t)exp((double)value_to_int(a[0]))); }
+
+// Floor of the square root, exact beyond 2^53; 0 for negative numbers
+static Value math_sqrt(const Value *a) {
+    int64_t x = value_to_int(a[0]);
+    if (x <= 0) return value_int(0);
+    int64_t r = (int64_t)sqrt((double)x);
+    while (r > 0 && r > x / r) r--;
+    while (r + 1 <= x / (r + 1)) r++;
+    return value_int(r);
+}
+
+static Value math_abs(const Value *a) {
+    int64_t x = value_to_int(a[0]);
+    return value_int(x < 0 ? -x : x);
+}
+
+// Integer power by squaring, wrapping like repeated multiplication
+static Value math_pow(const Value *a) {
+    int64_t base = value_to_int(a[0]), e = value_to_int(a[1]);
+    if (e < 0) return value_int(base == 1 ? 1 : base == -1 ? (e % 2 ? -1 : 1) : 0);
+    uint64_t r = 1, b = (uint64_t)base;
+    for (; e; e >>= 1, b *= b)
+        if (e & 1) r *= b;
+    return value_int((int64_t)r);
+}
+
+static Value math_mod(const Value *a) {
+    int64_t x = value_to_int(a[0]), y = value_to_int(a[1]);
+    return value_int(y == 0 || y == -1 ? 0 : x % y);
+}
+
+static Value math_max(const Value *a) {
+    int64_t x = value_to_int(a[0]), y = value_to_int(a[1]);
+    return value_int(x > y ? x : y);
+}
+
+static Value math_min(const Value *a) {
+    int64_t x = value_to_int(a[0]), y = value_to_int(a[1]);
+    return value_int(x < y ? x : y);
+}
+
+// ------------------------ Arrays ------------------------
+static const CcrpArray* want_array(Value v, const char *fn) {
+    if (v.type == VAL_ARRAY) return v.as.a;
+    ccrp_out_printf("Error: %s expects an array.\n", fn);
+    return NULL;
+}
+
+static Value core_len(const Value *a) {
+    if (a[0].type == VAL_ARRAY) return value_int((int64_t)a[0].as.a->length);
+    if (a[0].type == VAL_STR) return value_int((int64_t)a[0].as.s->length);
+    if (a[0].type == VAL_MAP) return value_int((int64_t)a[0].as.m->count);
+    ccrp_out_printf("Error: len expects an array, a string or a map.\n");
+    return value_int(0);
+}
+
+// push(a, x): append in place, returns the new length
+static Value core_push(const Value *a) {
+    if (!want_array(a[0], "push")) return value_int(0);
+    if (!ccrp_array_push(a[0].as.a, a[1])) ccrp_out_printf("Error: arrays hold only numbers.\n");
+    return value_int((int64_t)a[0].as.a->length);
+}
+
+// array(n, fill): n copies of fill
+static Value core_array(const Value *a) {
+    int64_t n = value_to_int(a[0]);
+    if (n < 0) n = 0;
+    Value fill = a[1].type == VAL_DOUBLE ? a[1] : value_int(value_to_int(a[1]));
+    CcrpArray *out = ccrp_array_new(fill.type == VAL_DOUBLE, (size_t)n);
+    for (int64_t k = 0; k < n; k++) ccrp_array_push(out, fill);
+    return value_array(out);
+}
+
+static Value core_sum(const Value *a) {
+    const CcrpArray *x = want_array(a[0], "sum");
+    return x ? ccrp_array_sum(x) : value_int(0);
+}
+
+static Value core_min(const Value *a) {
+    const CcrpArray *x = want_array(a[0], "min");
+    return x ? ccrp_array_min(x) : value_int(0);
+}
+
+static Value core_max(const Value *a) {
+    const CcrpArray *x = want_array(a[0], "max");
+    return x ? ccrp_array_max(x) : value_int(0);
+}
+
+static Value core_dot(const Value *a) {
+    const CcrpArray *x = want_array(a[0], "dot"), *y = x ? want_array(a[1], "dot") : NULL;
+    return y ? ccrp_array_dot(x, y) : value_int(0);
+}
+
+// map(a, "op", b): a[k] op b, or a[k] op b[k] when b is an array
+static Value core_map(const Value *a) {
+    static const char ops[] = "+-*/%";
+    static const int bin[] = { BIN_ADD, BIN_SUB, BIN_MUL, BIN_DIV, BIN_MOD };
+    const CcrpArray *x = want_array(a[0], "map");
+    if (!x) return value_int(0);
+    const char *op = a[1].type == VAL_STR ? a[1].as.s->data : "";
+    const char *at = op[0] && !op[1] ? strchr(ops, op[0]) : NULL;
+    if (!at) {
+        ccrp_out_printf("Error: map operator must be one of \"+\", \"-\", \"*\", \"/\", \"%%\".\n");
+        return value_int(0);
+    }
+    CcrpArray *out = ccrp_array_map(x, bin[at - ops], a[2]);
+    return out ? value_array(out) : value_int(0);
+}
+
+// ------------------------ Maps ------------------------
+static CcrpMap* want_map(Value v, const char *fn) {
+    if (v.type == VAL_MAP) return v.as.m;
+    ccrp_out_printf("Error: %s expects a map.\n", fn);
+    return NULL;
+}
+
+static Value core_has(const Value *a) {
+    const CcrpMap *m = want_map(a[0], "has");
+    return value_int(m && ccrp_map_find(m, a[1]) != NULL);
+}
+
+// get(m, key, default): m[key], or default when key is missing
+static Value core_get(const Value *a) {
+    const CcrpMap *m = want_map(a[0], "get");
+    const Value *v = m ? ccrp_map_find(m, a[1]) : NULL;
+    return value_retain(v ? *v : a[2]);
+}
+
+// del(m, key): 1 if key was removed
+static Value core_del(const Value *a) {
+    CcrpMap *m = want_map(a[0], "del");
+    return value_int(m && ccrp_map_delete(m, a[1]));
+}
+
+// key_at(m, i) / value_at(m, i): the i-th entry in insertion order, so
+// `for i in 0..len(m) - 1` walks a map
+static const CcrpMapEntry* entry_at(const Value *a, const char *fn) {
+    CcrpMap *m = want_map(a[0], fn);
+    if (!m) return NULL;
+    const CcrpMapEntry *e = ccrp_map_entry(m, value_to_int(a[1]));
+    if (!e) ccrp_out_printf("Error: index %" PRId64 " out of range (length %zu).\n", value_to_int(a[1]), m->count);
+    return e;
+}
+
+static Value core_key_at(const Value *a) {
+    const CcrpMapEntry *e = entry_at(a, "key_at");
+    return e ? value_retain(e->key) : value_int(0);
+}
+
+static Value core_value_at(const Value *a) {
+    const CcrpMapEntry *e = entry_at(a, "value_at");
+    return e ? value_retain(e->value) : value_int(0);
+}
+
+// ------------------------ Strings ------------------------
+// The `string` library. Arguments are taken as text, converting numbers; each
+// function releases the references text() hands out.
+static const CcrpString* text(Value v, Value *hold) {
+    *hold = value_to_string(v);
+    return hold->as.s;
+}
+
+// A character argument: the first byte of a string or a character code; -1 for ""
+static int char_arg(Value v) {
+    if (v.type == VAL_STR) return v.as.s->length ? (unsigned char)v.as.s->data[0] : -1;
+    return (unsigned char)value_to_int(v);
+}
+
+static Value str_length(const Value *a) {
+    Value h;
+    int64_t n = (int64_t)text(a[0], &h)->length;
+    value_release(h);
+    return value_int(n);
+}
+
+// substring(s, start, end): bytes [start, end), clamped to the string
+static Value str_substring(const Value *a) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    int64_t start = value_to_int(a[1]), end = value_to_int(a[2]);
+    if (start < 0) start = 0;
+    if (end > (int64_t)s->length) end = (int64_t)s->length;
+    Value r = start < end ? value_string_len(s->data + start, (size_t)(end - start)) : value_string_len("", 0);
+    value_release(h);
+    return r;
+}
+
+static Value str_concat(const Value *a) {
+    return value_concat(value_to_string(a[0]), a[1]);
+}
+
+static Value str_case(const Value *a, int upper) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    Value r = ccrp_str_case(s->data, s->length, upper);
+    value_release(h);
+    return r;
+}
+
+static Value str_to_upper(const Value *a) { return str_case(a, 1); }
+static Value str_to_lower(const Value *a) { return str_case(a, 0); }
+
+static Value str_reverse(const Value *a) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    CcrpString *out = ccrp_string_sized(s->length);
+    for (size_t k = 0; k < s->length; k++) out->data[k] = s->data[s->length - 1 - k];
+    value_release(h);
+    Value r;
+    r.type = VAL_STR;
+    r.as.s = out;
+    return r;
+}
+
+static Value str_is_palindrome(const Value *a) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    int same = 1;
+    for (size_t i = 0, j = s->length; same && i + 1 < j; i++, j--) same = s->data[i] == s->data[j - 1];
+    value_release(h);
+    return value_int(same);
+}
+
+static Value str_count_char(const Value *a) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    int c = char_arg(a[1]);
+    int64_t n = c < 0 ? 0 : (int64_t)ccrp_str_count_byte(s->data, s->length, (char)c);
+    value_release(h);
+    return value_int(n);
+}
+
+static Value str_find_char(const Value *a) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    int c = char_arg(a[1]);
+    const char *hit = c < 0 ? NULL : memchr(s->data, c, s->length);
+    int64_t at = hit ? hit - s->data : -1;
+    value_release(h);
+    return value_int(at);
+}
+
+// replace_char(s, old, new): new may be any string
+static Value str_replace_char(const Value *a) {
+    Value h, ht;
+    const CcrpString *s = text(a[0], &h), *to = text(a[2], &ht);
+    int c = char_arg(a[1]);
+    char from = (char)c;
+    Value r = ccrp_str_replace(s->data, s->length, &from, c < 0 ? 0 : 1, to->data, to->length);
+    value_release(h);
+    value_release(ht);
+    return r;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static Value str_trim(const Value *a) {
+    Value h;
+    const CcrpString *s = text(a[0], &h);
+    size_t start = 0, end = s->length;
+    while (start < end && is_space(s->data[start])) start++;
+    while (end > start && is_space(s->data[end - 1])) end--;
+    Value r = value_string_len(s->data + start, end - start);
+    value_release(h);
+    return r;
+}
+
+// The two-string searches: find, contains, count, starts_with, ends_with, compare
+enum { SEARCH_FIND, SEARCH_CONTAINS, SEARCH_COUNT, SEARCH_STARTS, SEARCH_ENDS, SEARCH_COMPARE };
+
+static Value str_search(const Value *a, int kind) {
+    Value h, hn;
+    const CcrpString *s = text(a[0], &h), *t = text(a[1], &hn);
+    int64_t r = 0;
+    switch (kind) {
+        case SEARCH_FIND: r = ccrp_str_find(s->data, s->length, t->data, t->length, 0); break;
+        case SEARCH_CONTAINS: r = ccrp_str_find(s->data, s->length, t->data, t->length, 0) >= 0; break;
+        case SEARCH_COUNT: r = t->length ? (int64_t)ccrp_str_count(s->data, s->length, t->data, t->length) : 0; break;
+        case SEARCH_STARTS: r = t->length <= s->length && memcmp(s->data, t->data, t->length) == 0; break;
+        case SEARCH_ENDS:
+            r = t->length <= s->length && memcmp(s->data + s->length - t->length, t->data, t->length) == 0;
+            break;
+        case SEARCH_COMPARE: {
+            size_t n = s->length < t->length ? s->length : t->length;
+            int c = memcmp(s->data, t->data, n);
+            if (c == 0) c = (s->length > t->length) - (s->length < t->length);
+            r = (c > 0) - (c < 0);
+            break;
+        }
+    }
+    value_release(h);
+    value_release(hn);
+    return value_int(r);
+}
+
+static Value str_find(const Value *a) { return str_search(a, SEARCH_FIND); }
+static Value str_contains(const Value *a) { return str_search(a, SEARCH_CONTAINS); }
+static Value str_count(const Value *a) { return str_search(a, SEARCH_COUNT); }
+static Value str_starts_with(const Value *a) { return str_search(a, SEARCH_STARTS); }
+static Value str_ends_with(const Value *a) { return str_search(a, SEARCH_ENDS); }
+static Value str_compare(const Value *a) { return str_search(a, SEARCH_COMPARE); }
+
+static Value str_replace(const Value *a) {
+    Value h, hf, ht;
+    const CcrpString *s = text(a[0], &h), *from = text(a[1], &hf), *to = text(a[2], &ht);
+    Value r = ccrp_str_replace(s->data, s->length, from->data, from->length, to->data, to->length);
+    value_release(h);
+    value_release(hf);
+    value_release(ht);
+    return r;
+}
+
+// split(s, sep): a map keyed 0, 1, 2... (arrays hold only numbers)
+static Value str_split(const Value *a) {
+    Value h, hs;
+    const CcrpString *s = text(a[0], &h), *sep = text(a[1], &hs);
+    Value r = ccrp_str_split(s->data, s->length, sep->data, sep->length);
+    value_release(h);
+    value_release(hs);
+    return r;
+}
+
+static Value str_join(const Value *a) {
+    Value hs;
+    const CcrpString *sep = text(a[1], &hs);
+    Value r = ccrp_str_join(a[0], sep->data, sep->length);
+    value_release(hs);
+    return r;
+}
+
+// ------------------------ Registry ------------------------
+#define MATH (BUILTIN_PURE | BUILTIN_INT)
+#define STR BUILTIN_PURE
+#define STR_INT (BUILTIN_PURE | BUILTIN_INT)
+
+// Sorted by name, then arity (checked on first lookup)
+static const Builtin builtins[] = {
+    { "abs",           "math",   1, MATH, math_abs },
+    { "array",         NULL,     2, 0, core_array },
+    { "compare",       "string", 2, STR_INT, str_compare },
+    { "concat",        "string", 2, STR, str_concat },
+    { "contains",      "string", 2, STR_INT, str_contains },
+    { "cos",           "math",   1, MATH, math_cos },
+    { "count",         "string", 2, STR_INT, str_count },
+    { "count_char",    "string", 2, STR_INT, str_count_char },
+    { "del",           NULL,     2, BUILTIN_INT, core_del },
+    { "dot",           NULL,     2, 0, core_dot },
+    { "ends_with",     "string", 2, STR_INT, str_ends_with },
+    { "exp",           "math",   1, MATH, math_exp },
+    { "find",          "string", 2, STR_INT, str_find },
+    { "find_char",     "string", 2, STR_INT, str_find_char },
+    { "get",           NULL,     3, 0, core_get },
+    { "has",           NULL,     2, BUILTIN_INT, core_has },
+    { "is_palindrome", "string", 1, STR_INT, str_is_palindrome },
+    { "join",          "string", 2, 0, str_join },
+    { "key_at",        NULL,     2, 0, core_key_at },
+    { "len",           NULL,     1, BUILTIN_PURE | BUILTIN_INT, core_len },
+    { "length",        "string", 1, STR_INT, str_length },
+    { "log",           "math",   1, MATH, math_log },
+    { "map",           NULL,     3, 0, core_map },
+    { "max",           NULL,     1, 0, core_max },
+    { "max",           "math",   2, MATH, math_max },
+    { "min",           NULL,     1, 0, core_min },
+    { "min",           "math",   2, MATH, math_min },
+    { "mod",           "math",   2, MATH, math_mod },
+    { "pow",           "math",   2, MATH, math_pow },
+    { "push",          NULL,     2, BUILTIN_INT, core_push },
+    { "replace",       "string", 3, STR, str_replace },
+    { "replace_char",  "string", 3, STR, str_replace_char },
+    { "reverse",       "string", 1, STR, str_reverse },
+    { "sin",           "math",   1, MATH, math_sin },
+    { "split",         "string", 2, 0, str_split },
+    { "sqrt",          "math",   1, MATH, math_sqrt },
+    { "starts_with",   "string", 2, STR_INT, str_starts_with },
+    { "substring",     "string", 3, STR, str_substring },
+    { "sum",           NULL,     1, 0, core_sum },
+    { "tan",           "math",   1, MATH, math_tan },
+    { "to_lower",      "string", 1, STR, str_to_lower },
+    { "to_upper",      "string", 1, STR, str_to_upper },
+    { "trim",          "string", 1, STR, str_trim },
+    { "value_at",      NULL,     2, 0, core_value_at },
+};
+
+#define BUILTIN_COUNT ((int)(sizeof(builtins) / sizeof(builtins[0])))
+
+static int compare_builtin(const char *name, int arity, const Builtin *b) {
+    int c = strcmp(name, b->name);
+    return c ? c : arity - b->arity;
+}
+
+static void check_sorted(void) {
+    static int checked = 0;
+    if (g_atomic_int_get(&checked)) return;
+    g_atomic_int_set(&checked, 1);
+    for (int i = 1; i < BUILTIN_COUNT; i++) {
+        if (compare_builtin(builtins[i].name, builtins[i].arity, &builtins[i - 1]) <= 0) {
+            fprintf(stderr, "Error: builtin table out of order at '%s'.\n", builtins[i].name);
+            abort();
+        }
+    }
+}
+
+// The i-th builtin in name order, NULL past the end
+const Builtin* ccrp_builtin_at(int i) {
+    return i >= 0 && i < BUILTIN_COUNT ? &builtins[i] : NULL;
+}
+
+// Builtin name taking arg_count arguments, imported or not. A qualified name
+// (`math.sqrt`) only matches builtins of that library.
+const Builtin* ccrp_builtin_find(const char *name, int arg_count) {
+    check_sorted();
+    const char *dot = strchr(name, '.');
+    const char *base = dot ? dot + 1 : name;
+    int lo = 0, hi = BUILTIN_COUNT - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = compare_builtin(base, arg_count, &builtins[mid]);
+        if (c == 0) {
+            const Builtin *b = &builtins[mid];
+            if (dot && (!b->library || strlen(b->library) != (size_t)(dot - name) ||
+                        strncmp(b->library, name, (size_t)(dot - name)) != 0)) return NULL;
+            return b;
+        }
+        if (c < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+// Builtin a call site should bind to, or NULL after reporting why there is none
+const Builtin* ccrp_builtin_resolve(const char *name, int arg_count) {
+    const Builtin *b = ccrp_builtin_find(name, arg_count);
+    if (!b) {
+        ccrp_out_printf("Error: Unknown function '%s'.\n", name);
+        return NULL;
+    }
+    if (b->library && !lib_enabled(b->library)) {
+        ccrp_out_printf("Error: '%s' library not imported for %s.\n", b->library, name);
+        return NULL;
+    }
+    return b;
+}
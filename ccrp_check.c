@@ -0,0 +1,644 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * CCRP diagnostics for editors
+ *
+ * A checker keeps a record per line of a buffer: the function the line
+ * defines, the library it imports, the calls it makes and any error in the
+ * line on its own. An edit marks the records of the lines it touched dirty;
+ * only those are parsed again, with the interpreter's statement and
+ * expression parsers. Nothing is run.
+ *
+ * Next to the records, a compact array holds each line's shape: the block
+ * keyword it opens or closes, its net braces and a 64-bit bloom of the names
+ * it calls. ccrp_checker_update works from the shapes:
+ *
+ *   - a call is resolved again when its line was parsed, or when a name it
+ *     may call was defined, undefined, imported or unimported;
+ *   - if/while/for are matched with their end keywords and `{` with `}` in
+ *     one pass, and only when some line's keyword or braces changed.
+ *
+ * Typing inside a line of a 50k line file costs one line parse; typing that
+ * changes the block structure or the names in scope adds one pass over the
+ * shapes.
+ */
+
+typedef enum { LINE_PLAIN, LINE_IF, LINE_ELSE, LINE_ENDIF, LINE_WHILE, LINE_ENDWHILE, LINE_FOR, LINE_ENDFOR } LineKind;
+
+typedef struct {
+    char *name;
+    int arg_count;
+} CheckCall;
+
+typedef struct {
+    unsigned char dirty;        // text changed, not parsed yet
+    unsigned char fresh;        // parsed since the last update
+    unsigned char import_bare;  // #[lib] or [src] lib: bare names too
+    char *defines;              // function defined here
+    char *import;               // library imported here
+    CheckCall *calls;
+    int call_count;
+    char *error;                // found in the line on its own
+    char *call_error;
+    char *shown;                // message last reported
+} CheckLine;
+
+typedef struct {
+    guint64 bloom;              // a bit per called name
+    const char *block_error;
+    const char *last_error;     // block_error before the running pass
+    int braces;                 // '{' minus '}' outside strings
+    int pending;                // during a pass: blocks opened here and not closed yet
+    int kind;                   // LineKind
+} LineShape;
+
+// What parse_line learns about one line
+typedef struct {
+    CheckLine line;
+    LineShape shape;
+} LineParse;
+
+typedef struct {
+    int line;
+    int kind;                   // LINE_IF, LINE_WHILE, LINE_FOR or -1 for '{'
+} OpenBlock;
+
+struct CcrpChecker {
+    GPtrArray *lines;           // CheckLine*
+    GArray *shapes;             // LineShape, one per line
+    int dirty_from, dirty_to;   // every dirty or fresh line lies in [dirty_from, dirty_to)
+    GHashTable *defined;        // function name -> definitions
+    GHashTable *imports;        // library -> imports of any form
+    GHashTable *bare_imports;   // library -> imports with bare names
+    GHashTable *libraries;      // library -> set of its function names, NULL value if missing
+    guint64 changed;            // bloom of names whose meaning changed since the last update
+    int blocks_changed;         // a line's keyword or braces changed
+    GArray *open;               // OpenBlock, during a pass
+    GArray *reported;           // lines whose message changed in the last update
+    CcrpVM *vm;                 // holds the string literals of parsed expressions
+};
+
+#define LINE(c, i) ((CheckLine*)g_ptr_array_index((c)->lines, (i)))
+#define SHAPE(c, i) (&g_array_index((c)->shapes, LineShape, (i)))
+#define MAX_INTERNED 4096       // literals kept before the parsing VM is replaced
+
+// ------------------------ Names ------------------------
+static guint64 name_bit(const char *name) {
+    return (guint64)1 << (g_str_hash(name) & 63);
+}
+
+// Add delta to name's count; 1 when the name appeared or disappeared
+static int count_name(GHashTable *table, const char *name, int delta) {
+    int before = GPOINTER_TO_INT(g_hash_table_lookup(table, name));
+    int after = before + delta;
+    if (after > 0) g_hash_table_replace(table, g_strdup(name), GINT_TO_POINTER(after));
+    else g_hash_table_remove(table, name);
+    return (before > 0) != (after > 0);
+}
+
+static void free_names(gpointer names) {
+    if (names) g_hash_table_destroy(names);
+}
+
+// Function names of src/lib.crh, read once; NULL if there is no such library
+static GHashTable* library_names(CcrpChecker *c, const char *lib) {
+    gpointer names;
+    if (g_hash_table_lookup_extended(c->libraries, lib, NULL, &names)) return names;
+    char **list = ccrp_library_function_names(lib);
+    GHashTable *set = NULL;
+    if (list) {
+        set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        for (int i = 0; list[i]; i++) g_hash_table_add(set, list[i]);
+        g_free(list); // the strings now belong to the set
+    }
+    g_hash_table_insert(c->libraries, g_strdup(lib), set);
+    return set;
+}
+
+static guint64 qualified_bit(const char *lib, const char *name) {
+    char *qualified = g_strdup_printf("%s.%s", lib, name);
+    guint64 bit = name_bit(qualified);
+    g_free(qualified);
+    return bit;
+}
+
+// Bloom of every call an import of lib can make resolve: its functions, bare
+// and qualified, and the builtins it enables
+static guint64 library_bloom(CcrpChecker *c, const char *lib) {
+    guint64 bloom = 0;
+    GHashTable *names = library_names(c, lib);
+    if (names) {
+        GHashTableIter it;
+        gpointer name;
+        g_hash_table_iter_init(&it, names);
+        while (g_hash_table_iter_next(&it, &name, NULL)) bloom |= name_bit(name) | qualified_bit(lib, name);
+    }
+    const Builtin *b;
+    for (int i = 0; (b = ccrp_builtin_at(i)); i++) {
+        if (b->library && strcmp(b->library, lib) == 0) bloom |= name_bit(b->name) | qualified_bit(lib, b->name);
+    }
+    return bloom;
+}
+
+// Add (delta 1) or withdraw (-1) what a line defines and imports
+static void scope_update(CcrpChecker *c, const CheckLine *l, int delta) {
+    if (l->defines && count_name(c->defined, l->defines, delta)) c->changed |= name_bit(l->defines);
+    if (l->import) {
+        int changed = count_name(c->imports, l->import, delta);
+        if (l->import_bare && count_name(c->bare_imports, l->import, delta)) changed = 1;
+        if (changed) c->changed |= library_bloom(c, l->import);
+    }
+}
+
+// ------------------------ Parsing one line ------------------------
+static int starts_with_word(const char *s, const char *word) {
+    size_t n = strlen(word);
+    return strncmp(s, word, n) == 0 && (s[n] == '\0' || s[n] == ' ' || s[n] == '\t');
+}
+
+static const char* skip_word(const char *s) {
+    while (*s && *s != ' ' && *s != '\t') s++;
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+// Control keyword: a word, or directly followed by `(` as in if(x > 3)
+static int starts_with_keyword(const char *s, const char *word) {
+    size_t n = strlen(word);
+    return starts_with_word(s, word) || (strncmp(s, word, n) == 0 && s[n] == '(');
+}
+
+// Condition after a control keyword that starts s
+static const char* skip_keyword(const char *s, const char *word) {
+    s += strlen(word);
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+static int count_braces(const char *s) {
+    int n = 0, in_str = 0;
+    for (; *s; s++) {
+        if (*s == '"') in_str = !in_str;
+        else if (!in_str && *s == '{') n++;
+        else if (!in_str && *s == '}') n--;
+    }
+    return n;
+}
+
+static void add_calls(LineParse *p, const Expr *e) {
+    if (!e) return;
+    if (e->kind == EXPR_CALL) {
+        CheckLine *l = &p->line;
+        l->calls = realloc(l->calls, (size_t)(l->call_count + 1) * sizeof(CheckCall));
+        l->calls[l->call_count].name = g_strdup(e->name);
+        l->calls[l->call_count++].arg_count = e->arg_count;
+        p->shape.bloom |= name_bit(e->name);
+    }
+    add_calls(p, e->left);
+    add_calls(p, e->right);
+    for (int i = 0; i < e->arg_count; i++) add_calls(p, e->args[i]);
+}
+
+// Keep the calls of expression src; a syntax error becomes the line's error
+static void check_expr(LineParse *p, const char *src) {
+    Expr *e = ccrp_expr_try_parse(src);
+    if (!e) {
+        if (!p->line.error) p->line.error = g_strdup_printf("invalid expression '%s'", src);
+        return;
+    }
+    add_calls(p, e);
+    ccrp_expr_free(e);
+}
+
+// print items are split at top-level commas; string literals are not parsed
+static void check_print(LineParse *p, const char *args) {
+    const char *s = args;
+    while (*s) {
+        const char *start = s;
+        int depth = 0, in_str = 0;
+        for (; *s; s++) {
+            if (*s == '"') in_str = !in_str;
+            else if (!in_str && (*s == '(' || *s == '[' || *s == '{')) depth++;
+            else if (!in_str && (*s == ')' || *s == ']' || *s == '}')) depth--;
+            else if (!in_str && depth == 0 && *s == ',') break;
+        }
+        const char *end = s;
+        while (*start == ' ' || *start == '\t') start++;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (end > start && !(end - start >= 2 && *start == '"' && end[-1] == '"')) {
+            char *item = g_strndup(start, (gsize)(end - start));
+            check_expr(p, item);
+            g_free(item);
+        }
+        if (*s == ',') s++;
+    }
+}
+
+static void check_import(CcrpChecker *c, LineParse *p, const char *lib, int bare) {
+    p->line.import = g_strdup(lib);
+    p->line.import_bare = (unsigned char)bare;
+    if (!library_names(c, lib)) p->line.error = g_strdup_printf("library '%s' not found (src/%s.crh)", lib, lib);
+}
+
+// Mirrors the statement forms of compile_lines in ccrp_vm.c
+static void parse_line(CcrpChecker *c, LineParse *p, const char *text) {
+    const char *start = text;
+    while (*start == ' ' || *start == '\t') start++;
+    const char *comment = strstr(start, "//");
+    const char *stop = comment ? comment : start + strlen(start);
+    while (stop > start && isspace((unsigned char)stop[-1])) stop--;
+    char *s = g_strndup(start, (gsize)(stop - start));
+    p->shape.braces = count_braces(s);
+
+    char *name = NULL, *rhs = NULL, *index = NULL, *from = NULL, *to = NULL;
+    char lib[50];
+    if (!*s || (s[0] == '#' && s[1] != '[')) {
+        // blank or comment
+    } else if (starts_with_keyword(s, "if") || starts_with_keyword(s, "while")) {
+        p->shape.kind = s[0] == 'i' ? LINE_IF : LINE_WHILE;
+        check_expr(p, skip_keyword(s, s[0] == 'i' ? "if" : "while"));
+    } else if (starts_with_keyword(s, "for")) {
+        if (parse_for_header(s, &name, &from, &to)) {
+            p->shape.kind = LINE_FOR;
+            check_expr(p, from);
+            check_expr(p, to);
+        } else {
+            p->line.error = g_strdup("expected 'for NAME in START..END'");
+        }
+    } else if (starts_with_word(s, "parallel")) {
+        ParallelHeader h;
+        if (ccrp_parallel_parse(s, &h)) {
+            p->shape.kind = LINE_FOR;
+            check_expr(p, h.start);
+            check_expr(p, h.end);
+            ccrp_parallel_header_free(&h);
+        } else {
+            p->line.error = g_strdup("expected 'parallel for NAME in START..END [reduce OP into NAME, ...]'");
+        }
+    } else if (starts_with_word(s, "else")) {
+        p->shape.kind = LINE_ELSE;
+        const char *rest = skip_word(s);
+        if (starts_with_keyword(rest, "if")) check_expr(p, skip_keyword(rest, "if"));
+    } else if (strcmp(s, "endif") == 0) {
+        p->shape.kind = LINE_ENDIF;
+    } else if (strcmp(s, "endwhile") == 0) {
+        p->shape.kind = LINE_ENDWHILE;
+    } else if (strcmp(s, "endfor") == 0 || (s[0] == '}' && strcmp(s + 1 + strspn(s + 1, " \t"), "endfor") == 0)) {
+        p->shape.kind = LINE_ENDFOR; // `} endfor` closes a braced parallel for
+    } else if (starts_with_word(s, "print")) {
+        check_print(p, skip_word(s));
+    } else if (starts_with_word(s, "return")) {
+        if (*skip_word(s)) check_expr(p, skip_word(s));
+    } else if (starts_with_word(s, "function") || starts_with_word(s, "fn")) {
+        const char *def = skip_word(s);
+        const char *end = strchr(def, '(');
+        while (end && end > def && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (end && end > def) p->line.defines = g_strndup(def, (gsize)(end - def));
+        else p->line.error = g_strdup("expected 'function NAME(PARAMS) {'");
+    } else if (strncmp(s, "#[", 2) == 0) {
+        if (sscanf(s, "#[use %49[^]]]", lib) == 1) check_import(c, p, lib, 0);
+        else if (sscanf(s, "#[%49[^]]]", lib) == 1) check_import(c, p, lib, 1);
+    } else if (strncmp(s, "[src]", 5) == 0) {
+        if (sscanf(s, "[src] %49s", lib) == 1) check_import(c, p, lib, 1);
+    } else if (starts_with_word(s, "style") && strchr(s, '{')) {
+        // style block: CSS, not CCRP
+    } else if (ccrp_task_parse(s, &name, &rhs) >= 0) {
+        check_expr(p, rhs);
+    } else if (parse_index_assignment(s, &name, &index, &rhs)) {
+        check_expr(p, index);
+        check_expr(p, rhs);
+    } else if (is_call_statement(s)) {
+        check_expr(p, s);
+    } else if (split_assignment(s, &name, &rhs)) {
+        check_expr(p, rhs);
+    }
+    // anything else (gtk commands, dot-call sugar, input) is left to the interpreter
+    g_free(name);
+    g_free(rhs);
+    g_free(index);
+    g_free(from);
+    g_free(to);
+    g_free(s);
+}
+
+// ------------------------ Line records ------------------------
+// Free what the line's text produced; the last reported message stays
+static void line_clear(CheckLine *l) {
+    for (int i = 0; i < l->call_count; i++) g_free(l->calls[i].name);
+    free(l->calls);
+    g_free(l->defines);
+    g_free(l->import);
+    g_free(l->error);
+    g_free(l->call_error);
+    l->calls = NULL;
+    l->call_count = 0;
+    l->defines = l->import = l->error = l->call_error = NULL;
+}
+
+static void line_free(CheckLine *l) {
+    line_clear(l);
+    g_free(l->shown);
+    free(l);
+}
+
+static void mark_dirty(CcrpChecker *c, int from, int to) {
+    if (c->dirty_from >= c->dirty_to) {
+        c->dirty_from = from;
+        c->dirty_to = to;
+    } else {
+        c->dirty_from = MIN(c->dirty_from, from);
+        c->dirty_to = MAX(c->dirty_to, to);
+    }
+}
+
+CcrpChecker* ccrp_checker_new(void) {
+    CcrpChecker *c = calloc(1, sizeof(CcrpChecker));
+    c->lines = g_ptr_array_new();
+    c->shapes = g_array_new(FALSE, TRUE, sizeof(LineShape));
+    c->defined = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    c->imports = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    c->bare_imports = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    c->libraries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_names);
+    c->open = g_array_new(FALSE, FALSE, sizeof(OpenBlock));
+    c->reported = g_array_new(FALSE, FALSE, sizeof(int));
+    c->vm = ccrp_vm_new();
+    ccrp_checker_edit(c, 0, 0, 1); // an empty buffer has one line
+    return c;
+}
+
+void ccrp_checker_free(CcrpChecker *c) {
+    if (!c) return;
+    for (guint i = 0; i < c->lines->len; i++) line_free(LINE(c, i));
+    g_ptr_array_free(c->lines, TRUE);
+    g_array_free(c->shapes, TRUE);
+    g_hash_table_destroy(c->defined);
+    g_hash_table_destroy(c->imports);
+    g_hash_table_destroy(c->bare_imports);
+    g_hash_table_destroy(c->libraries);
+    g_array_free(c->open, TRUE);
+    g_array_free(c->reported, TRUE);
+    ccrp_vm_free(c->vm);
+    free(c);
+}
+
+int ccrp_checker_line_count(const CcrpChecker *c) {
+    return (int)c->lines->len;
+}
+
+// Lines first .. first+removed-1 were replaced by added lines, still to be parsed
+void ccrp_checker_edit(CcrpChecker *c, int first, int removed, int added) {
+    int count = (int)c->lines->len;
+    first = CLAMP(first, 0, count);
+    removed = CLAMP(removed, 0, count - first);
+    added = MAX(added, 0);
+    // Records that stay are parsed again in place, so typing that keeps a
+    // line's keyword and braces leaves the blocks as they were
+    int kept = MIN(removed, added);
+    for (int i = first; i < first + kept; i++) LINE(c, i)->dirty = 1;
+    for (int i = first + kept; i < first + removed; i++) {
+        const LineShape *shape = SHAPE(c, i);
+        if (shape->kind != LINE_PLAIN || shape->braces) c->blocks_changed = 1;
+        scope_update(c, LINE(c, i), -1);
+        line_free(LINE(c, i));
+    }
+    // one move of each array's tail, however many lines come and go
+    int tail = count - first - removed, size = count + added - removed;
+    if (added > removed) {
+        g_ptr_array_set_size(c->lines, size);
+        g_array_set_size(c->shapes, (guint)size);
+    }
+    memmove(&c->lines->pdata[first + added], &c->lines->pdata[first + removed], (size_t)tail * sizeof(gpointer));
+    memmove(SHAPE(c, first + added), SHAPE(c, first + removed), (size_t)tail * sizeof(LineShape));
+    if (added < removed) {
+        g_ptr_array_set_size(c->lines, size);
+        g_array_set_size(c->shapes, (guint)size);
+    }
+    for (int i = first + kept; i < first + added; i++) {
+        CheckLine *l = calloc(1, sizeof(CheckLine));
+        l->dirty = 1;
+        c->lines->pdata[i] = l;
+        memset(SHAPE(c, i), 0, sizeof(LineShape));
+    }
+
+    if (c->dirty_from < c->dirty_to) {
+        // the range moves with the lines around the edit
+        int delta = added - removed;
+        if (c->dirty_from >= first + removed) c->dirty_from += delta;
+        else if (c->dirty_from > first) c->dirty_from = first;
+        if (c->dirty_to >= first + removed) c->dirty_to += delta;
+        else if (c->dirty_to > first) c->dirty_to = first;
+    }
+    mark_dirty(c, first, first + added);
+}
+
+// First line from `from` on that needs ccrp_checker_set_line, -1 if none
+int ccrp_checker_next_dirty(const CcrpChecker *c, int from) {
+    for (int i = MAX(from, c->dirty_from); i < c->dirty_to; i++) {
+        if (LINE(c, i)->dirty) return i;
+    }
+    return -1;
+}
+
+void ccrp_checker_set_line(CcrpChecker *c, int line, const char *text) {
+    if (line < 0 || line >= (int)c->lines->len) return;
+    CheckLine *l = LINE(c, line);
+    LineShape *shape = SHAPE(c, line);
+    LineParse p;
+    memset(&p, 0, sizeof(p));
+    CcrpVM *outer = ccrp_vm;
+    ccrp_vm = c->vm;
+    parse_line(c, &p, text);
+    ccrp_vm = outer;
+    if (c->vm->interned && g_hash_table_size(c->vm->interned) > MAX_INTERNED) {
+        // the parsed expressions are gone, so their literals can go too
+        ccrp_vm_free(c->vm);
+        c->vm = ccrp_vm_new();
+    }
+
+    // The scope changes only when the definition or import itself changed
+    if (g_strcmp0(l->defines, p.line.defines) != 0 || g_strcmp0(l->import, p.line.import) != 0 ||
+        l->import_bare != p.line.import_bare) {
+        scope_update(c, l, -1);
+        scope_update(c, &p.line, 1);
+    }
+    if (shape->kind != p.shape.kind || shape->braces != p.shape.braces) c->blocks_changed = 1;
+    line_clear(l);
+    p.line.shown = l->shown;
+    p.line.fresh = 1;
+    *l = p.line;
+    shape->kind = p.shape.kind;
+    shape->braces = p.shape.braces;
+    shape->bloom = p.shape.bloom;
+    mark_dirty(c, line, line + 1);
+}
+
+// ------------------------ Relating lines ------------------------
+// NULL when the call resolves the way the interpreter would resolve it
+static char* resolve_call(CcrpChecker *c, const CheckCall *call) {
+    if (g_hash_table_contains(c->defined, call->name)) return NULL;
+    const Builtin *b = ccrp_builtin_find(call->name, call->arg_count);
+    if (b && !b->library) return NULL;
+    if (b) {
+        if (g_hash_table_contains(c->imports, b->library)) return NULL;
+        return g_strdup_printf("'%s' library not imported for %s", b->library, call->name);
+    }
+    const char *dot = strchr(call->name, '.');
+    if (dot) {
+        char *lib = g_strndup(call->name, (gsize)(dot - call->name));
+        GHashTable *names = g_hash_table_contains(c->imports, lib) ? library_names(c, lib) : NULL;
+        g_free(lib);
+        if (names && g_hash_table_contains(names, dot + 1)) return NULL;
+    } else {
+        GHashTableIter it;
+        gpointer lib;
+        g_hash_table_iter_init(&it, c->bare_imports);
+        while (g_hash_table_iter_next(&it, &lib, NULL)) {
+            GHashTable *names = library_names(c, lib);
+            if (names && g_hash_table_contains(names, call->name)) return NULL;
+        }
+    }
+    return g_strdup_printf("Unknown function '%s'", call->name);
+}
+
+static void check_calls(CcrpChecker *c, CheckLine *l) {
+    g_free(l->call_error);
+    l->call_error = NULL;
+    for (int i = 0; i < l->call_count && !l->call_error; i++) l->call_error = resolve_call(c, &l->calls[i]);
+}
+
+// Note line if it was parsed or its message changed since it was last reported
+static void report(CcrpChecker *c, int line) {
+    CheckLine *l = LINE(c, line);
+    const char *block_error = SHAPE(c, line)->block_error;
+    const char *message = l->error ? l->error : block_error ? block_error : l->call_error;
+    if (!l->fresh && g_strcmp0(message, l->shown) == 0) return;
+    l->fresh = 0;
+    g_free(l->shown);
+    l->shown = g_strdup(message);
+    g_array_append_val(c->reported, line);
+}
+
+// A line's blocks are all matched: report it if its block error changed
+static void settle(CcrpChecker *c, int line, LineShape *shape) {
+    if (--shape->pending == 0 && shape->block_error != shape->last_error) report(c, line);
+}
+
+static void open_block(CcrpChecker *c, int line, LineShape *shape, int kind) {
+    OpenBlock b = { line, kind };
+    g_array_append_val(c->open, b);
+    shape->pending++;
+}
+
+static void close_block(CcrpChecker *c, const char *error) {
+    int line = g_array_index(c->open, OpenBlock, c->open->len - 1).line;
+    LineShape *shape = SHAPE(c, line);
+    g_array_set_size(c->open, c->open->len - 1);
+    if (error && !shape->block_error) shape->block_error = error;
+    settle(c, line, shape);
+}
+
+static const char* never_closed(int kind) {
+    switch (kind) {
+        case LINE_IF: return "'if' block is never closed";
+        case LINE_WHILE: return "'while' block is never closed";
+        case LINE_FOR: return "'for' block is never closed";
+        default: return "'{' is never closed";
+    }
+}
+
+static int top_kind(const CcrpChecker *c) {
+    return c->open->len ? g_array_index(c->open, OpenBlock, c->open->len - 1).kind : LINE_PLAIN;
+}
+
+static void match_braces(CcrpChecker *c, int line, LineShape *shape) {
+    for (int n = shape->braces; n > 0; n--) open_block(c, line, shape, -1);
+    for (int n = shape->braces; n < 0; n++) {
+        int brace = (int)c->open->len - 1;
+        while (brace >= 0 && g_array_index(c->open, OpenBlock, brace).kind != -1) brace--;
+        if (brace < 0) {
+            if (!shape->block_error) shape->block_error = "'}' without '{'";
+            return;
+        }
+        // blocks opened inside the braces end with them
+        while ((int)c->open->len - 1 > brace) close_block(c, never_closed(top_kind(c)));
+        close_block(c, NULL);
+    }
+}
+
+static void match_keyword(CcrpChecker *c, int line, LineShape *shape) {
+    switch (shape->kind) {
+        case LINE_IF: case LINE_WHILE: case LINE_FOR:
+            open_block(c, line, shape, shape->kind);
+            break;
+        case LINE_ELSE:
+            if (top_kind(c) != LINE_IF) shape->block_error = "'else' without 'if'";
+            break;
+        case LINE_ENDIF:
+            if (top_kind(c) == LINE_IF) close_block(c, NULL);
+            else shape->block_error = "'endif' without 'if'";
+            break;
+        case LINE_ENDWHILE:
+            if (top_kind(c) == LINE_WHILE) close_block(c, NULL);
+            else shape->block_error = "'endwhile' without 'while'";
+            break;
+        case LINE_ENDFOR:
+            if (top_kind(c) == LINE_FOR) close_block(c, NULL);
+            else shape->block_error = "'endfor' without 'for'";
+            break;
+        default:
+            break;
+    }
+}
+
+// Match every block of the buffer, reporting lines whose block error changed
+static void match_blocks(CcrpChecker *c) {
+    g_array_set_size(c->open, 0);
+    int count = (int)c->shapes->len;
+    for (int i = 0; i < count; i++) {
+        LineShape *shape = SHAPE(c, i);
+        if (shape->kind == LINE_PLAIN && !shape->braces && !shape->block_error) continue; // most lines
+        shape->last_error = shape->block_error;
+        shape->block_error = NULL;
+        shape->pending = 1; // the line itself, settled below
+        int closes = shape->kind == LINE_ENDIF || shape->kind == LINE_ENDWHILE || shape->kind == LINE_ENDFOR;
+        // `} endfor` leaves the braces before the loop; `parallel for ... {` enters them after it
+        if (closes) match_braces(c, i, shape);
+        match_keyword(c, i, shape);
+        if (!closes) match_braces(c, i, shape);
+        settle(c, i, shape);
+    }
+    while (c->open->len) close_block(c, never_closed(top_kind(c)));
+}
+
+// Relate the lines after edits (parse every dirty line first). Returns the
+// lines whose message changed, valid until the next call.
+const GArray* ccrp_checker_update(CcrpChecker *c) {
+    g_array_set_size(c->reported, 0);
+    // Calls of parsed lines, and any call whose meaning may have changed with
+    // the definitions and imports; only the bloom is read for the others
+    int count = (int)c->lines->len;
+    int dirty_to = MIN(c->dirty_to, count);
+    int from = c->changed ? 0 : c->dirty_from, to = c->changed ? count : dirty_to;
+    for (int i = from; i < to; i++) {
+        int parsed = i >= c->dirty_from && i < dirty_to && LINE(c, i)->fresh;
+        if (parsed || (SHAPE(c, i)->bloom & c->changed)) {
+            check_calls(c, LINE(c, i));
+            report(c, i);
+        }
+    }
+    if (c->blocks_changed) match_blocks(c);
+    c->blocks_changed = 0;
+    c->changed = 0;
+    c->dirty_from = c->dirty_to = 0;
+    return c->reported;
+}
+
+// Message shown for line after the last update, NULL if it is fine
+const char* ccrp_checker_message(const CcrpChecker *c, int line) {
+    if (line < 0 || line >= (int)c->lines->len) return NULL;
+    return LINE(c, line)->shown;
+}
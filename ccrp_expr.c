@@ -0,0 +1,627 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+
+/*
+ * CCRP expression engine
+ *
+ * Expressions are parsed once by a precedence-climbing parser into an Expr tree
+ * and evaluated by walking the tree. Parsed trees are cached by source position
+ * (line, column), so an expression that is evaluated again (a loop condition,
+ * an assignment inside a loop) costs one cache lookup instead of a re-parse.
+ *
+ * Precedence, lowest first:
+ *   or ||   and &&   == != < <= > >=   ..   + -   * / %   unary - + ! not
+ *
+ * `..` always concatenates; `+` concatenates when either operand is a string.
+ * Postfix a[i] and a[i:j] bind tighter than everything; [x, y] builds an array.
+ */
+
+// ------------------------ Tokenizer ------------------------
+typedef enum {
+    TOK_END,
+    TOK_NUM,
+    TOK_STR,
+    TOK_IDENT,
+    TOK_OP,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_COMMA,
+    TOK_LBRACKET,
+    TOK_RBRACKET,
+    TOK_COLON,
+    TOK_LBRACE,
+    TOK_RBRACE,
+    TOK_ERROR
+} TokKind;
+
+typedef struct {
+    const char *src;
+    const char *pos;
+    TokKind kind;
+    const char *start;  // current token text
+    int len;
+    Value num;
+} Parser;
+
+static void next_token(Parser *p) {
+    const char *s = p->pos;
+    while (*s == ' ' || *s == '\t') s++;
+    p->start = s;
+    if (!*s) { p->kind = TOK_END; p->len = 0; p->pos = s; return; }
+    if (isdigit((unsigned char)*s)) {
+        char *end;
+        p->num = value_int(strtoll(s, &end, 10));
+        if (*end == '.' && isdigit((unsigned char)end[1])) p->num = value_double(strtod(s, &end));
+        s = end;
+        p->kind = TOK_NUM;
+    } else if (isalpha((unsigned char)*s) || *s == '_') {
+        // a dot followed by a name continues it: qualified library calls like math.sqrt
+        while (isalnum((unsigned char)*s) || *s == '_' ||
+               (*s == '.' && (isalpha((unsigned char)s[1]) || s[1] == '_'))) s++;
+        p->kind = TOK_IDENT;
+        // word operators
+        int n = (int)(s - p->start);
+        if ((n == 3 && strncmp(p->start, "and", 3) == 0) ||
+            (n == 2 && strncmp(p->start, "or", 2) == 0) ||
+            (n == 3 && strncmp(p->start, "not", 3) == 0)) p->kind = TOK_OP;
+    } else if (*s == '"') {
+        s++;
+        while (*s && *s != '"') s++;
+        if (!*s) { p->kind = TOK_ERROR; p->pos = s; return; }
+        s++;
+        p->kind = TOK_STR;
+    } else if (*s == '(') { s++; p->kind = TOK_LPAREN; }
+    else if (*s == ')') { s++; p->kind = TOK_RPAREN; }
+    else if (*s == ',') { s++; p->kind = TOK_COMMA; }
+    else if (*s == '[') { s++; p->kind = TOK_LBRACKET; }
+    else if (*s == ']') { s++; p->kind = TOK_RBRACKET; }
+    else if (*s == ':') { s++; p->kind = TOK_COLON; }
+    else if (*s == '{') { s++; p->kind = TOK_LBRACE; }
+    else if (*s == '}') { s++; p->kind = TOK_RBRACE; }
+    else if ((s[0] == '=' && s[1] == '=') || (s[0] == '!' && s[1] == '=') ||
+             (s[0] == '<' && s[1] == '=') || (s[0] == '>' && s[1] == '=') ||
+             (s[0] == '&' && s[1] == '&') || (s[0] == '|' && s[1] == '|') ||
+             (s[0] == '.' && s[1] == '.')) { s += 2; p->kind = TOK_OP; }
+    else if (strchr("+-*/%<>!", *s)) { s++; p->kind = TOK_OP; }
+    else { p->kind = TOK_ERROR; s++; }
+    p->len = (int)(s - p->start);
+    p->pos = s;
+}
+
+static int tok_is(const Parser *p, const char *op) {
+    return p->kind == TOK_OP && (int)strlen(op) == p->len && strncmp(p->start, op, p->len) == 0;
+}
+
+// ------------------------ Tree construction ------------------------
+static Expr* new_expr(ExprKind kind) {
+    Expr *e = calloc(1, sizeof(Expr));
+    e->kind = kind;
+    e->slot = -1;
+    e->value = value_int(0);
+    return e;
+}
+
+void ccrp_expr_free(Expr *e) {
+    if (!e) return;
+    ccrp_expr_free(e->left);
+    ccrp_expr_free(e->right);
+    for (int i = 0; i < e->arg_count; i++) ccrp_expr_free(e->args[i]);
+    free(e->args);
+    g_free(e->name);
+    value_release(e->value);
+    free(e);
+}
+
+// Binary operator under the cursor and its precedence, or -1
+static int peek_binop(const Parser *p, int *prec) {
+    static const struct { const char *text; int op; int prec; } table[] = {
+        {"or", BIN_OR, 1}, {"||", BIN_OR, 1},
+        {"and", BIN_AND, 2}, {"&&", BIN_AND, 2},
+        {"==", BIN_EQ, 3}, {"!=", BIN_NE, 3}, {"<=", BIN_LE, 3},
+        {">=", BIN_GE, 3}, {"<", BIN_LT, 3}, {">", BIN_GT, 3},
+        {"..", BIN_CONCAT, 4},
+        {"+", BIN_ADD, 5}, {"-", BIN_SUB, 5},
+        {"*", BIN_MUL, 6}, {"/", BIN_DIV, 6}, {"%", BIN_MOD, 6},
+    };
+    if (p->kind != TOK_OP) return -1;
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (tok_is(p, table[i].text)) { *prec = table[i].prec; return table[i].op; }
+    }
+    return -1;
+}
+
+static Expr* parse_binary(Parser *p, int min_prec);
+
+// Comma-separated expressions into e->args up to the closing token
+static Expr* parse_list(Parser *p, Expr *e, TokKind close) {
+    int capacity = 0;
+    while (p->kind != close) {
+        Expr *arg = parse_binary(p, 1);
+        if (!arg) { ccrp_expr_free(e); return NULL; }
+        if (e->arg_count >= capacity) {
+            capacity = capacity ? capacity * 2 : 2;
+            e->args = realloc(e->args, capacity * sizeof(Expr*));
+        }
+        e->args[e->arg_count++] = arg;
+        if (p->kind == TOK_COMMA) next_token(p);
+        else if (p->kind != close) { ccrp_expr_free(e); return NULL; }
+    }
+    next_token(p);
+    return e;
+}
+
+// {key: value, ...} after the opening brace; args alternate keys and values
+static Expr* parse_map(Parser *p) {
+    Expr *e = new_expr(EXPR_MAP);
+    int capacity = 0;
+    while (p->kind != TOK_RBRACE) {
+        Expr *key = parse_binary(p, 1), *value = NULL;
+        if (key && p->kind == TOK_COLON) {
+            next_token(p);
+            value = parse_binary(p, 1);
+        }
+        if (!value) { ccrp_expr_free(key); ccrp_expr_free(e); return NULL; }
+        if (e->arg_count + 2 > capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            e->args = realloc(e->args, capacity * sizeof(Expr*));
+        }
+        e->args[e->arg_count++] = key;
+        e->args[e->arg_count++] = value;
+        if (p->kind == TOK_COMMA) next_token(p);
+        else if (p->kind != TOK_RBRACE) { ccrp_expr_free(e); return NULL; }
+    }
+    next_token(p);
+    return e;
+}
+
+static Expr* parse_primary(Parser *p) {
+    if (p->kind == TOK_NUM) {
+        Expr *e = new_expr(EXPR_NUM);
+        e->value = p->num;
+        next_token(p);
+        return e;
+    }
+    if (p->kind == TOK_STR) {
+        Expr *e = new_expr(EXPR_STR);
+        e->value = value_string_intern(p->start + 1, (size_t)(p->len - 2));
+        next_token(p);
+        return e;
+    }
+    if (p->kind == TOK_IDENT) {
+        char *name = g_strndup(p->start, (gsize)p->len);
+        next_token(p);
+        if (p->kind != TOK_LPAREN) {
+            Expr *e = new_expr(EXPR_VAR);
+            e->name = name;
+            return e;
+        }
+        Expr *e = new_expr(EXPR_CALL);
+        e->name = name;
+        next_token(p);
+        return parse_list(p, e, TOK_RPAREN);
+    }
+    if (p->kind == TOK_LBRACKET) {
+        next_token(p);
+        return parse_list(p, new_expr(EXPR_ARRAY), TOK_RBRACKET);
+    }
+    if (p->kind == TOK_LBRACE) {
+        next_token(p);
+        return parse_map(p);
+    }
+    if (p->kind == TOK_LPAREN) {
+        next_token(p);
+        Expr *inner = parse_binary(p, 1);
+        if (!inner || p->kind != TOK_RPAREN) { ccrp_expr_free(inner); return NULL; }
+        next_token(p);
+        return inner;
+    }
+    return NULL;
+}
+
+// target[index] or target[start:end] after the opening bracket
+static Expr* parse_subscript(Parser *p, Expr *target) {
+    next_token(p);
+    Expr *start = NULL, *end = NULL;
+    if (p->kind != TOK_COLON) {
+        start = parse_binary(p, 1);
+        if (!start) { ccrp_expr_free(target); return NULL; }
+    }
+    Expr *e;
+    if (p->kind == TOK_COLON) {
+        next_token(p);
+        if (p->kind != TOK_RBRACKET) {
+            end = parse_binary(p, 1);
+            if (!end) { ccrp_expr_free(target); ccrp_expr_free(start); return NULL; }
+        }
+        e = new_expr(EXPR_SLICE);
+        e->args = malloc(2 * sizeof(Expr*));
+        e->args[0] = start;
+        e->args[1] = end;
+        e->arg_count = 2;
+    } else {
+        if (!start) { ccrp_expr_free(target); return NULL; }
+        e = new_expr(EXPR_INDEX);
+        e->right = start;
+    }
+    e->left = target;
+    if (p->kind != TOK_RBRACKET) { ccrp_expr_free(e); return NULL; }
+    next_token(p);
+    return e;
+}
+
+static Expr* parse_unary(Parser *p) {
+    if (tok_is(p, "-") || tok_is(p, "!") || tok_is(p, "not") || tok_is(p, "+")) {
+        int is_plus = tok_is(p, "+");
+        ExprKind kind = tok_is(p, "-") ? EXPR_NEG : EXPR_NOT;
+        next_token(p);
+        Expr *operand = parse_unary(p);
+        if (!operand || is_plus) return operand;
+        if (kind == EXPR_NEG && operand->kind == EXPR_NUM) {
+            if (operand->value.type == VAL_DOUBLE) operand->value.as.d = -operand->value.as.d;
+            else operand->value.as.i = (int64_t)(0 - (uint64_t)operand->value.as.i);
+            return operand;
+        }
+        Expr *e = new_expr(kind);
+        e->left = operand;
+        return e;
+    }
+    Expr *e = parse_primary(p);
+    while (e && p->kind == TOK_LBRACKET) e = parse_subscript(p, e);
+    return e;
+}
+
+static Expr* parse_binary(Parser *p, int min_prec) {
+    Expr *lhs = parse_unary(p);
+    if (!lhs) return NULL;
+    for (;;) {
+        int prec;
+        int op = peek_binop(p, &prec);
+        if (op < 0 || prec < min_prec) return lhs;
+        next_token(p);
+        Expr *rhs = parse_binary(p, prec + 1);
+        if (!rhs) { ccrp_expr_free(lhs); return NULL; }
+        Expr *e = new_expr(EXPR_BINARY);
+        e->op = op;
+        e->left = lhs;
+        e->right = rhs;
+        lhs = e;
+    }
+}
+
+// NULL when src is not a whole expression; nothing is reported
+Expr* ccrp_expr_try_parse(const char *src) {
+    Parser p = { src, src, TOK_END, src, 0, {0} };
+    next_token(&p);
+    Expr *e = parse_binary(&p, 1);
+    if (e && p.kind != TOK_END) { ccrp_expr_free(e); e = NULL; }
+    return e;
+}
+
+Expr* ccrp_expr_parse(const char *src) {
+    Expr *e = ccrp_expr_try_parse(src);
+    if (!e) ccrp_out_printf("Error: invalid expression '%s'\n", src);
+    return e;
+}
+
+// ------------------------ Resolution ------------------------
+// Bind every variable reference to a slot so evaluation never hashes: a local
+// of fn when it declares that name, otherwise a global in vars[]
+void ccrp_resolve_expr_in(Expr *e, const Function *fn) {
+    if (!e) return;
+    if (e->kind == EXPR_VAR) {
+        e->local = 0;
+        for (int i = 0; fn && i < fn->local_count; i++) {
+            if (strcmp(fn->local_names[i], e->name) == 0) { e->local = 1; e->slot = i; break; }
+        }
+        if (!e->local) e->slot = var_slot(e->name);
+    }
+    ccrp_resolve_expr_in(e->left, fn);
+    ccrp_resolve_expr_in(e->right, fn);
+    for (int i = 0; i < e->arg_count; i++) ccrp_resolve_expr_in(e->args[i], fn);
+}
+
+void ccrp_resolve_expr(Expr *e) {
+    ccrp_resolve_expr_in(e, NULL);
+}
+
+// ------------------------ Evaluation ------------------------
+static Value eval_call(const Expr *e) {
+    // A call site binds once, to a user function or else to a builtin; neither
+    // is ever removed, so the binding can be memoized
+    Function *user_func = e->fn;
+    if (!user_func && !e->builtin) user_func = ((Expr*)e)->fn = ccrp_call_target(e->name, e->arg_count);
+    Value small[8];
+    Value *args = e->arg_count <= 8 ? small : malloc(e->arg_count * sizeof(Value));
+    for (int i = 0; i < e->arg_count; i++) args[i] = ccrp_expr_eval(e->args[i]);
+    Value result;
+    if (user_func) {
+        result = ccrp_call(user_func, args, e->arg_count);
+    } else {
+        const Builtin *b = e->builtin;
+        if (!b) b = ((Expr*)e)->builtin = ccrp_builtin_resolve(e->name, e->arg_count);
+        result = b ? b->fn(args) : value_int(0);
+    }
+    for (int i = 0; i < e->arg_count; i++) value_release(args[i]);
+    if (args != small) free(args);
+    return result;
+}
+
+// Ordering of two values: strings compare as text, everything else numerically
+static int compare_values(Value l, Value r) {
+    if (l.type == VAL_STR && r.type == VAL_STR) return strcmp(l.as.s->data, r.as.s->data);
+    if (l.type == VAL_INT && r.type == VAL_INT) return (l.as.i > r.as.i) - (l.as.i < r.as.i);
+    double a = value_to_double(l), b = value_to_double(r);
+    return (a > b) - (a < b);
+}
+
+static int values_equal(Value l, Value r) {
+    if ((l.type == VAL_ARRAY) != (r.type == VAL_ARRAY)) return 0;
+    if (l.type == VAL_ARRAY) return ccrp_array_equal(l.as.a, r.as.a);
+    if (l.type == VAL_MAP || r.type == VAL_MAP) return l.type == r.type && l.as.m == r.as.m;
+    if ((l.type == VAL_STR) != (r.type == VAL_STR)) return 0;
+    return compare_values(l, r) == 0;
+}
+
+// 64-bit integer arithmetic, wrapping on overflow instead of invoking UB
+static inline int64_t int_arith(int op, int64_t l, int64_t r) {
+    uint64_t a = (uint64_t)l, b = (uint64_t)r;
+    switch (op) {
+        case BIN_ADD: return (int64_t)(a + b);
+        case BIN_SUB: return (int64_t)(a - b);
+        case BIN_MUL: return (int64_t)(a * b);
+        case BIN_DIV: return r == 0 ? 0 : r == -1 ? (int64_t)(0 - a) : l / r;
+        case BIN_MOD: return r == 0 || r == -1 ? 0 : l % r;
+    }
+    return 0;
+}
+
+static Value eval_arith(int op, Value l, Value r) {
+    if (l.type != VAL_DOUBLE && r.type != VAL_DOUBLE)
+        return value_int(int_arith(op, value_to_int(l), value_to_int(r)));
+    double a = value_to_double(l), b = value_to_double(r);
+    switch (op) {
+        case BIN_ADD: return value_double(a + b);
+        case BIN_SUB: return value_double(a - b);
+        case BIN_MUL: return value_double(a * b);
+        case BIN_DIV: return value_double(b != 0.0 ? a / b : 0.0);
+        case BIN_MOD: return value_double(b != 0.0 ? fmod(a, b) : 0.0);
+    }
+    return value_int(0);
+}
+
+// EXPR_NEG or EXPR_NOT applied to v; consumes v
+Value ccrp_apply_unary(ExprKind kind, Value v) {
+    if (kind == EXPR_NOT) {
+        int t = value_truthy(v);
+        value_release(v);
+        return value_int(!t);
+    }
+    if (v.type == VAL_DOUBLE) return value_double(-v.as.d);
+    int64_t i = value_to_int(v);
+    value_release(v);
+    return value_int((int64_t)(0 - (uint64_t)i));
+}
+
+// Non-logical binary operator; consumes both operands
+Value ccrp_apply_binary(int op, Value l, Value r) {
+    Value result;
+    switch (op) {
+        case BIN_EQ: result = value_int(values_equal(l, r)); break;
+        case BIN_NE: result = value_int(!values_equal(l, r)); break;
+        case BIN_LT: result = value_int(compare_values(l, r) < 0); break;
+        case BIN_LE: result = value_int(compare_values(l, r) <= 0); break;
+        case BIN_GT: result = value_int(compare_values(l, r) > 0); break;
+        case BIN_GE: result = value_int(compare_values(l, r) >= 0); break;
+        case BIN_ADD:
+            if (l.type != VAL_STR && r.type != VAL_STR) { result = eval_arith(op, l, r); break; }
+            /* fall through */
+        case BIN_CONCAT:
+            result = value_concat(l, r);
+            value_release(r);
+            return result;
+        default: result = eval_arith(op, l, r); break;
+    }
+    value_release(l);
+    value_release(r);
+    return result;
+}
+
+// Array and map literals, indexing and slicing
+static Value eval_collection(const Expr *e) {
+    if (e->kind == EXPR_MAP) {
+        CcrpMap *m = ccrp_map_new((size_t)e->arg_count / 2);
+        for (int i = 0; i + 1 < e->arg_count; i += 2) {
+            Value key = ccrp_expr_eval(e->args[i]), v = ccrp_expr_eval(e->args[i + 1]);
+            ccrp_map_set(m, key, v);
+            value_release(key);
+            value_release(v);
+        }
+        return value_map(m);
+    }
+    if (e->kind == EXPR_ARRAY) {
+        CcrpArray *a = ccrp_array_new(0, (size_t)e->arg_count);
+        for (int i = 0; i < e->arg_count; i++) {
+            Value v = ccrp_expr_eval(e->args[i]);
+            if (!ccrp_array_push(a, v)) ccrp_out_printf("Error: arrays hold only numbers.\n");
+            value_release(v);
+        }
+        return value_array(a);
+    }
+    Value target = ccrp_expr_eval(e->left), result;
+    if (e->kind == EXPR_INDEX) {
+        Value index = ccrp_expr_eval(e->right);
+        result = ccrp_index_get(target, index);
+        value_release(index);
+    } else {
+        Value start = ccrp_expr_eval(e->args[0]), end = ccrp_expr_eval(e->args[1]);
+        result = ccrp_slice(target, e->args[0] ? &start : NULL, e->args[1] ? &end : NULL);
+        value_release(start);
+        value_release(end);
+    }
+    value_release(target);
+    return result;
+}
+
+// Returns a new reference; the caller releases it
+Value ccrp_expr_eval(const Expr *e) {
+    if (!e) return value_int(0);
+    switch (e->kind) {
+        case EXPR_NUM:
+            return e->value;
+        case EXPR_STR:
+            value_retain(e->value);
+            return e->value;
+        case EXPR_VAR: {
+            if (e->slot < 0) return get_value(e->name);
+            Value v = *CCRP_VAR(e->local, e->slot);
+            value_retain(v);
+            return v;
+        }
+        case EXPR_NEG:
+        case EXPR_NOT:
+            return ccrp_apply_unary(e->kind, ccrp_expr_eval(e->left));
+        case EXPR_CALL:
+            return eval_call(e);
+        case EXPR_ARRAY:
+        case EXPR_MAP:
+        case EXPR_INDEX:
+        case EXPR_SLICE:
+            return eval_collection(e);
+        case EXPR_BINARY:
+            if (e->int_only) return value_int(ccrp_expr_eval_int(e));
+            break;
+    }
+    Value l = ccrp_expr_eval(e->left);
+    // short-circuit logic operators
+    if (e->op == BIN_AND || e->op == BIN_OR) {
+        int t = value_truthy(l);
+        value_release(l);
+        if (e->op == BIN_AND ? !t : t) return value_int(t);
+        Value r = ccrp_expr_eval(e->right);
+        t = value_truthy(r);
+        value_release(r);
+        return value_int(t);
+    }
+    return ccrp_apply_binary(e->op, l, ccrp_expr_eval(e->right));
+}
+
+// Unboxed evaluation of a tree the type inference marked int_only: every
+// variable it reads holds an int, so reads are one tag check and no refcounts
+int64_t ccrp_expr_eval_int(const Expr *e) {
+    switch (e->kind) {
+        case EXPR_NUM: return e->value.as.i;
+        case EXPR_VAR: return value_as_int(CCRP_VAR(e->local, e->slot));
+        case EXPR_NEG: return (int64_t)(0 - (uint64_t)ccrp_expr_eval_int(e->left));
+        case EXPR_NOT: return !ccrp_expr_eval_int(e->left);
+        case EXPR_CALL: {
+            Value r = eval_call(e);
+            int64_t x = value_as_int(&r);
+            value_release(r);
+            return x;
+        }
+        case EXPR_STR: return 0;
+        case EXPR_ARRAY: case EXPR_MAP: case EXPR_INDEX: case EXPR_SLICE: {
+            Value v = eval_collection(e);
+            int64_t i = value_to_int(v);
+            value_release(v);
+            return i;
+        }
+        case EXPR_BINARY: break;
+    }
+    switch (e->op) {
+        case BIN_AND: return ccrp_expr_eval_int(e->left) && ccrp_expr_eval_int(e->right);
+        case BIN_OR: return ccrp_expr_eval_int(e->left) || ccrp_expr_eval_int(e->right);
+        default: break;
+    }
+    int64_t a = ccrp_expr_eval_int(e->left), b = ccrp_expr_eval_int(e->right);
+    switch (e->op) {
+        case BIN_EQ: return a == b;
+        case BIN_NE: return a != b;
+        case BIN_LT: return a < b;
+        case BIN_LE: return a <= b;
+        case BIN_GT: return a > b;
+        case BIN_GE: return a >= b;
+        default: return int_arith(e->op, a, b);
+    }
+}
+
+// target = target + rhs / target = target .. rhs. A string target is detached
+// from its variable before the operator runs, so it is uniquely owned and the
+// concatenation appends in place instead of copying the whole string.
+void ccrp_expr_assign(const Expr *e, int local, int slot) {
+    if (e && e->kind == EXPR_BINARY && (e->op == BIN_ADD || e->op == BIN_CONCAT) &&
+        e->left->kind == EXPR_VAR && e->left->slot == slot && e->left->local == local &&
+        CCRP_VAR(local, slot)->type == VAL_STR) {
+        Value r = ccrp_expr_eval(e->right);
+        Value *dst = CCRP_VAR(local, slot); // vars[] may have grown during the call above
+        Value cur = *dst;
+        *dst = value_int(0);
+        *dst = ccrp_apply_binary(e->op, cur, r);
+        return;
+    }
+    value_assign(CCRP_VAR(local, slot), ccrp_expr_eval(e));
+}
+
+// ------------------------ Parse cache ------------------------
+typedef struct {
+    gint64 key;         // line << 32 | column
+    char *source;       // text the tree was parsed from, to detect stale positions
+    Expr *expr;
+} ExprCacheEntry;
+
+// g_int64_hash folds the halves with xor, which leaves column -1 keys clustered
+static guint expr_key_hash(gconstpointer key) {
+    guint64 k = (guint64)*(const gint64*)key * 0x9E3779B97F4A7C15ull;
+    return (guint)(k >> 32);
+}
+
+static void free_cache_entry(gpointer data) {
+    ExprCacheEntry *entry = data;
+    g_free(entry->source);
+    ccrp_expr_free(entry->expr);
+    free(entry);
+}
+
+// Parsed, resolved and folded tree for src at (line, column), kept in the VM
+Expr* ccrp_expr_cached(int line, int column, const char *src) {
+    CcrpVM *vm = ccrp_vm;
+    if (!vm->expr_cache) vm->expr_cache = g_hash_table_new_full(expr_key_hash, g_int64_equal, NULL, free_cache_entry);
+    gint64 key = ((gint64)line << 32) | (guint32)column;
+    ExprCacheEntry *entry = g_hash_table_lookup(vm->expr_cache, &key);
+    if (entry && strcmp(entry->source, src) == 0) return entry->expr;
+    entry = malloc(sizeof(ExprCacheEntry));
+    entry->key = key;
+    entry->source = g_strdup(src);
+    entry->expr = ccrp_expr_parse(src);
+    ccrp_resolve_expr(entry->expr);
+    ccrp_expr_fold(entry->expr);
+    g_hash_table_replace(vm->expr_cache, &entry->key, entry);
+    return entry->expr;
+}
+
+void ccrp_expr_cache_clear(void) {
+    if (ccrp_vm->expr_cache) g_hash_table_remove_all(ccrp_vm->expr_cache);
+}
+
+// ------------------------ Public entry points ------------------------
+Value eval_value_at(const char *expr, int column) {
+    return ccrp_expr_eval(ccrp_expr_cached(ccrp_vm->current_line_index, column, expr));
+}
+
+int64_t eval_expr(const char *expr) {
+    Value v = eval_value_at(expr, -1);
+    int64_t i = value_to_int(v);
+    value_release(v);
+    return i;
+}
+
+int eval_condition(const char *condition) {
+    Value v = eval_value_at(condition, -1);
+    int t = value_truthy(v);
+    value_release(v);
+    return t;
+}
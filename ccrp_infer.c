@@ -0,0 +1,302 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * CCRP type inference
+ *
+ * Whole-program pass over the compiled script and every function it can call,
+ * imported .crh libraries included. It proves which globals, locals,
+ * parameters and return values only ever hold integers, then specializes the
+ * code that touches them: int_only expression trees are evaluated unboxed by
+ * ccrp_expr_eval_int, and assignments and branches on them use OP_ASSIGN_INT
+ * and OP_JUMP_IF_FALSE_INT, or the fused OP_ADD_INT (x = x + k) and
+ * OP_CMP_JUMP_INT (if a < b) where the shape allows. For loops always store
+ * ints into their variable.
+ *
+ * Every slot starts out as int, unless it already holds something else (a
+ * global left by an earlier run, or copied into a parallel for worker), and is
+ * demoted when some assignment, argument or return may store something else.
+ * Demotion repeats until nothing changes, so what is left is consistent: an
+ * int slot is only ever written with ints.
+ *
+ * Functions or imports that appear at runtime (inside a block) could break
+ * those guarantees, so a program containing one is left unspecialized.
+ */
+
+typedef struct {
+    char *global_int;   // per slot in vars[]
+    int global_count;
+    int changed;
+} Infer;
+
+// Int flag of a resolved variable slot, NULL when nothing is known about it
+static char* slot_flag(Infer *in, int local, int slot, const Function *scope) {
+    if (slot < 0) return NULL;
+    if (local) return scope ? &scope->local_int[slot] : NULL;
+    return slot < in->global_count ? &in->global_int[slot] : NULL;
+}
+
+// Whether e yields an int under the current assumptions
+static int expr_int(Infer *in, const Expr *e, const Function *scope) {
+    if (!e) return 1; // an invalid expression evaluates to 0
+    switch (e->kind) {
+        case EXPR_NUM: return e->value.type == VAL_INT;
+        case EXPR_STR: return 0;
+        case EXPR_VAR: {
+            char *flag = slot_flag(in, e->local, e->slot, scope);
+            return flag && *flag;
+        }
+        case EXPR_NEG: return expr_int(in, e->left, scope);
+        case EXPR_NOT: return 1;
+        case EXPR_ARRAY: case EXPR_MAP: case EXPR_INDEX: case EXPR_SLICE: return 0;
+        case EXPR_CALL: {
+            // failed calls produce 0
+            Function *callee = ccrp_call_target(e->name, e->arg_count);
+            if (callee) return callee->returns_int;
+            const Builtin *b = ccrp_builtin_find(e->name, e->arg_count);
+            return !b || (b->flags & BUILTIN_INT);
+        }
+        case EXPR_BINARY:
+            switch (e->op) {
+                case BIN_ADD: case BIN_SUB: case BIN_MUL: case BIN_DIV: case BIN_MOD:
+                    return expr_int(in, e->left, scope) && expr_int(in, e->right, scope);
+                case BIN_CONCAT: return 0;
+                default: return 1; // comparisons and logic
+            }
+    }
+    return 0;
+}
+
+static void demote(Infer *in, char *flag) {
+    if (flag && *flag) { *flag = 0; in->changed = 1; }
+}
+
+// Parameters are int only if every call site passes ints
+static void check_calls(Infer *in, const Expr *e, const Function *scope) {
+    if (!e) return;
+    if (e->kind == EXPR_CALL) {
+        Function *callee = ccrp_call_target(e->name, e->arg_count);
+        if (callee && callee->param_count == e->arg_count) {
+            for (int i = 0; i < e->arg_count; i++)
+                if (!expr_int(in, e->args[i], scope)) demote(in, &callee->local_int[i]);
+        }
+    }
+    check_calls(in, e->left, scope);
+    check_calls(in, e->right, scope);
+    for (int i = 0; i < e->arg_count; i++) check_calls(in, e->args[i], scope);
+}
+
+// Next user function called in the text of a statement left to run_line,
+// searching from *p. Inference never sees those arguments.
+static Function* next_line_call(const char **p) {
+    const char *s = *p;
+    while (*s) {
+        if (*s == '"') {
+            s++;
+            while (*s && *s != '"') s += (*s == '\\' && s[1]) ? 2 : 1;
+            if (*s) s++;
+        } else if (isalpha((unsigned char)*s) || *s == '_') {
+            const char *start = s;
+            while (isalnum((unsigned char)*s) || *s == '_' || *s == '.') s++;
+            const char *q = s;
+            while (*q == ' ' || *q == '\t') q++;
+            char name[MAX_FUNCTION_NAME];
+            size_t len = (size_t)(s - start);
+            if (*q != '(' || len >= sizeof(name)) continue;
+            memcpy(name, start, len);
+            name[len] = '\0';
+            Function *fn = get_function(name);
+            if (fn) { *p = s; return fn; }
+        } else {
+            s++;
+        }
+    }
+    *p = s;
+    return NULL;
+}
+
+static void infer_program(Infer *in, const Program *prog, Function *scope) {
+    for (int i = 0; i < prog->count; i++) {
+        const Instr *ins = &prog->code[i];
+        check_calls(in, ins->expr, scope);
+        check_calls(in, ins->limit, scope);
+        for (int k = 0; k < ins->item_count; k++) check_calls(in, ins->items[k].expr, scope);
+        if (ins->op == OP_LINE) {
+            // arguments and results of calls run by run_line are unknown
+            const char *p = ins->a;
+            Function *callee;
+            while ((callee = next_line_call(&p))) {
+                for (int k = 0; k < callee->param_count; k++) demote(in, &callee->local_int[k]);
+                if (callee->returns_int) { callee->returns_int = 0; in->changed = 1; }
+            }
+        }
+        if ((ins->op == OP_ASSIGN && !expr_int(in, ins->expr, scope)) || (ins->op == OP_AWAIT && ins->imm)) {
+            demote(in, slot_flag(in, ins->local, ins->slot, scope)); // a task may return anything
+        } else if (ins->op == OP_RETURN && scope && ins->expr && !expr_int(in, ins->expr, scope)) {
+            if (scope->returns_int) { scope->returns_int = 0; in->changed = 1; }
+        }
+    }
+}
+
+// Mark subtrees that can be evaluated entirely on ints
+static int mark_int_only(Infer *in, Expr *e, const Function *scope) {
+    if (!e) return 0;
+    for (int i = 0; i < e->arg_count; i++) mark_int_only(in, e->args[i], scope);
+    int left = mark_int_only(in, e->left, scope);
+    int right = mark_int_only(in, e->right, scope);
+    switch (e->kind) {
+        case EXPR_NUM: case EXPR_VAR: case EXPR_CALL: e->int_only = expr_int(in, e, scope); break;
+        case EXPR_NEG: case EXPR_NOT: e->int_only = left; break;
+        case EXPR_BINARY: e->int_only = e->op != BIN_CONCAT && left && right; break;
+        case EXPR_STR: case EXPR_ARRAY: case EXPR_MAP: case EXPR_INDEX: case EXPR_SLICE: e->int_only = 0; break;
+    }
+    return e->int_only;
+}
+
+static void specialize(Infer *in, Program *prog, const Function *scope) {
+    for (int i = 0; i < prog->count; i++) {
+        Instr *ins = &prog->code[i];
+        mark_int_only(in, ins->expr, scope);
+        mark_int_only(in, ins->limit, scope);
+        for (int k = 0; k < ins->item_count; k++) mark_int_only(in, ins->items[k].expr, scope);
+        Expr *e = ins->expr;
+        if (!e || !e->int_only) continue;
+        if (ins->op == OP_ASSIGN) {
+            const char *flag = slot_flag(in, ins->local, ins->slot, scope);
+            if (!flag || !*flag) continue;
+            ins->op = OP_ASSIGN_INT;
+            // x = x + k, x = x - k, x = k + x
+            if (e->kind == EXPR_BINARY && (e->op == BIN_ADD || e->op == BIN_SUB)) {
+                const Expr *var = e->left, *k = e->right;
+                if (e->op == BIN_ADD && k->kind == EXPR_VAR) { var = e->right; k = e->left; }
+                if (var->kind == EXPR_VAR && var->local == ins->local && var->slot == ins->slot &&
+                    k->kind == EXPR_NUM) {
+                    ins->op = OP_ADD_INT;
+                    ins->imm = e->op == BIN_SUB ? (int64_t)(0 - (uint64_t)k->value.as.i) : k->value.as.i;
+                }
+            }
+        } else if (ins->op == OP_JUMP_IF_FALSE) {
+            ins->op = OP_JUMP_IF_FALSE_INT;
+            if (e->kind == EXPR_BINARY && e->op >= BIN_EQ && e->op <= BIN_GE) {
+                ins->op = OP_CMP_JUMP_INT;
+                ins->imm = e->op;
+            }
+        }
+    }
+}
+
+// Statements that define functions or load libraries while running
+static int has_runtime_definitions(const Program *prog) {
+    for (int i = 0; i < prog->count; i++) {
+        const Instr *ins = &prog->code[i];
+        if (ins->op != OP_LINE) continue;
+        if (strncmp(ins->a, "function", 8) == 0 || strncmp(ins->a, "fn ", 3) == 0 ||
+            strncmp(ins->a, "#[", 2) == 0 || strncmp(ins->a, "[src]", 5) == 0) return 1;
+    }
+    return 0;
+}
+
+static void add_callee(GPtrArray *reach, GHashTable *seen, Function *callee) {
+    if (callee && !g_hash_table_contains(seen, callee)) {
+        g_hash_table_insert(seen, callee, callee);
+        g_ptr_array_add(reach, callee);
+    }
+}
+
+// Add the user functions called anywhere in e to the reachable set
+static void add_callees(GPtrArray *reach, GHashTable *seen, const Expr *e) {
+    if (!e) return;
+    if (e->kind == EXPR_CALL) add_callee(reach, seen, ccrp_call_target(e->name, e->arg_count));
+    add_callees(reach, seen, e->left);
+    add_callees(reach, seen, e->right);
+    for (int i = 0; i < e->arg_count; i++) add_callees(reach, seen, e->args[i]);
+}
+
+static void add_program_callees(GPtrArray *reach, GHashTable *seen, const Program *prog) {
+    for (int i = 0; i < prog->count; i++) {
+        const Instr *ins = &prog->code[i];
+        add_callees(reach, seen, ins->expr);
+        add_callees(reach, seen, ins->limit);
+        for (int k = 0; k < ins->item_count; k++) add_callees(reach, seen, ins->items[k].expr);
+        if (ins->op == OP_LINE) {
+            const char *p = ins->a;
+            Function *callee;
+            while ((callee = next_line_call(&p))) add_callee(reach, seen, callee);
+        }
+    }
+}
+
+void ccrp_infer_types(Program *main) {
+    // Only functions the script can call are analysed; library functions it
+    // never uses stay uncompiled. They are compiled here so their bodies can be read.
+    GPtrArray *reach = g_ptr_array_new();
+    GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    add_program_callees(reach, seen, main);
+    int bail = has_runtime_definitions(main);
+    for (guint f = 0; f < reach->len && !bail; f++) {
+        Function *fn = g_ptr_array_index(reach, f);
+        if (!fn->program) fn->program = ccrp_compile_function(fn);
+        bail = has_runtime_definitions(fn->program);
+        add_program_callees(reach, seen, fn->program);
+    }
+    g_hash_table_destroy(seen);
+    if (bail) { g_ptr_array_free(reach, TRUE); return; }
+    int count = (int)reach->len;
+    Function **fns = (Function**)reach->pdata;
+
+    int var_count = ccrp_vm->var_count;
+    Infer in = { NULL, var_count, 0 };
+    in.global_int = malloc((size_t)var_count + 1);
+    for (int i = 0; i < var_count; i++) in.global_int[i] = ccrp_vm->vars[i].type == VAL_INT;
+    for (int f = 0; f < count; f++) {
+        Function *fn = fns[f];
+        free(fn->local_int);
+        fn->local_int = malloc((size_t)fn->local_count + 1);
+        memset(fn->local_int, 1, (size_t)fn->local_count + 1);
+        fn->returns_int = 1;
+    }
+
+    // Statements left to run_line store into globals, from any scope:
+    // input_text a string, and its assignment fallback (NAME = ..., NAME[i] = ...,
+    // for names the compiler rejects like cfg.mode) anything at all. A parallel
+    // for stores whatever its reductions produce.
+    for (int f = -1; f < count; f++) {
+        Function *scope = f < 0 ? NULL : fns[f];
+        const Program *prog = scope ? scope->program : main;
+        for (int i = 0; i < prog->count; i++) {
+            const Instr *ins = &prog->code[i];
+            char name[50];
+            ParallelHeader h;
+            if (ins->op != OP_LINE) continue;
+            if (sscanf(ins->a, "input_text %49s", name) == 1 ||
+                (strchr(ins->a, '=') && sscanf(ins->a, " %49[^ =[]", name) == 1)) {
+                int slot = find_var_slot(name);
+                if (slot >= 0 && slot < in.global_count) in.global_int[slot] = 0;
+            }
+            if (ccrp_parallel_parse(ins->a, &h)) {
+                for (int r = 0; r < h.reduction_count; r++) {
+                    int k = 0;
+                    while (scope && k < scope->local_count && strcmp(scope->local_names[k], h.reduce_into[r]) != 0) k++;
+                    int slot = find_var_slot(h.reduce_into[r]);
+                    if (scope && k < scope->local_count) scope->local_int[k] = 0;
+                    else if (slot >= 0 && slot < in.global_count) in.global_int[slot] = 0;
+                }
+                ccrp_parallel_header_free(&h);
+            }
+        }
+    }
+
+    do {
+        in.changed = 0;
+        infer_program(&in, main, NULL);
+        for (int f = 0; f < count; f++) infer_program(&in, fns[f]->program, fns[f]);
+    } while (in.changed);
+
+    specialize(&in, main, NULL);
+    for (int f = 0; f < count; f++) specialize(&in, fns[f]->program, fns[f]);
+    free(in.global_int);
+    g_ptr_array_free(reach, TRUE);
+}
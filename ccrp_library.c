@@ -0,0 +1,429 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ccrp.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * CCRP libraries
+ *
+ * Importing a .crh library only indexes it: each function's name maps to the
+ * offset of its definition (parameter list, body, line range) in a string
+ * pool. A function record is created the first time the name is looked up,
+ * and its body is compiled on its first call, so importing a large library
+ * costs almost nothing for the functions a script never uses.
+ *
+ * Every function is indexed under its qualified name (math.sqrt). `#[math]`
+ * also indexes the bare names; `#[use math]` does not, so a library can be
+ * imported without its names colliding with the script's.
+ *
+ * The pool is built by scanning the .crh once and saved as a .crhc file next
+ * to the library, or under $XDG_CACHE_HOME/cryptic when src/ is not writable.
+ * Later imports map that file and index it in place. A cache is used when the
+ * library's size and stamp (mtime and ctime to the nanosecond, inode) match
+ * the ones recorded in it. Otherwise the library is hashed: an unchanged hash
+ * keeps the cache (and refreshes the recorded stamp), anything else rebuilds
+ * it. A stamp within a second of the cache's own mtime proves nothing, since
+ * the library may have been rewritten within one tick of a coarse clock, so
+ * such a library is always hashed.
+ *
+ * Cache layout: CacheHeader, function_count CacheEntry records, then the
+ * string pool. Entries hold offsets of NUL-terminated strings in the pool.
+ */
+
+#define CACHE_MAGIC "CRHC"
+#define CACHE_VERSION 3
+#define NS_PER_SEC 1000000000LL
+
+typedef struct {
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t ino;
+} SourceStamp;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    SourceStamp source_stamp;
+    uint64_t source_size;
+    uint64_t source_hash;   // FNV-1a of the library text
+    uint32_t function_count;
+    uint32_t strings_size;
+} CacheHeader;
+
+typedef struct {
+    uint32_t name;
+    uint32_t params;
+    uint32_t body;
+    int32_t start_line;
+    int32_t end_line;
+} CacheEntry;
+
+// An imported library: its entries and string pool, mapped from the cache or on the heap
+typedef struct {
+    const CacheEntry *entries;
+    uint32_t count;
+    const char *strings;
+    void *map;              // cache mapping, NULL when entries and strings are on the heap
+    size_t map_length;
+    char *path;             // src/NAME.crh
+    int bare_names;         // bare names have been indexed
+    Function **defined;     // per entry, created on first lookup
+} Library;
+
+typedef struct {
+    Library *lib;
+    uint32_t entry;
+} LibraryFunction;
+
+// ------------------------ Paths ------------------------
+static uint64_t fnv1a(const char *data, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Cache file for the library at path: 0 next to it, 1 in the user cache directory
+static char* cache_path(const char *lib_name, const char *path, int where) {
+    if (where == 0) return g_strdup_printf("%sc", path);
+    // Keyed by the library's location so projects with their own src/ don't collide
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    char *full = g_build_filename(cwd, path, NULL);
+    char *file = g_strdup_printf("%s-%016llx.crhc", lib_name, (unsigned long long)fnv1a(full, strlen(full)));
+    char *result = g_build_filename(g_get_user_cache_dir(), "cryptic", file, NULL);
+    g_free(file);
+    g_free(full);
+    return result;
+}
+
+char* read_library_file(const char *lib_name) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "src/%s.crh", lib_name);
+    FILE *file = fopen(filename, "r");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *content = malloc(file_size + 1);
+    if (!content) { fclose(file); return NULL; }
+    size_t bytes_read = fread(content, 1, file_size, file);
+    content[bytes_read] = '\0';
+    fclose(file);
+    return content;
+}
+
+// ------------------------ Scanning ------------------------
+static int has_prefix_word(const char *line, const char *word) {
+    char first[256];
+    if (sscanf(line, " %255s", first) != 1) return 0;
+    return strncmp(first, word, strlen(word)) == 0;
+}
+
+static uint32_t pool_add(GString *pool, const char *s, size_t length) {
+    uint32_t offset = (uint32_t)pool->len;
+    g_string_append_len(pool, s, (gssize)length);
+    g_string_append_c(pool, '\0');
+    return offset;
+}
+
+// Find every `function`/`fn` definition in the library text; returns the entry count
+static int scan_library(const char *content, GString *pool, CacheEntry **entries_out) {
+    int line_count;
+    char **lines = split_lines(content, &line_count);
+    int count = 0, capacity = 16;
+    CacheEntry *entries = malloc(capacity * sizeof(CacheEntry));
+    GString *body = g_string_new("");
+
+    for (int i = 0; i < line_count; i++) {
+        if (!has_prefix_word(lines[i], "function") && !has_prefix_word(lines[i], "fn")) continue;
+        char func_def[256];
+        if (sscanf(lines[i], "%*s %255[^{]", func_def) != 1) continue;
+        const char *paren = strchr(func_def, '(');
+        if (!paren) continue;
+
+        // Find closing '}' matching this block
+        int body_start = i + 1, depth = 1, body_end = -1;
+        for (int j = body_start; j < line_count; j++) {
+            if (strstr(lines[j], "{") != NULL) depth++;
+            if (strstr(lines[j], "}") != NULL) {
+                depth--;
+                if (depth == 0) { body_end = j; break; }
+            }
+        }
+        if (body_end <= body_start) continue;
+
+        if (count >= capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(CacheEntry));
+        }
+        CacheEntry *e = &entries[count++];
+        size_t name_len = (size_t)(paren - func_def);
+        if (name_len >= MAX_FUNCTION_NAME) name_len = MAX_FUNCTION_NAME - 1;
+        while (name_len > 0 && func_def[name_len - 1] == ' ') name_len--;
+        e->name = pool_add(pool, func_def, name_len);
+        const char *close = strchr(paren, ')');
+        e->params = pool_add(pool, paren + 1, close ? (size_t)(close - paren - 1) : strlen(paren + 1));
+        g_string_truncate(body, 0);
+        for (int j = body_start; j < body_end; j++) {
+            g_string_append(body, lines[j]);
+            g_string_append_c(body, '\n');
+        }
+        e->body = pool_add(pool, body->str, body->len);
+        e->start_line = body_start;
+        e->end_line = body_end;
+        i = body_end;
+    }
+
+    g_string_free(body, TRUE);
+    free_lines(lines, line_count);
+    *entries_out = entries;
+    return count;
+}
+
+// Names of the functions src/NAME.crh defines, without importing it (for
+// editors); NULL when there is no such library. Free with g_strfreev.
+char** ccrp_library_function_names(const char *lib_name) {
+    char *content = read_library_file(lib_name);
+    if (!content) return NULL;
+    GString *pool = g_string_new("");
+    CacheEntry *entries;
+    int count = scan_library(content, pool, &entries);
+    char **names = g_new(char*, count + 1);
+    for (int i = 0; i < count; i++) names[i] = g_strdup(pool->str + entries[i].name);
+    names[count] = NULL;
+    free(entries);
+    g_string_free(pool, TRUE);
+    free(content);
+    return names;
+}
+
+// ------------------------ Cache files ------------------------
+// Header and string pool are consistent with the file size
+static int cache_valid(const char *map, size_t size) {
+    if (size < sizeof(CacheHeader)) return 0;
+    const CacheHeader *h = (const CacheHeader*)map;
+    if (memcmp(h->magic, CACHE_MAGIC, 4) != 0 || h->version != CACHE_VERSION) return 0;
+    size_t strings = sizeof(CacheHeader) + (size_t)h->function_count * sizeof(CacheEntry);
+    if (strings > size || size - strings != h->strings_size || h->strings_size == 0) return 0;
+    if (map[size - 1] != '\0') return 0;
+    const CacheEntry *entries = (const CacheEntry*)(map + sizeof(CacheHeader));
+    for (uint32_t i = 0; i < h->function_count; i++) {
+        if (entries[i].name >= h->strings_size || entries[i].params >= h->strings_size ||
+            entries[i].body >= h->strings_size) return 0;
+    }
+    return 1;
+}
+
+static SourceStamp source_stamp(const struct stat *st) {
+    SourceStamp s;
+    memset(&s, 0, sizeof(s));
+    s.mtime_ns = (int64_t)st->st_mtim.tv_sec * NS_PER_SEC + st->st_mtim.tv_nsec;
+    s.ctime_ns = (int64_t)st->st_ctim.tv_sec * NS_PER_SEC + st->st_ctim.tv_nsec;
+    s.ino = (uint64_t)st->st_ino;
+    return s;
+}
+
+// Whether the cache (last written at cache_mtime_ns) describes the library as it is now
+static int cache_current(const char *cache_file, int64_t cache_mtime_ns, const CacheHeader *h,
+                         const char *path, const struct stat *st) {
+    if ((uint64_t)st->st_size != h->source_size) return 0;
+    SourceStamp stamp = source_stamp(st);
+    if (memcmp(&stamp, &h->source_stamp, sizeof(stamp)) == 0 && stamp.mtime_ns < cache_mtime_ns - NS_PER_SEC) return 1;
+    gchar *content = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(path, &content, &length, NULL)) return 0;
+    int same = length == h->source_size && fnv1a(content, length) == h->source_hash;
+    g_free(content);
+    if (same) {
+        // touched but unchanged: record the new stamp so the next import skips the hash
+        int fd = open(cache_file, O_WRONLY);
+        if (fd >= 0) {
+            ssize_t written = pwrite(fd, &stamp, sizeof(stamp), offsetof(CacheHeader, source_stamp));
+            (void)written; // if this fails the hash is just checked again next time
+            close(fd);
+        }
+    }
+    return same;
+}
+
+// Map a current cache of the library; the mapping stays until the VM is freed
+static int cache_load(Library *lib, const char *lib_name, const char *path, const struct stat *st) {
+    for (int where = 0; where < 2; where++) {
+        char *file = cache_path(lib_name, path, where);
+        int fd = open(file, O_RDONLY);
+        if (fd < 0) { g_free(file); continue; }
+        struct stat cst;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &cst) == 0 && cst.st_size > 0)
+            map = mmap(NULL, (size_t)cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) { g_free(file); continue; }
+
+        const CacheHeader *h = map;
+        int64_t cache_mtime_ns = (int64_t)cst.st_mtim.tv_sec * NS_PER_SEC + cst.st_mtim.tv_nsec;
+        int ok = cache_valid(map, (size_t)cst.st_size) && cache_current(file, cache_mtime_ns, h, path, st);
+        g_free(file);
+        if (ok) {
+            lib->entries = (const CacheEntry*)((const char*)map + sizeof(CacheHeader));
+            lib->count = h->function_count;
+            lib->strings = (const char*)(lib->entries + h->function_count);
+            lib->map = map;
+            lib->map_length = (size_t)cst.st_size;
+            return 1;
+        }
+        munmap(map, (size_t)cst.st_size);
+    }
+    return 0;
+}
+
+// Write to a temporary file and rename, so readers never see a partial cache.
+// The name is unique per VM, so concurrent imports in one process don't collide.
+static int write_cache(const char *file, const CacheHeader *h, const CacheEntry *entries, const GString *pool) {
+    char *tmp = g_strdup_printf("%s.%ld.%p.tmp", file, (long)getpid(), (void*)ccrp_vm);
+    FILE *out = fopen(tmp, "wb");
+    int ok = out != NULL;
+    if (ok) {
+        ok = fwrite(h, sizeof(*h), 1, out) == 1 &&
+             (h->function_count == 0 || fwrite(entries, sizeof(CacheEntry), h->function_count, out) == h->function_count) &&
+             fwrite(pool->str, 1, pool->len, out) == pool->len;
+        ok = fclose(out) == 0 && ok;
+        ok = ok && rename(tmp, file) == 0;
+        if (!ok) remove(tmp);
+    }
+    g_free(tmp);
+    return ok;
+}
+
+static void cache_store(const char *lib_name, const char *path, const struct stat *st, const char *content,
+                        size_t length, const CacheEntry *entries, int count, const GString *pool) {
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 4);
+    h.version = CACHE_VERSION;
+    h.source_stamp = source_stamp(st);
+    h.source_size = length;
+    h.source_hash = fnv1a(content, length);
+    h.function_count = (uint32_t)count;
+    h.strings_size = (uint32_t)pool->len;
+
+    char *file = cache_path(lib_name, path, 0);
+    if (!write_cache(file, &h, entries, pool)) {
+        g_free(file);
+        file = cache_path(lib_name, path, 1);
+        char *dir = g_path_get_dirname(file);
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+        write_cache(file, &h, entries, pool);
+    }
+    g_free(file);
+}
+
+// Scan the library text and cache the result; the pool is kept on the heap
+static int scan_and_store(Library *lib, const char *lib_name, const char *path, const struct stat *st) {
+    char *content = read_library_file(lib_name);
+    if (!content) return 0;
+    size_t length = strlen(content);
+    GString *pool = g_string_new("");
+    CacheEntry *entries;
+    int count = scan_library(content, pool, &entries);
+    if (pool->len == 0) g_string_append_c(pool, '\0');
+    if ((uint64_t)st->st_size == length) cache_store(lib_name, path, st, content, length, entries, count, pool);
+    free(content);
+    lib->entries = entries;
+    lib->count = (uint32_t)count;
+    lib->strings = g_string_free(pool, FALSE);
+    return 1;
+}
+
+// ------------------------ Index ------------------------
+static void index_name(GHashTable *index, char *name, Library *lib, uint32_t entry) {
+    if (g_hash_table_contains(index, name)) { g_free(name); return; } // first import wins
+    LibraryFunction *lf = malloc(sizeof(LibraryFunction));
+    lf->lib = lib;
+    lf->entry = entry;
+    g_hash_table_insert(index, name, lf);
+}
+
+static void library_free(gpointer data) {
+    Library *lib = data;
+    if (lib->map) {
+        munmap(lib->map, lib->map_length);
+    } else {
+        free((CacheEntry*)lib->entries);
+        g_free((char*)lib->strings);
+    }
+    free(lib->defined); // the functions themselves belong to the VM's function list
+    g_free(lib->path);
+    free(lib);
+}
+
+void load_library(const char *lib_name, int qualified_only) {
+    CcrpVM *vm = ccrp_vm;
+    if (!vm->libraries) {
+        vm->libraries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, library_free);
+        vm->library_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+    }
+    Library *lib = g_hash_table_lookup(vm->libraries, lib_name);
+    if (!lib) {
+        char path[256];
+        snprintf(path, sizeof(path), "src/%s.crh", lib_name);
+        struct stat st;
+        if (stat(path, &st) != 0) return;
+        lib = calloc(1, sizeof(Library));
+        if (!cache_load(lib, lib_name, path, &st) && !scan_and_store(lib, lib_name, path, &st)) {
+            free(lib);
+            return;
+        }
+        lib->defined = calloc((size_t)lib->count + 1, sizeof(Function*));
+        lib->path = g_strdup(path);
+        g_hash_table_insert(vm->libraries, g_strdup(lib_name), lib);
+        for (uint32_t i = 0; i < lib->count; i++)
+            index_name(vm->library_index, g_strdup_printf("%s.%s", lib_name, lib->strings + lib->entries[i].name), lib, i);
+    }
+    if (!qualified_only && !lib->bare_names) {
+        lib->bare_names = 1;
+        for (uint32_t i = 0; i < lib->count; i++)
+            index_name(vm->library_index, g_strdup(lib->strings + lib->entries[i].name), lib, i);
+    }
+}
+
+// Library function indexed under name, created on first use
+Function* ccrp_library_lookup(const char *name) {
+    GHashTable *index = ccrp_vm->library_index;
+    LibraryFunction *lf = index ? g_hash_table_lookup(index, name) : NULL;
+    if (!lf) return NULL;
+    Library *lib = lf->lib;
+    if (!lib->defined[lf->entry]) {
+        const CacheEntry *e = &lib->entries[lf->entry];
+        lib->defined[lf->entry] = ccrp_function_new(lib->strings + e->name, lib->strings + e->params,
+                                                    lib->strings + e->body, e->start_line, e->end_line);
+        lib->defined[lf->entry]->source = lib->path;
+    }
+    return lib->defined[lf->entry];
+}
+
+// Import into the current VM what from has imported, in the same order
+void ccrp_libraries_copy(const CcrpVM *from) {
+    for (int i = 0; i < from->lib_count; i++) {
+        const char *name = from->active_libs[i];
+        const Library *lib = from->libraries ? g_hash_table_lookup(from->libraries, name) : NULL;
+        import_lib(name);
+        load_library(name, lib && !lib->bare_names);
+    }
+}
+
+void ccrp_libraries_free(CcrpVM *vm) {
+    if (vm->library_index) g_hash_table_destroy(vm->library_index);
+    if (vm->libraries) g_hash_table_destroy(vm->libraries);
+    vm->library_index = NULL;
+    vm->libraries = NULL;
+}
@@ -0,0 +1,259 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+
+/*
+ * CCRP maps
+ *
+ * Entries are appended to a dense array in insertion order, which is also the
+ * iteration order. Lookups go through a separate open-addressing index of
+ * 8-byte (entry, hash) slots using Robin Hood probing: an insert takes the
+ * slot of any resident that is closer to its home slot, so probe lengths stay
+ * short and a miss stops as soon as it meets a resident closer to home than
+ * the probe. Deletion shifts the following run back by one slot instead of
+ * leaving tombstones in the index; the deleted entry is only flagged and is
+ * squeezed out when the entry array is next compacted.
+ *
+ * The index is kept at most 7/8 full. Keys are ints or strings; a double key
+ * with an integral value is the same key as that int.
+ */
+
+#define MIN_SLOTS 8
+#define MAX_FORMAT_DEPTH 16
+
+// ------------------------ Keys ------------------------
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint32_t hash_key(Value key) {
+    if (key.type == VAL_INT) return (uint32_t)(mix64((uint64_t)key.as.i) >> 32);
+    const char *p = key.as.s->data;
+    size_t n = key.as.s->length;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    return (uint32_t)(mix64(h ^ tail) >> 32);
+}
+
+static int key_equal(Value a, Value b) {
+    if (a.type != b.type) return 0;
+    if (a.type == VAL_INT) return a.as.i == b.as.i;
+    return a.as.s == b.as.s ||
+           (a.as.s->length == b.as.s->length && memcmp(a.as.s->data, b.as.s->data, a.as.s->length) == 0);
+}
+
+// Canonical form of key in place; 0 (after reporting it) if it cannot be a key
+static int normalize_key(Value *key) {
+    if (key->type == VAL_DOUBLE && key->as.d == floor(key->as.d) && fabs(key->as.d) < 9.2e18) {
+        *key = value_int((int64_t)key->as.d);
+    }
+    if (key->type == VAL_INT || key->type == VAL_STR) return 1;
+    ccrp_out_printf("Error: map keys must be integers or strings.\n");
+    return 0;
+}
+
+// ------------------------ Index ------------------------
+// How far slot is from the home slot of hash
+static inline size_t distance(const CcrpMap *m, size_t slot, uint32_t hash) {
+    return (slot - (hash & m->mask)) & m->mask;
+}
+
+static size_t find_slot(const CcrpMap *m, Value key, uint32_t hash) {
+    size_t i = hash & m->mask;
+    for (size_t d = 0;; d++, i = (i + 1) & m->mask) {
+        CcrpMapSlot s = m->slots[i];
+        if (s.entry == CCRP_MAP_EMPTY || distance(m, i, s.hash) < d) return SIZE_MAX;
+        if (s.hash == hash && key_equal(m->entries[s.entry].key, key)) return i;
+    }
+}
+
+static void place(CcrpMap *m, uint32_t entry, uint32_t hash) {
+    CcrpMapSlot cur = { entry, hash };
+    size_t i = hash & m->mask;
+    for (size_t d = 0;; d++, i = (i + 1) & m->mask) {
+        CcrpMapSlot *s = &m->slots[i];
+        if (s->entry == CCRP_MAP_EMPTY) { *s = cur; return; }
+        size_t resident = distance(m, i, s->hash);
+        if (resident < d) {
+            CcrpMapSlot t = *s;
+            *s = cur;
+            cur = t;
+            d = resident;
+        }
+    }
+}
+
+// Drop deleted entries and rebuild the index with slot_count slots
+static void rebuild(CcrpMap *m, size_t slot_count) {
+    if (m->used != m->count) {
+        size_t n = 0;
+        for (size_t k = 0; k < m->used; k++) {
+            if (!m->entries[k].deleted) m->entries[n++] = m->entries[k];
+        }
+        m->used = n;
+    }
+    if (slot_count != m->mask + 1) {
+        free(m->slots);
+        m->slots = malloc(slot_count * sizeof(CcrpMapSlot));
+        m->mask = slot_count - 1;
+    }
+    memset(m->slots, 0xff, slot_count * sizeof(CcrpMapSlot));
+    for (size_t k = 0; k < m->used; k++) place(m, (uint32_t)k, m->entries[k].hash);
+}
+
+// ------------------------ Maps ------------------------
+CcrpMap* ccrp_map_new(size_t capacity) {
+    size_t slots = MIN_SLOTS;
+    while (slots * 7 < capacity * 8) slots *= 2;
+    CcrpMap *m = malloc(sizeof(CcrpMap));
+    m->refcount = 1;
+    m->count = 0;
+    m->used = 0;
+    m->capacity = capacity > MIN_SLOTS ? capacity : MIN_SLOTS;
+    m->entries = malloc(m->capacity * sizeof(CcrpMapEntry));
+    m->slots = malloc(slots * sizeof(CcrpMapSlot));
+    m->mask = slots - 1;
+    memset(m->slots, 0xff, slots * sizeof(CcrpMapSlot));
+    return m;
+}
+
+void ccrp_map_free(CcrpMap *m) {
+    for (size_t k = 0; k < m->used; k++) {
+        if (m->entries[k].deleted) continue;
+        value_release(m->entries[k].key);
+        value_release(m->entries[k].value);
+    }
+    free(m->entries);
+    free(m->slots);
+    free(m);
+}
+
+Value value_map(CcrpMap *m) {
+    Value v;
+    v.type = VAL_MAP;
+    v.as.m = m;
+    return v;
+}
+
+// Value stored under key, or NULL; borrows key
+const Value* ccrp_map_find(const CcrpMap *m, Value key) {
+    if (!normalize_key(&key)) return NULL;
+    size_t i = find_slot(m, key, hash_key(key));
+    return i == SIZE_MAX ? NULL : &m->entries[m->slots[i].entry].value;
+}
+
+// m[key] = v; borrows key and v
+void ccrp_map_set(CcrpMap *m, Value key, Value v) {
+    if (!normalize_key(&key)) return;
+    uint32_t hash = hash_key(key);
+    size_t i = find_slot(m, key, hash);
+    if (i != SIZE_MAX) {
+        value_assign(&m->entries[m->slots[i].entry].value, value_retain(v));
+        return;
+    }
+    // Grow the entries unless at least half of them are deleted, in which
+    // case compacting makes the room
+    if (m->used == m->capacity && m->count * 2 > m->used) {
+        m->capacity *= 2;
+        m->entries = realloc(m->entries, m->capacity * sizeof(CcrpMapEntry));
+    }
+    size_t slots = m->mask + 1;
+    if ((m->count + 1) * 8 > slots * 7) slots *= 2;
+    if (m->used == m->capacity || slots != m->mask + 1) rebuild(m, slots);
+
+    CcrpMapEntry *e = &m->entries[m->used];
+    e->key = value_retain(key);
+    e->value = value_retain(v);
+    e->hash = hash;
+    e->deleted = 0;
+    place(m, (uint32_t)m->used, hash);
+    m->used++;
+    m->count++;
+}
+
+// Remove key; 1 if it was present
+int ccrp_map_delete(CcrpMap *m, Value key) {
+    if (!normalize_key(&key)) return 0;
+    size_t i = find_slot(m, key, hash_key(key));
+    if (i == SIZE_MAX) return 0;
+    CcrpMapEntry *e = &m->entries[m->slots[i].entry];
+    value_release(e->key);
+    value_release(e->value);
+    e->deleted = 1;
+    m->count--;
+    if (m->slots[i].entry == m->used - 1 || m->count == 0) {
+        // the last entry (or every entry) is gone: no hole is left behind
+        while (m->used > 0 && m->entries[m->used - 1].deleted) m->used--;
+    }
+    // Backward shift: pull the rest of the probe run one slot closer to home
+    for (;;) {
+        size_t next = (i + 1) & m->mask;
+        CcrpMapSlot s = m->slots[next];
+        if (s.entry == CCRP_MAP_EMPTY || distance(m, next, s.hash) == 0) break;
+        m->slots[i] = s;
+        i = next;
+    }
+    m->slots[i].entry = CCRP_MAP_EMPTY;
+    return 1;
+}
+
+// Entry at position in insertion order (negative counts from the end), or NULL
+const CcrpMapEntry* ccrp_map_entry(CcrpMap *m, int64_t position) {
+    if (position < 0) position += (int64_t)m->count;
+    if (position < 0 || (uint64_t)position >= m->count) return NULL;
+    if (m->used != m->count) rebuild(m, m->mask + 1);
+    return &m->entries[position];
+}
+
+// ------------------------ Formatting ------------------------
+static void format_value(Value v, GString *out, int depth);
+
+static void format_map(const CcrpMap *m, GString *out, int depth) {
+    if (depth > MAX_FORMAT_DEPTH) { g_string_append(out, "{...}"); return; }
+    g_string_append_c(out, '{');
+    int first = 1;
+    for (size_t k = 0; k < m->used; k++) {
+        const CcrpMapEntry *e = &m->entries[k];
+        if (e->deleted) continue;
+        if (!first) g_string_append(out, ", ");
+        first = 0;
+        format_value(e->key, out, depth);
+        g_string_append(out, ": ");
+        format_value(e->value, out, depth);
+    }
+    g_string_append_c(out, '}');
+}
+
+// Strings are quoted inside maps so keys like "1" and 1 can be told apart
+static void format_value(Value v, GString *out, int depth) {
+    switch (v.type) {
+        case VAL_INT: g_string_append_printf(out, "%" PRId64, v.as.i); break;
+        case VAL_DOUBLE: g_string_append_printf(out, "%g", v.as.d); break;
+        case VAL_STR:
+            g_string_append_c(out, '"');
+            g_string_append_len(out, v.as.s->data, (gssize)v.as.s->length);
+            g_string_append_c(out, '"');
+            break;
+        case VAL_ARRAY: ccrp_array_format(v.as.a, out); break;
+        case VAL_MAP: format_map(v.as.m, out, depth + 1); break;
+    }
+}
+
+void ccrp_map_format(const CcrpMap *m, GString *out) {
+    format_map(m, out, 0);
+}
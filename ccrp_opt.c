@@ -0,0 +1,315 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/*
+ * CCRP optimizer
+ *
+ * Runs between parsing and execution. Expression trees are constant-folded
+ * bottom-up: operators whose operands are literals, short-circuit operators
+ * whose left side decides the result, and calls to pure builtins with literal
+ * arguments. Folding reuses the evaluator, so a folded expression
+ * yields exactly what it would have at runtime.
+ *
+ * Compiled programs then lose their dead branches: a conditional jump on a
+ * constant becomes unconditional or disappears, unreachable instructions are
+ * dropped and jumps to the next instruction are removed.
+ */
+
+// ------------------------ Constant folding ------------------------
+int ccrp_expr_is_const(const Expr *e) {
+    return e && (e->kind == EXPR_NUM || e->kind == EXPR_STR);
+}
+
+// Turn e into a literal holding v (consumed), freeing its operands
+static void make_const(Expr *e, Value v) {
+    ccrp_expr_free(e->left);
+    ccrp_expr_free(e->right);
+    for (int i = 0; i < e->arg_count; i++) ccrp_expr_free(e->args[i]);
+    free(e->args);
+    g_free(e->name);
+    value_release(e->value);
+    e->kind = v.type == VAL_STR ? EXPR_STR : EXPR_NUM;
+    e->value = v;
+    e->name = NULL;
+    e->left = e->right = NULL;
+    e->args = NULL;
+    e->arg_count = 0;
+    e->fn = NULL;
+    e->builtin = NULL;
+    e->slot = -1;
+    e->local = 0;
+}
+
+// A call is pure when it reaches a builtin flagged pure: no user function
+// shadows the name and the builtin's library is imported
+static int is_pure_call(const Expr *e) {
+    const Builtin *b = ccrp_builtin_find(e->name, e->arg_count);
+    if (!b || !(b->flags & BUILTIN_PURE)) return 0;
+    if (ccrp_call_target(e->name, e->arg_count) || (b->library && !lib_enabled(b->library))) return 0;
+    for (int i = 0; i < e->arg_count; i++)
+        if (!ccrp_expr_is_const(e->args[i])) return 0;
+    return 1;
+}
+
+void ccrp_expr_fold(Expr *e) {
+    if (!e) return;
+    ccrp_expr_fold(e->left);
+    ccrp_expr_fold(e->right);
+    for (int i = 0; i < e->arg_count; i++) ccrp_expr_fold(e->args[i]);
+
+    switch (e->kind) {
+        case EXPR_NEG:
+        case EXPR_NOT:
+            if (ccrp_expr_is_const(e->left)) make_const(e, ccrp_expr_eval(e));
+            break;
+        case EXPR_BINARY:
+            if (ccrp_expr_is_const(e->left) && ccrp_expr_is_const(e->right)) {
+                make_const(e, ccrp_expr_eval(e));
+            } else if ((e->op == BIN_AND || e->op == BIN_OR) && ccrp_expr_is_const(e->left)) {
+                int t = value_truthy(e->left->value);
+                if (e->op == BIN_AND ? !t : t) make_const(e, value_int(t));
+            }
+            break;
+        case EXPR_CALL:
+            if (is_pure_call(e)) make_const(e, ccrp_expr_eval(e));
+            break;
+        default:
+            break;
+    }
+}
+
+// ------------------------ Dead branches ------------------------
+static int has_target(OpCode op) {
+    switch (op) {
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_FALSE_INT:
+        case OP_CMP_JUMP_INT: case OP_FOR_INIT: case OP_FOR_NEXT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void ccrp_optimize(Program *prog) {
+    int n = prog->count;
+    Instr *code = prog->code;
+    if (n <= 0) return;
+
+    // Constant conditions: always true falls through, always false always jumps
+    for (int i = 0; i < n; i++) {
+        Instr *in = &code[i];
+        if (in->op != OP_JUMP_IF_FALSE || !ccrp_expr_is_const(in->expr)) continue;
+        if (value_truthy(in->expr->value)) in->target = i + 1;
+        in->op = OP_JUMP;
+        ccrp_expr_free(in->expr);
+        in->expr = NULL;
+    }
+
+    // Reachability from the entry point
+    char *keep = calloc((size_t)n + 1, 1);
+    int *work = malloc(((size_t)n + 1) * 2 * sizeof(int));
+    int top = 0;
+    work[top++] = 0;
+    while (top > 0) {
+        int i = work[--top];
+        if (i < 0 || i >= n || keep[i]) continue;
+        keep[i] = 1;
+        switch (code[i].op) {
+            case OP_JUMP: work[top++] = code[i].target; break;
+            case OP_RETURN: case OP_HALT: break;
+            default:
+                if (has_target(code[i].op)) work[top++] = code[i].target;
+                work[top++] = i + 1;
+                break;
+        }
+    }
+    keep[n - 1] = 1; // the final HALT anchors jumps past the end
+
+    // next_kept[i]: first surviving instruction at or after i. Walking
+    // backwards also drops forward jumps that land where they would fall through.
+    int *next_kept = malloc(((size_t)n + 1) * sizeof(int));
+    next_kept[n] = n;
+    for (int i = n - 1; i >= 0; i--) {
+        if (keep[i] && code[i].op == OP_JUMP && code[i].target > i &&
+            next_kept[i + 1] == next_kept[code[i].target]) keep[i] = 0;
+        next_kept[i] = keep[i] ? i : next_kept[i + 1];
+    }
+
+    int *new_index = malloc(((size_t)n + 1) * sizeof(int));
+    int count = 0;
+    for (int i = 0; i <= n; i++) {
+        new_index[i] = count;
+        if (i < n && keep[i]) count++;
+    }
+    count = 0;
+    for (int i = 0; i < n; i++) {
+        if (!keep[i]) { ccrp_instr_free(&code[i]); continue; }
+        Instr in = code[i];
+        if (has_target(in.op)) in.target = new_index[next_kept[in.target]];
+        code[count++] = in;
+    }
+    prog->count = count;
+
+    free(keep);
+    free(work);
+    free(next_kept);
+    free(new_index);
+}
+
+// ------------------------ Dump ------------------------
+static const char *binop_text[] = {
+    [BIN_ADD] = "+", [BIN_SUB] = "-", [BIN_MUL] = "*", [BIN_DIV] = "/", [BIN_MOD] = "%",
+    [BIN_EQ] = "==", [BIN_NE] = "!=", [BIN_LT] = "<", [BIN_LE] = "<=", [BIN_GT] = ">", [BIN_GE] = ">=",
+    [BIN_AND] = "and", [BIN_OR] = "or", [BIN_CONCAT] = "..",
+};
+
+static void format_expr(const Expr *e, FILE *out) {
+    if (!e) { fputs("<invalid>", out); return; }
+    switch (e->kind) {
+        case EXPR_NUM:
+            if (e->value.type == VAL_DOUBLE) fprintf(out, "%g", e->value.as.d);
+            else fprintf(out, "%" PRId64, e->value.as.i);
+            break;
+        case EXPR_STR: fprintf(out, "\"%s\"", e->value.as.s->data); break;
+        case EXPR_VAR: fputs(e->name, out); break;
+        case EXPR_NEG: fputc('-', out); format_expr(e->left, out); break;
+        case EXPR_NOT: fputs("not ", out); format_expr(e->left, out); break;
+        case EXPR_BINARY:
+            fputc('(', out);
+            format_expr(e->left, out);
+            fprintf(out, " %s ", binop_text[e->op]);
+            format_expr(e->right, out);
+            fputc(')', out);
+            break;
+        case EXPR_CALL:
+            fprintf(out, "%s(", e->name);
+            for (int i = 0; i < e->arg_count; i++) {
+                if (i) fputs(", ", out);
+                format_expr(e->args[i], out);
+            }
+            fputc(')', out);
+            break;
+        case EXPR_ARRAY:
+            fputc('[', out);
+            for (int i = 0; i < e->arg_count; i++) {
+                if (i) fputs(", ", out);
+                format_expr(e->args[i], out);
+            }
+            fputc(']', out);
+            break;
+        case EXPR_MAP:
+            fputc('{', out);
+            for (int i = 0; i + 1 < e->arg_count; i += 2) {
+                if (i) fputs(", ", out);
+                format_expr(e->args[i], out);
+                fputs(": ", out);
+                format_expr(e->args[i + 1], out);
+            }
+            fputc('}', out);
+            break;
+        case EXPR_INDEX:
+        case EXPR_SLICE:
+            format_expr(e->left, out);
+            fputc('[', out);
+            if (e->kind == EXPR_INDEX) format_expr(e->right, out);
+            else {
+                if (e->args[0]) format_expr(e->args[0], out);
+                fputc(':', out);
+                if (e->args[1]) format_expr(e->args[1], out);
+            }
+            fputc(']', out);
+            break;
+    }
+}
+
+void ccrp_program_dump(const Program *prog, const char *title, FILE *out) {
+    fprintf(out, "== %s ==\n", title);
+    for (int i = 0; i < prog->count; i++) {
+        const Instr *in = &prog->code[i];
+        fprintf(out, "%4d  L%-4d ", i, in->line + 1);
+        switch (in->op) {
+            case OP_LINE: fprintf(out, "line     %s", in->a); break;
+            case OP_PRINT:
+                fputs(in->imm ? "print.n  " : "print    ", out);
+                for (int k = 0; k < in->item_count; k++) {
+                    if (k) fputs(", ", out);
+                    if (in->items[k].is_literal) fprintf(out, "\"%s\"", in->items[k].text);
+                    else format_expr(in->items[k].expr, out);
+                }
+                break;
+            case OP_ASSIGN:
+            case OP_ASSIGN_INT:
+                fprintf(out, "%s %s%s = ", in->op == OP_ASSIGN_INT ? "assign.i" : "assign  ",
+                        in->local ? "local " : "", in->a);
+                format_expr(in->expr, out);
+                break;
+            case OP_JUMP: fprintf(out, "jump     -> %d", in->target); break;
+            case OP_CMP_JUMP_INT:
+                fputs("cmpjmp.i ", out);
+                format_expr(in->expr, out);
+                fprintf(out, " -> %d", in->target);
+                break;
+            case OP_ADD_INT:
+                fprintf(out, "add.i    %s%s += %" PRId64, in->local ? "local " : "", in->a, in->imm);
+                break;
+            case OP_FOR_INIT:
+                fprintf(out, "for      %s%s = ", in->local ? "local " : "", in->a);
+                if (in->imm) fputs("pop .. pop", out);
+                else {
+                    format_expr(in->expr, out);
+                    fputs(" .. ", out);
+                    format_expr(in->limit, out);
+                }
+                fprintf(out, " -> %d", in->target);
+                break;
+            case OP_FOR_NEXT: fprintf(out, "endfor   -> %d", in->target); break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_FALSE_INT:
+                fputs(in->op == OP_JUMP_IF_FALSE_INT ? "jfalse.i " : "jfalse   ", out);
+                format_expr(in->expr, out);
+                fprintf(out, " -> %d", in->target);
+                break;
+            case OP_RETURN:
+                fputs("return   ", out);
+                if (in->expr) format_expr(in->expr, out);
+                break;
+            case OP_HALT: fputs("halt", out); break;
+            case OP_PUSH: fputs("push     ", out); format_expr(in->expr, out); break;
+            case OP_CALL: fprintf(out, "call     %s/%" PRId64, in->a, in->imm); break;
+            case OP_TAILCALL: fprintf(out, "tailcall %s/%" PRId64, in->a, in->imm); break;
+            case OP_BUILTIN: fprintf(out, "builtin  %s/%" PRId64, in->a, in->imm); break;
+            case OP_UNARY: fputs(in->imm == EXPR_NOT ? "not" : "neg", out); break;
+            case OP_BINARY: fprintf(out, "binary   %s", binop_text[in->imm]); break;
+            case OP_AND_JUMP: fprintf(out, "and      -> %d", in->target); break;
+            case OP_OR_JUMP: fprintf(out, "or       -> %d", in->target); break;
+            case OP_TRUTHY: fputs("truthy", out); break;
+            case OP_STORE: fprintf(out, "store    %s%s", in->local ? "local " : "", in->a); break;
+            case OP_JUMP_IF_FALSE_POP: fprintf(out, "jfalse   pop -> %d", in->target); break;
+            case OP_PRINT_POP: fputs("print    pop", out); break;
+            case OP_RETURN_POP: fputs("return   pop", out); break;
+            case OP_STORE_INDEX_POP: fprintf(out, "store[]  %s%s[pop] = pop", in->local ? "local " : "", in->a); break;
+            case OP_EVAL:
+                fputs("eval     ", out);
+                if (in->expr) format_expr(in->expr, out);
+                else fputs("pop", out);
+                break;
+            case OP_SPAWN:
+            case OP_AWAIT:
+                fputs(in->op == OP_SPAWN ? "spawn    " : "await    ", out);
+                if (in->imm) fprintf(out, "%s%s = ", in->local ? "local " : "", in->a);
+                format_expr(in->expr, out);
+                break;
+            case OP_SLEEP: fputs("sleep    ", out); format_expr(in->expr, out); break;
+            case OP_STORE_INDEX:
+                fprintf(out, "store[]  %s%s[", in->local ? "local " : "", in->a);
+                format_expr(in->limit, out);
+                fputs("] = ", out);
+                format_expr(in->expr, out);
+                break;
+            default: fprintf(out, "op %d", in->op); break;
+        }
+        fputc('\n', out);
+    }
+}
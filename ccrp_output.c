@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * CCRP output
+ *
+ * Everything a script prints (print, prompts, runtime errors) goes through one
+ * buffer that is handed to write(2) in large blocks. On a terminal the buffer
+ * is also flushed at every newline so output appears line by line; on pipes
+ * and files it is only flushed when full, by the `flush` statement, before
+ * reading input and when the run ends. Writes larger than the buffer skip it.
+ *
+ * Each VM has its own buffer and file descriptor, so concurrent scripts never
+ * share a buffer; ones writing to the same fd interleave in whole blocks. An
+ * embedder can take the blocks through a callback instead (ccrp_output_sink).
+ */
+
+static void write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return; // closed pipe or full disk: drop the output like stdio would
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+}
+
+// Hand a block of output to the sink or the file descriptor
+static void deliver(CcrpVM *vm, const char *data, size_t length) {
+    if (vm->out_sink) vm->out_sink(data, length, vm->out_sink_data);
+    else write_all(vm->out_fd, data, length);
+}
+
+void ccrp_output_init(CcrpVM *vm, int fd, size_t buffer_size) {
+    ccrp_output_free(vm);
+    vm->out_size = buffer_size ? buffer_size : CCRP_OUTPUT_BUFFER;
+    vm->out_buf = malloc(vm->out_size);
+    vm->out_fd = fd;
+    vm->out_line_flush = isatty(fd);
+}
+
+int ccrp_output_open(CcrpVM *vm, const char *path, size_t buffer_size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+    ccrp_output_init(vm, fd, buffer_size ? buffer_size : CCRP_OUTPUT_FILE_BUFFER);
+    vm->out_owns_fd = 1;
+    return 1;
+}
+
+// Send output to sink (an IDE pane, a log) instead of a file descriptor.
+// Complete lines are delivered as soon as they are printed.
+void ccrp_output_sink(CcrpVM *vm, CcrpOutputSink sink, void *user_data, size_t buffer_size) {
+    ccrp_output_init(vm, -1, buffer_size);
+    vm->out_sink = sink;
+    vm->out_sink_data = user_data;
+    vm->out_line_flush = 1;
+}
+
+// Flush and drop vm's buffer, closing a file opened by ccrp_output_open
+void ccrp_output_free(CcrpVM *vm) {
+    if (vm->out_len) {
+        fflush(stdout);
+        deliver(vm, vm->out_buf, vm->out_len);
+        vm->out_len = 0;
+    }
+    free(vm->out_buf);
+    vm->out_buf = NULL;
+    vm->out_size = 0;
+    if (vm->out_owns_fd) close(vm->out_fd);
+    vm->out_owns_fd = 0;
+    vm->out_fd = 1;
+    vm->out_sink = NULL;
+    vm->out_sink_data = NULL;
+}
+
+void ccrp_out_flush(void) {
+    CcrpVM *vm = ccrp_vm;
+    if (!vm || vm->out_len == 0) return;
+    fflush(stdout); // keep anything printed through stdio (dumps, usage) in order
+    deliver(vm, vm->out_buf, vm->out_len);
+    vm->out_len = 0;
+}
+
+// Outside a VM (no script running on this thread) output goes straight to stdout
+void ccrp_out_write(const char *data, size_t length) {
+    CcrpVM *vm = ccrp_vm;
+    if (!vm) { write_all(1, data, length); return; }
+    if (!vm->out_buf) ccrp_output_init(vm, vm->out_fd, 0);
+    if (length > vm->out_size - vm->out_len) {
+        ccrp_out_flush();
+        if (length >= vm->out_size) { deliver(vm, data, length); return; }
+    }
+    memcpy(vm->out_buf + vm->out_len, data, length);
+    vm->out_len += length;
+    if (vm->out_line_flush && memchr(data, '\n', length)) ccrp_out_flush();
+}
+
+void ccrp_out_str(const char *text) {
+    ccrp_out_write(text, strlen(text));
+}
+
+void ccrp_out_char(char c) {
+    CcrpVM *vm = ccrp_vm;
+    if (vm && vm->out_buf && vm->out_len < vm->out_size && !(vm->out_line_flush && c == '\n')) vm->out_buf[vm->out_len++] = c;
+    else ccrp_out_write(&c, 1);
+}
+
+void ccrp_out_printf(const char *fmt, ...) {
+    char small[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(small)) { ccrp_out_write(small, (size_t)n); return; }
+    char *text = malloc((size_t)n + 1);
+    va_start(args, fmt);
+    vsnprintf(text, (size_t)n + 1, fmt, args);
+    va_end(args);
+    ccrp_out_write(text, (size_t)n);
+    free(text);
+}
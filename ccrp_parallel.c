@@ -0,0 +1,409 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * CCRP parallel loops
+ *
+ *   parallel for i in 0..n reduce sum into total, max into best
+ *       ...
+ *   endfor
+ *
+ * The iterations are split between workers, one per processor (CCRP_THREADS
+ * overrides the count). Each worker is a VM of its own: it gets copies of the
+ * globals, of the locals of the function the loop is in, of the script's
+ * functions and of the imports, compiles the body and runs its iterations
+ * there. Assignments in the body therefore only change the worker's copies and
+ * are dropped when the loop ends, and workers never share a value.
+ *
+ * Only reduction variables come back. In each worker a sum starts at 0 and a
+ * product at 1; min and max start at the variable's value. After the loop the
+ * partial results are folded into the variable with + , *, min or max.
+ *
+ * Scheduling is work stealing over index ranges: every worker starts with an
+ * equal share and takes chunks from the front of it; a worker that runs out
+ * takes the upper half of another worker's remaining range. The calling thread
+ * is worker 0, the others run on a GThreadPool shared by all VMs. A parallel
+ * for inside the body of another runs on the worker's own thread.
+ */
+
+#define CHUNKS_PER_WORKER 16    // grain: a worker's share is taken in about this many steps
+#define MAX_GRAIN 4096
+
+typedef struct {
+    GMutex lock;
+    int64_t next;       // iterations not taken yet: next..end-1
+    int64_t end;
+} Range;
+
+typedef struct ParallelJob ParallelJob;
+
+typedef struct {
+    ParallelJob *job;
+    int index;
+    Range range;
+    Value partial[MAX_REDUCTIONS]; // the worker's reduction results, owned by the calling VM
+} Worker;
+
+struct ParallelJob {
+    CcrpVM *parent;
+    const ParallelHeader *header;
+    const Function *scope;      // function the loop is in, NULL at the top level
+    Value *locals;              // its locals
+    char **body;
+    int body_count;
+    int64_t grain;
+    Worker *workers;
+    int worker_count;
+    GMutex lock;
+    GCond done;
+    int running;                // pool workers not finished yet
+};
+
+static const char *reduce_names[] = { "sum", "product", "min", "max" };
+static const int reduce_ops[] = { BIN_ADD, BIN_MUL, BIN_LT, BIN_GT };
+
+// ------------------------ Parsing ------------------------
+// Start of the word `reduce` outside quotes and parentheses, NULL if absent
+static const char* find_reduce(const char *s) {
+    int depth = 0, in_str = 0;
+    for (const char *p = s; *p; p++) {
+        if (*p == '"') in_str = !in_str;
+        else if (!in_str && *p == '(') depth++;
+        else if (!in_str && *p == ')') depth--;
+        else if (!in_str && depth == 0 && p > s && (p[-1] == ' ' || p[-1] == '\t') &&
+                 strncmp(p, "reduce", 6) == 0 && (p[6] == ' ' || p[6] == '\t')) return p;
+    }
+    return NULL;
+}
+
+// `OP into NAME`, one clause of the reduce list
+static int parse_reduction(const char *clause, ParallelHeader *h) {
+    char op[16], into[8], name[50];
+    int used = 0;
+    if (sscanf(clause, " %15s %7s %49[A-Za-z0-9_] %n", op, into, name, &used) != 3 || clause[used]) return 0;
+    if (strcmp(into, "into") != 0 || h->reduction_count >= MAX_REDUCTIONS) return 0;
+    for (size_t k = 0; k < sizeof(reduce_names) / sizeof(reduce_names[0]); k++) {
+        if (strcmp(op, reduce_names[k]) == 0) {
+            h->reduce_op[h->reduction_count] = reduce_ops[k];
+            h->reduce_into[h->reduction_count++] = g_strdup(name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Fills h from a `parallel for` line (free with ccrp_parallel_header_free), 0 if malformed
+int ccrp_parallel_parse(const char *line, ParallelHeader *h) {
+    memset(h, 0, sizeof(*h));
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (strncmp(p, "parallel", 8) != 0 || (p[8] != ' ' && p[8] != '\t')) return 0;
+    char *text = g_strstrip(g_strdup(p + 8));
+    size_t n = strlen(text);
+    if (n > 0 && text[n - 1] == '{') text[n - 1] = '\0'; // `{ ... }` around the body is optional
+    const char *reduce = find_reduce(text);
+    int ok = 1;
+    if (reduce) {
+        char **clauses = g_strsplit(reduce + 6, ",", -1);
+        for (int i = 0; clauses[i] && ok; i++) ok = parse_reduction(clauses[i], h);
+        g_strfreev(clauses);
+        text[reduce - text] = '\0';
+    }
+    ok = ok && parse_for_header(text, &h->var, &h->start, &h->end);
+    g_free(text);
+    if (!ok) ccrp_parallel_header_free(h);
+    return ok;
+}
+
+void ccrp_parallel_header_free(ParallelHeader *h) {
+    g_free(h->var);
+    g_free(h->start);
+    g_free(h->end);
+    for (int i = 0; i < h->reduction_count; i++) g_free(h->reduce_into[i]);
+    memset(h, 0, sizeof(*h));
+}
+
+// Line of the endfor closing the parallel for on header_line, -1 if none
+int ccrp_parallel_end(char **lines, int line_count, int header_line) {
+    int depth = 1;
+    for (int i = header_line + 1; i < line_count; i++) {
+        const char *p = lines[i];
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '}') p++; // `} endfor`
+        char word[16];
+        if (sscanf(p, " %15s", word) != 1) continue;
+        if (strcmp(word, "for") == 0 || strcmp(word, "parallel") == 0) depth++;
+        else if (strcmp(word, "endfor") == 0 && --depth == 0) return i;
+    }
+    return -1;
+}
+
+// ------------------------ Worker state ------------------------
+// Copy of v owned by the current VM. v is only read, never retained, so it
+// may belong to another VM as long as that one is not running.
+static Value clone_value(Value v) {
+    switch (v.type) {
+        case VAL_STR: return value_string_len(v.as.s->data, v.as.s->length);
+        case VAL_ARRAY: {
+            const CcrpArray *a = v.as.a;
+            CcrpArray *copy = ccrp_array_new(a->is_double, a->length);
+            if (a->length) memcpy(copy->data.i, a->data.i, a->length * sizeof(int64_t));
+            copy->length = a->length;
+            return value_array(copy);
+        }
+        case VAL_MAP: {
+            const CcrpMap *m = v.as.m;
+            CcrpMap *copy = ccrp_map_new(m->count);
+            for (size_t k = 0; k < m->used; k++) {
+                const CcrpMapEntry *e = &m->entries[k];
+                if (e->deleted) continue;
+                Value key = clone_value(e->key), value = clone_value(e->value);
+                ccrp_map_set(copy, key, value);
+                value_release(key);
+                value_release(value);
+            }
+            return value_map(copy);
+        }
+        default: return v;
+    }
+}
+
+static void copy_functions(const CcrpVM *from) {
+    for (int i = 0; i < from->function_count; i++) {
+        const Function *fn = from->functions[i];
+        if (fn->source) continue; // library functions come with the imports
+        GString *params = g_string_new(NULL), *body = g_string_new(NULL);
+        for (int k = 0; k < fn->param_count; k++) {
+            if (k) g_string_append(params, ", ");
+            g_string_append(params, fn->params[k]);
+        }
+        for (int k = 0; k < fn->line_count; k++) {
+            g_string_append(body, fn->lines[k]);
+            g_string_append_c(body, '\n');
+        }
+        define_function(fn->name, params->str, body->str, fn->start_line, fn->end_line);
+        g_string_free(params, TRUE);
+        g_string_free(body, TRUE);
+    }
+}
+
+// Give the current (worker) VM what the body can see: globals, then the
+// enclosing function's locals as globals of the same names, then the
+// reduction variables at their starting values
+static void copy_state(const ParallelJob *job) {
+    CcrpVM *vm = ccrp_vm;
+    const CcrpVM *parent = job->parent;
+    const ParallelHeader *h = job->header;
+    for (int i = 0; i < parent->var_count; i++) {
+        int slot = var_slot(parent->var_names[i]);
+        value_assign(&vm->vars[slot], clone_value(parent->vars[i]));
+    }
+    for (int i = 0; job->scope && i < job->scope->local_count; i++) {
+        int slot = var_slot(job->scope->local_names[i]);
+        value_assign(&vm->vars[slot], clone_value(job->locals[i]));
+    }
+    for (int r = 0; r < h->reduction_count; r++) {
+        int slot = var_slot(h->reduce_into[r]);
+        if (h->reduce_op[r] == BIN_ADD) value_assign(&vm->vars[slot], value_int(0));
+        else if (h->reduce_op[r] == BIN_MUL) value_assign(&vm->vars[slot], value_int(1));
+    }
+    copy_functions(parent);
+    ccrp_libraries_copy(parent);
+}
+
+// ------------------------ Scheduling ------------------------
+// Next chunk for worker w: the front of its own range, or else the upper half
+// of the first other range with iterations left. 0 when everything is taken.
+static int take_chunk(ParallelJob *job, int w, int64_t *lo, int64_t *hi) {
+    Range *own = &job->workers[w].range;
+    for (;;) {
+        g_mutex_lock(&own->lock);
+        if (own->next < own->end) {
+            *lo = own->next;
+            *hi = own->end - own->next > job->grain ? own->next + job->grain : own->end;
+            own->next = *hi;
+            g_mutex_unlock(&own->lock);
+            return 1;
+        }
+        g_mutex_unlock(&own->lock);
+
+        int64_t from = 0, to = 0;
+        for (int k = 1; k < job->worker_count && from == to; k++) {
+            Range *victim = &job->workers[(w + k) % job->worker_count].range;
+            g_mutex_lock(&victim->lock);
+            int64_t left = victim->end - victim->next;
+            if (left > 0) {
+                from = left > job->grain ? victim->next + left / 2 : victim->next;
+                to = victim->end;
+                victim->end = from;
+            }
+            g_mutex_unlock(&victim->lock);
+        }
+        if (from == to) return 0;
+        // Published as this worker's range so it can be stolen from in turn
+        g_mutex_lock(&own->lock);
+        own->next = from;
+        own->end = to;
+        g_mutex_unlock(&own->lock);
+    }
+}
+
+static void run_worker(Worker *w) {
+    ParallelJob *job = w->job;
+    const ParallelHeader *h = job->header;
+    CcrpVM *outer = ccrp_vm, *vm = ccrp_vm_new();
+    if (job->parent->out_sink) ccrp_output_sink(vm, job->parent->out_sink, job->parent->out_sink_data, 0);
+    else vm->out_fd = job->parent->out_fd;
+    vm->parallel_worker = 1;
+    vm->interrupt = job->parent->interrupt; // Stop reaches the workers too
+    ccrp_vm = vm;
+    copy_state(job);
+    int slot = var_slot(h->var);
+    value_assign(&vm->vars[slot], value_int(0)); // an int before the body is compiled, so it is typed as one
+    Program *prog = ccrp_compile(job->body, job->body_count);
+
+    int64_t lo, hi;
+    while (take_chunk(job, w->index, &lo, &hi)) {
+        for (int64_t i = lo; i < hi && !g_atomic_int_get(vm->interrupt); i++) {
+            value_assign(&vm->vars[slot], value_int(i));
+            value_release(ccrp_execute(prog));
+        }
+    }
+
+    for (int r = 0; r < h->reduction_count; r++) {
+        w->partial[r] = clone_value(vm->vars[var_slot(h->reduce_into[r])]);
+    }
+    ccrp_program_free(prog);
+    ccrp_vm = outer;
+    ccrp_vm_free(vm); // flushes the worker's output
+}
+
+static void pool_worker(gpointer data, gpointer user_data) {
+    (void)user_data;
+    Worker *w = data;
+    ParallelJob *job = w->job;
+    run_worker(w);
+    g_mutex_lock(&job->lock);
+    if (--job->running == 0) g_cond_signal(&job->done);
+    g_mutex_unlock(&job->lock);
+}
+
+// Threads for workers 1..n-1 of every parallel loop in the process
+static GThreadPool* worker_pool(void) {
+    static GMutex lock;
+    static GThreadPool *pool;
+    g_mutex_lock(&lock);
+    if (!pool) pool = g_thread_pool_new(pool_worker, NULL, -1, FALSE, NULL);
+    g_mutex_unlock(&lock);
+    return pool;
+}
+
+static int worker_count(int64_t iterations) {
+    if (ccrp_vm->parallel_worker) return 1;
+    const char *env = getenv("CCRP_THREADS");
+    int64_t n = env && atoi(env) > 0 ? atoi(env) : (int64_t)g_get_num_processors();
+    if (n > iterations) n = iterations;
+    return n > 0 ? (int)n : 1;
+}
+
+// ------------------------ Statement ------------------------
+// Where a reduction result goes: a local of the function the loop is in, or a global
+static Value* reduction_target(const Function *scope, const char *name) {
+    for (int i = 0; scope && i < scope->local_count; i++)
+        if (strcmp(scope->local_names[i], name) == 0) return &ccrp_vm->frame_locals[i];
+    return &ccrp_vm->vars[var_slot(name)];
+}
+
+// Evaluate a bound in the scope of the function the loop is in
+static int64_t eval_bound(const char *src, const Function *scope) {
+    Expr *e = ccrp_expr_parse(src);
+    ccrp_resolve_expr_in(e, scope);
+    Value v = ccrp_expr_eval(e);
+    int64_t n = value_to_int(v);
+    value_release(v);
+    ccrp_expr_free(e);
+    return n;
+}
+
+// `parallel for` on the current line; continues after its endfor
+void handle_parallel_for(const char *line) {
+    CcrpVM *vm = ccrp_vm;
+    int header = vm->current_line_index;
+    int end = ccrp_parallel_end(vm->current_lines, vm->current_line_count, header);
+    if (end < 0) {
+        ccrp_out_printf("Error: 'parallel for' without 'endfor'\n");
+        vm->current_line_index = vm->current_line_count;
+        return;
+    }
+    vm->current_line_index = end;
+    ParallelHeader h;
+    if (!ccrp_parallel_parse(line, &h)) {
+        ccrp_out_printf("Error: expected 'parallel for NAME in START..END [reduce sum|product|min|max into NAME, ...]'\n");
+        return;
+    }
+
+    ParallelJob job;
+    memset(&job, 0, sizeof(job));
+    job.parent = vm;
+    job.header = &h;
+    job.scope = ccrp_current_function();
+    job.locals = job.scope ? vm->frame_locals : NULL;
+    int64_t from = eval_bound(h.start, job.scope), to = eval_bound(h.end, job.scope);
+    if (from >= to) { ccrp_parallel_header_free(&h); return; }
+    int64_t n = to - from;
+    job.body = vm->current_lines + header + 1;
+    job.body_count = end - header - 1;
+    job.worker_count = worker_count(n);
+    job.grain = n / ((int64_t)job.worker_count * CHUNKS_PER_WORKER);
+    if (job.grain < 1) job.grain = 1;
+    if (job.grain > MAX_GRAIN) job.grain = MAX_GRAIN;
+    job.workers = calloc((size_t)job.worker_count, sizeof(Worker));
+    int64_t share = n / job.worker_count, extra = n % job.worker_count, next = from;
+    for (int w = 0; w < job.worker_count; w++) {
+        Worker *wk = &job.workers[w];
+        wk->job = &job;
+        wk->index = w;
+        g_mutex_init(&wk->range.lock);
+        wk->range.next = next;
+        next += share + (w < extra);
+        wk->range.end = next;
+    }
+    for (int r = 0; r < h.reduction_count; r++) reduction_target(job.scope, h.reduce_into[r]); // create globals first
+
+    ccrp_out_flush(); // what was printed before the loop comes first
+    g_mutex_init(&job.lock);
+    g_cond_init(&job.done);
+    job.running = job.worker_count - 1;
+    GThreadPool *pool = job.running ? worker_pool() : NULL;
+    for (int w = 1; w < job.worker_count; w++) g_thread_pool_push(pool, &job.workers[w], NULL);
+    run_worker(&job.workers[0]);
+    g_mutex_lock(&job.lock);
+    while (job.running > 0) g_cond_wait(&job.done, &job.lock);
+    g_mutex_unlock(&job.lock);
+
+    // Fold the partial results into the variables, in worker order
+    for (int r = 0; r < h.reduction_count; r++) {
+        int op = h.reduce_op[r];
+        Value acc = value_retain(*reduction_target(job.scope, h.reduce_into[r]));
+        for (int w = 0; w < job.worker_count; w++) {
+            Value part = job.workers[w].partial[r];
+            if (op == BIN_ADD || op == BIN_MUL) {
+                acc = ccrp_apply_binary(op, acc, part);
+            } else if (value_truthy(ccrp_apply_binary(op, value_retain(part), value_retain(acc)))) {
+                value_release(acc);
+                acc = part;
+            } else {
+                value_release(part);
+            }
+        }
+        value_assign(reduction_target(job.scope, h.reduce_into[r]), acc);
+    }
+
+    for (int w = 0; w < job.worker_count; w++) g_mutex_clear(&job.workers[w].range.lock);
+    free(job.workers);
+    g_cond_clear(&job.done);
+    g_mutex_clear(&job.lock);
+    ccrp_parallel_header_free(&h);
+}
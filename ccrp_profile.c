@@ -0,0 +1,281 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * CCRP profiler (--profile)
+ *
+ * Every body of code (the script, each function) is a unit with per-line
+ * hit counts and self wall/CPU time. The engines report the line they are
+ * about to run; when it differs from the current frame's line, the time since
+ * the previous change is charged to the previous line and the new line gets a
+ * hit. Function calls push a frame, so returning to the calling line is not a
+ * new hit. Functions also get call counts and inclusive time, counted once
+ * for the outermost of recursive activations.
+ *
+ * Self time is also charged to a node of the calling-context tree, which is
+ * written out as folded stacks (`main;f;g 1234`, microseconds) for
+ * flamegraph.pl. Stacks deeper than PROFILE_MAX_DEPTH are merged into the
+ * deepest node.
+ *
+ * One VM at a time can be profiled; its profiling flag turns the hooks on.
+ * When profiling is off nothing here runs: the VM threads its code without
+ * the hook, and the tree-walker and calls test the flag once.
+ */
+
+#define PROFILE_MAX_DEPTH 256
+
+typedef struct {
+    const Function *fn;     // NULL for the script
+    char **lines;
+    int line_count;
+    uint64_t *hits;         // per line
+    uint64_t *wall_ns;
+    uint64_t *cpu_ns;
+    uint64_t calls;
+    uint64_t total_wall_ns; // inclusive, outermost activations only
+    uint64_t total_cpu_ns;
+    int active;             // activations on the stack
+} ProfileUnit;
+
+typedef struct ProfileNode {
+    ProfileUnit *unit;
+    struct ProfileNode *parent;
+    struct ProfileNode *child;
+    struct ProfileNode *sibling;
+    uint64_t self_ns;
+    int depth;
+} ProfileNode;
+
+typedef struct {
+    ProfileUnit *unit;
+    int line;
+    ProfileNode *node;
+    uint64_t wall_start;
+    uint64_t cpu_start;
+} ProfileFrame;
+
+static GHashTable *units = NULL;    // lines -> ProfileUnit*
+static GPtrArray *unit_list = NULL; // in creation order
+static ProfileFrame *stack = NULL;
+static int depth = 0, capacity = 0;
+static ProfileNode root;
+static uint64_t start_wall, start_cpu, last_wall, last_cpu;
+static CcrpVM *profiled = NULL;
+static const char *script_name = "main";
+static char *out_prefix = NULL;
+static int finished = 0;
+
+// ------------------------ Clocks ------------------------
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Charge the time since the last charge to the current line and stack node
+static void charge(void) {
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC), cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    ProfileFrame *top = &stack[depth - 1];
+    if (top->unit && top->line >= 0 && top->line < top->unit->line_count) {
+        top->unit->wall_ns[top->line] += wall - last_wall;
+        top->unit->cpu_ns[top->line] += cpu - last_cpu;
+    }
+    top->node->self_ns += wall - last_wall;
+    last_wall = wall;
+    last_cpu = cpu;
+}
+
+// ------------------------ Units ------------------------
+static ProfileUnit* unit_for(const Function *fn, char **lines, int line_count) {
+    ProfileUnit *u = g_hash_table_lookup(units, lines);
+    if (u) return u;
+    u = calloc(1, sizeof(ProfileUnit));
+    u->fn = fn;
+    u->lines = lines;
+    u->line_count = line_count;
+    u->hits = calloc((size_t)line_count + 1, sizeof(uint64_t));
+    u->wall_ns = calloc((size_t)line_count + 1, sizeof(uint64_t));
+    u->cpu_ns = calloc((size_t)line_count + 1, sizeof(uint64_t));
+    g_hash_table_insert(units, lines, u);
+    g_ptr_array_add(unit_list, u);
+    return u;
+}
+
+static const char* unit_name(const ProfileUnit *u) {
+    return u && u->fn ? u->fn->name : "main";
+}
+
+// file:line of a line of u
+static void format_location(const ProfileUnit *u, int line, char *buf, size_t size) {
+    if (u->fn) snprintf(buf, size, "%s:%d", u->fn->source ? u->fn->source : script_name, u->fn->start_line + line + 1);
+    else snprintf(buf, size, "%s:%d", script_name, line + 1);
+}
+
+// ------------------------ Hooks ------------------------
+void ccrp_profile_start(CcrpVM *vm, const char *script, const char *prefix) {
+    if (profiled) {
+        fprintf(stderr, "Error: another script is already being profiled\n");
+        return;
+    }
+    profiled = vm;
+    units = g_hash_table_new(g_direct_hash, g_direct_equal);
+    unit_list = g_ptr_array_new();
+    script_name = script;
+    out_prefix = g_strdup(prefix ? prefix : "ccrp-profile");
+    capacity = 64;
+    stack = malloc(capacity * sizeof(ProfileFrame));
+    stack[0] = (ProfileFrame){ NULL, -1, &root, 0, 0 };
+    depth = 1;
+    start_wall = last_wall = clock_ns(CLOCK_MONOTONIC);
+    start_cpu = last_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    vm->profiling = 1;
+    atexit(ccrp_profile_finish);
+}
+
+void ccrp_profile_line(const Function *fn, char **lines, int line_count, int line) {
+    ProfileFrame *top = &stack[depth - 1];
+    if (top->line == line && top->unit && top->unit->lines == lines) return;
+    charge();
+    if (!top->unit || top->unit->lines != lines) top->unit = unit_for(fn, lines, line_count);
+    top->line = line;
+    if (line >= 0 && line < line_count) top->unit->hits[line]++;
+}
+
+void ccrp_profile_enter(const Function *fn) {
+    charge();
+    if (depth >= capacity) {
+        capacity *= 2;
+        stack = realloc(stack, capacity * sizeof(ProfileFrame));
+    }
+    ProfileUnit *u = unit_for(fn, fn->lines, fn->line_count);
+    ProfileNode *parent = stack[depth - 1].node, *node = parent;
+    if (parent->depth < PROFILE_MAX_DEPTH) {
+        for (node = parent->child; node && node->unit != u; node = node->sibling) { }
+        if (!node) {
+            node = calloc(1, sizeof(ProfileNode));
+            node->unit = u;
+            node->parent = parent;
+            node->sibling = parent->child;
+            node->depth = parent->depth + 1;
+            parent->child = node;
+        }
+    }
+    u->calls++;
+    u->active++;
+    stack[depth++] = (ProfileFrame){ u, -1, node, last_wall, last_cpu };
+}
+
+void ccrp_profile_leave(void) {
+    if (depth <= 1) return;
+    charge();
+    ProfileFrame *f = &stack[--depth];
+    if (--f->unit->active == 0) {
+        f->unit->total_wall_ns += last_wall - f->wall_start;
+        f->unit->total_cpu_ns += last_cpu - f->cpu_start;
+    }
+}
+
+// ------------------------ Report ------------------------
+typedef struct {
+    ProfileUnit *unit;
+    int line;
+} LineRef;
+
+static int by_line_time(const void *a, const void *b) {
+    const LineRef *x = a, *y = b;
+    uint64_t tx = x->unit->wall_ns[x->line], ty = y->unit->wall_ns[y->line];
+    if (tx != ty) return tx < ty ? 1 : -1;
+    uint64_t hx = x->unit->hits[x->line], hy = y->unit->hits[y->line];
+    return (hx < hy) - (hx > hy);
+}
+
+static int by_total_time(const void *a, const void *b) {
+    const ProfileUnit *x = *(ProfileUnit* const*)a, *y = *(ProfileUnit* const*)b;
+    return (x->total_wall_ns < y->total_wall_ns) - (x->total_wall_ns > y->total_wall_ns);
+}
+
+static double ms(uint64_t ns) { return (double)ns / 1e6; }
+
+static void write_report(FILE *out, uint64_t wall, uint64_t cpu) {
+    guint count = unit_list->len;
+    ProfileUnit **list = (ProfileUnit**)unit_list->pdata; // sorted in place
+    fprintf(out, "CCRP profile of %s: %.3f ms wall, %.3f ms cpu\n\n", script_name, ms(wall), ms(cpu));
+
+    qsort(list, count, sizeof(ProfileUnit*), by_total_time);
+    fprintf(out, "Functions by inclusive wall time\n");
+    fprintf(out, "%12s %12s %12s  %s\n", "calls", "wall ms", "cpu ms", "function");
+    for (guint i = 0; i < count; i++) {
+        const ProfileUnit *u = list[i];
+        if (!u->fn) continue;
+        char where[300];
+        format_location(u, -1, where, sizeof(where));
+        fprintf(out, "%12" PRIu64 " %12.3f %12.3f  %s (%s)\n", u->calls, ms(u->total_wall_ns),
+                ms(u->total_cpu_ns), u->fn->name, where);
+    }
+
+    size_t line_total = 0, n = 0;
+    for (guint i = 0; i < count; i++)
+        for (int k = 0; k < list[i]->line_count; k++) line_total += list[i]->hits[k] != 0;
+    LineRef *lines = malloc((line_total + 1) * sizeof(LineRef));
+    for (guint i = 0; i < count; i++)
+        for (int k = 0; k < list[i]->line_count; k++)
+            if (list[i]->hits[k]) lines[n++] = (LineRef){ list[i], k };
+    qsort(lines, n, sizeof(LineRef), by_line_time);
+    fprintf(out, "\nLines by self wall time\n");
+    fprintf(out, "%12s %12s %12s  %-28s %s\n", "hits", "wall ms", "cpu ms", "location", "source");
+    for (size_t i = 0; i < n; i++) {
+        const ProfileUnit *u = lines[i].unit;
+        int k = lines[i].line;
+        char where[300];
+        format_location(u, k, where, sizeof(where));
+        const char *text = u->lines[k];
+        while (*text == ' ' || *text == '\t') text++;
+        fprintf(out, "%12" PRIu64 " %12.3f %12.3f  %-28s %s\n", u->hits[k], ms(u->wall_ns[k]),
+                ms(u->cpu_ns[k]), where, text);
+    }
+    free(lines);
+}
+
+// One folded line per node with self time: frame names from the root, then microseconds
+static void write_folded(FILE *out, const ProfileNode *node, GString *path) {
+    gsize length = path->len;
+    if (path->len) g_string_append_c(path, ';');
+    g_string_append(path, node == &root ? "main" : unit_name(node->unit));
+    uint64_t us = node->self_ns / 1000;
+    if (us) fprintf(out, "%s %" PRIu64 "\n", path->str, us);
+    for (const ProfileNode *c = node->child; c; c = c->sibling) write_folded(out, c, path);
+    g_string_truncate(path, length);
+}
+
+// Write <prefix>.txt and <prefix>.folded; runs once, at the latest at exit
+void ccrp_profile_finish(void) {
+    if (!profiled || finished) return;
+    finished = 1;
+    charge();
+    while (depth > 1) ccrp_profile_leave();
+    uint64_t wall = last_wall - start_wall, cpu = last_cpu - start_cpu;
+
+    char *report = g_strdup_printf("%s.txt", out_prefix);
+    char *folded = g_strdup_printf("%s.folded", out_prefix);
+    FILE *out = fopen(report, "w");
+    if (out) {
+        write_report(out, wall, cpu);
+        fclose(out);
+    }
+    FILE *fold = fopen(folded, "w");
+    if (fold) {
+        GString *path = g_string_new(NULL);
+        write_folded(fold, &root, path);
+        g_string_free(path, TRUE);
+        fclose(fold);
+    }
+    if (out && fold) fprintf(stderr, "Profile written to %s and %s\n", report, folded);
+    else fprintf(stderr, "Error: could not write profile %s\n", out ? folded : report);
+    g_free(report);
+    g_free(folded);
+}
@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * CCRP source text
+ *
+ * A script is read into one buffer and indexed as (offset, length) spans in
+ * one pass with memchr. Each line is then terminated in place, so the
+ * line-based interpreter gets a char* per line without copying the text
+ * again or allocating per line. Blank lines are kept, so line numbers match
+ * the file.
+ *
+ * A regular file is read with a buffer of its size, usually in one read().
+ * (A private mapping is no cheaper: terminating the lines writes to every
+ * page, and each write costs a copy-on-write fault.) Stdin and pipes are
+ * read in large chunks into a growing buffer, indexing lines as they arrive.
+ * Spans hold offsets rather than pointers because the buffer moves as it grows.
+ */
+
+#define READ_CHUNK (64 * 1024)
+
+static void add_span(Source *src, int *capacity, size_t offset, size_t length) {
+    if (src->line_count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        src->spans = realloc(src->spans, *capacity * sizeof(LineSpan));
+    }
+    if (length > 0 && src->text[offset + length - 1] == '\r') length--; // CRLF line endings
+    src->spans[src->line_count].offset = offset;
+    src->spans[src->line_count].length = length;
+    src->line_count++;
+}
+
+// Index the complete lines in text[*line_start..length); scanning resumes at
+// *scanned so a long unfinished line is not searched again
+static void index_lines(Source *src, int *capacity, size_t *line_start, size_t *scanned) {
+    const char *end = src->text + src->length;
+    const char *p = src->text + *scanned;
+    const char *nl;
+    while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        add_span(src, capacity, *line_start, (size_t)(nl - src->text) - *line_start);
+        *line_start = (size_t)(nl - src->text) + 1;
+        p = nl + 1;
+    }
+    *scanned = src->length;
+}
+
+// Index the final unterminated line and terminate every line in place
+static void finish_lines(Source *src, int *capacity, size_t line_start) {
+    if (line_start < src->length) add_span(src, capacity, line_start, src->length - line_start);
+    src->lines = malloc(((size_t)src->line_count + 1) * sizeof(char*));
+    for (int i = 0; i < src->line_count; i++) {
+        char *line = src->text + src->spans[i].offset;
+        line[src->spans[i].length] = '\0';
+        src->lines[i] = line;
+    }
+    src->lines[src->line_count] = NULL;
+}
+
+// Read fd to its end; size is the expected length (0 if unknown)
+static Source* read_source(int fd, size_t size) {
+    Source *src = calloc(1, sizeof(Source));
+    size_t capacity = size ? size : READ_CHUNK, line_start = 0, scanned = 0;
+    int span_capacity = 0;
+    src->text = malloc(capacity + 1);
+    for (;;) {
+        if (src->length == capacity) {
+            capacity *= 2;
+            src->text = realloc(src->text, capacity + 1);
+        }
+        ssize_t n = read(fd, src->text + src->length, capacity - src->length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        src->length += (size_t)n;
+        index_lines(src, &span_capacity, &line_start, &scanned);
+    }
+    src->text[src->length] = '\0';
+    finish_lines(src, &span_capacity, line_start);
+    return src;
+}
+
+Source* ccrp_source_read(int fd) {
+    return read_source(fd, 0);
+}
+
+Source* ccrp_source_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    size_t size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size : 0;
+    Source *src = read_source(fd, size);
+    close(fd);
+    return src;
+}
+
+void ccrp_source_free(Source *src) {
+    if (!src) return;
+    free(src->text);
+    free(src->spans);
+    free(src->lines);
+    free(src);
+}
+
+// ------------------------ Utility: split lines ------------------------
+// Lines of an in-memory string. The pointer array and a copy of the text share
+// one allocation, so free_lines is a single free.
+char** split_lines(const char *code, int *line_count) {
+    size_t length = strlen(code);
+    int count = 0;
+    for (const char *p = code; (p = memchr(p, '\n', length - (size_t)(p - code))) != NULL; p++) count++;
+    if (length > 0 && code[length - 1] != '\n') count++;
+
+    char **lines = malloc(((size_t)count + 1) * sizeof(char*) + length + 1);
+    char *text = (char*)(lines + count + 1);
+    memcpy(text, code, length + 1);
+    char *p = text, *end = text + length;
+    for (int i = 0; i < count; i++) {
+        char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) nl = end;
+        size_t n = (size_t)(nl - p);
+        if (n > 0 && p[n - 1] == '\r') n--;
+        p[n] = '\0';
+        lines[i] = p;
+        p = nl + 1;
+    }
+    lines[count] = NULL;
+    *line_count = count;
+    return lines;
+}
+
+void free_lines(char **lines, int line_count) {
+    (void)line_count;
+    free(lines);
+}
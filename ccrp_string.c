@@ -0,0 +1,188 @@
+#define _GNU_SOURCE // memmem
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef CCRP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * CCRP string kernels
+ *
+ * The scanning behind the `string` library (#[string], ccrp_builtins.c).
+ * Searches go through memchr/memmem, which libc already vectorizes; case
+ * conversion and byte counting run on SSE2 or AVX2 like the array kernels,
+ * with plain loops for the tails and for CCRP_NO_SIMD=1. Strings are byte
+ * strings: positions and lengths count bytes, and only ASCII letters change
+ * case.
+ */
+
+// ------------------------ Case ------------------------
+// Bytes in [first, first + 26) get bit 0x20 flipped: 'a' upper-cases, 'A' lower-cases.
+// Shifting the range to start at -128 makes it one signed compare per lane.
+#ifdef CCRP_X86_SIMD
+__attribute__((target("avx2")))
+static size_t case_avx2(const char *in, char *out, size_t n, char first) {
+    __m256i shift = _mm256_set1_epi8((char)(128 - first));
+    __m256i limit = _mm256_set1_epi8(-128 + 26);
+    __m256i flip = _mm256_set1_epi8(0x20);
+    size_t k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(in + k));
+        __m256i hit = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(x, shift));
+        _mm256_storeu_si256((__m256i*)(out + k), _mm256_xor_si256(x, _mm256_and_si256(hit, flip)));
+    }
+    return k;
+}
+
+static size_t case_sse2(const char *in, char *out, size_t n, char first) {
+    __m128i shift = _mm_set1_epi8((char)(128 - first));
+    __m128i limit = _mm_set1_epi8(-128 + 26);
+    __m128i flip = _mm_set1_epi8(0x20);
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + k));
+        __m128i hit = _mm_cmplt_epi8(_mm_add_epi8(x, shift), limit);
+        _mm_storeu_si128((__m128i*)(out + k), _mm_xor_si128(x, _mm_and_si128(hit, flip)));
+    }
+    return k;
+}
+#endif
+
+Value ccrp_str_case(const char *s, size_t n, int upper) {
+    char first = upper ? 'a' : 'A';
+    CcrpString *out = ccrp_string_sized(n);
+    size_t k = 0;
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) k = case_avx2(s, out->data, n, first);
+    else if (ccrp_simd_level() == 1) k = case_sse2(s, out->data, n, first);
+#endif
+    for (; k < n; k++) {
+        char c = s[k];
+        out->data[k] = (unsigned char)(c - first) < 26 ? (char)(c ^ 0x20) : c;
+    }
+    Value v;
+    v.type = VAL_STR;
+    v.as.s = out;
+    return v;
+}
+
+// ------------------------ Searching ------------------------
+#ifdef CCRP_X86_SIMD
+__attribute__((target("avx2,popcnt")))
+static size_t count_byte_avx2(const char *s, size_t n, char c, size_t *done) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t k = 0, count = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + k)), needle);
+        count += (size_t)_mm_popcnt_u32((unsigned)_mm256_movemask_epi8(eq));
+    }
+    *done = k;
+    return count;
+}
+
+static size_t count_byte_sse2(const char *s, size_t n, char c, size_t *done) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t k = 0, count = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + k)), needle);
+        count += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(eq));
+    }
+    *done = k;
+    return count;
+}
+#endif
+
+size_t ccrp_str_count_byte(const char *s, size_t n, char c) {
+    size_t k = 0, count = 0;
+#ifdef CCRP_X86_SIMD
+    if (ccrp_simd_level() == 2) count = count_byte_avx2(s, n, c, &k);
+    else if (ccrp_simd_level() == 1) count = count_byte_sse2(s, n, c, &k);
+#endif
+    for (; k < n; k++) count += s[k] == c;
+    return count;
+}
+
+// First position of needle in s at or after from, or -1. An empty needle matches at from.
+int64_t ccrp_str_find(const char *s, size_t n, const char *needle, size_t m, size_t from) {
+    if (from > n) return -1;
+    if (m == 0) return (int64_t)from;
+    const char *hit = m == 1 ? memchr(s + from, needle[0], n - from) : memmem(s + from, n - from, needle, m);
+    return hit ? hit - s : -1;
+}
+
+// Non-overlapping occurrences of needle (m > 0)
+size_t ccrp_str_count(const char *s, size_t n, const char *needle, size_t m) {
+    if (m == 1) return ccrp_str_count_byte(s, n, needle[0]);
+    size_t count = 0;
+    for (int64_t at = ccrp_str_find(s, n, needle, m, 0); at >= 0; at = ccrp_str_find(s, n, needle, m, (size_t)at + m))
+        count++;
+    return count;
+}
+
+// ------------------------ Building ------------------------
+// s with every occurrence of from replaced by to, sized exactly in two passes
+Value ccrp_str_replace(const char *s, size_t n, const char *from, size_t from_len, const char *to, size_t to_len) {
+    size_t hits = from_len ? ccrp_str_count(s, n, from, from_len) : 0;
+    if (hits == 0) return value_string_len(s, n);
+    CcrpString *out = ccrp_string_sized(n - hits * from_len + hits * to_len);
+    char *dst = out->data;
+    size_t k = 0;
+    for (int64_t at; (at = ccrp_str_find(s, n, from, from_len, k)) >= 0; k = (size_t)at + from_len) {
+        memcpy(dst, s + k, (size_t)at - k);
+        dst += (size_t)at - k;
+        memcpy(dst, to, to_len);
+        dst += to_len;
+    }
+    memcpy(dst, s + k, n - k);
+    Value v;
+    v.type = VAL_STR;
+    v.as.s = out;
+    return v;
+}
+
+// Pieces of s between separators as a map keyed 0, 1, 2...; an empty
+// separator splits into single bytes
+Value ccrp_str_split(const char *s, size_t n, const char *sep, size_t sep_len) {
+    CcrpMap *parts = ccrp_map_new(sep_len ? ccrp_str_count(s, n, sep, sep_len) + 1 : n);
+    int64_t index = 0;
+    if (sep_len == 0) {
+        for (size_t k = 0; k < n; k++) {
+            Value piece = value_string_len(s + k, 1);
+            ccrp_map_set(parts, value_int(index++), piece);
+            value_release(piece);
+        }
+        return value_map(parts);
+    }
+    size_t k = 0;
+    for (;;) {
+        int64_t at = ccrp_str_find(s, n, sep, sep_len, k);
+        size_t end = at >= 0 ? (size_t)at : n;
+        Value piece = value_string_len(s + k, end - k);
+        ccrp_map_set(parts, value_int(index++), piece);
+        value_release(piece);
+        if (at < 0) break;
+        k = end + sep_len;
+    }
+    return value_map(parts);
+}
+
+// Values of a map (in order) or elements of an array, joined by sep
+Value ccrp_str_join(Value parts, const char *sep, size_t sep_len) {
+    GString *out = g_string_new(NULL);
+    size_t count = parts.type == VAL_MAP ? parts.as.m->count : parts.type == VAL_ARRAY ? parts.as.a->length : 0;
+    for (size_t k = 0; k < count; k++) {
+        if (k) g_string_append_len(out, sep, (gssize)sep_len);
+        Value item = parts.type == VAL_MAP ? value_retain(ccrp_map_entry(parts.as.m, (int64_t)k)->value)
+                                           : ccrp_index_get(parts, value_int((int64_t)k));
+        Value text = value_to_string(item);
+        g_string_append_len(out, text.as.s->data, (gssize)text.as.s->length);
+        value_release(text);
+        value_release(item);
+    }
+    Value v = value_string_len(out->str, out->len);
+    g_string_free(out, TRUE);
+    return v;
+}
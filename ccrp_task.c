@@ -0,0 +1,427 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <glib-unix.h>
+
+/*
+ * CCRP tasks
+ *
+ *   t = spawn fetch(url)      // start fetch as a task, t is its handle
+ *   sleep 100                 // milliseconds; other tasks run meanwhile
+ *   page = await t            // wait for fetch to return and take its result
+ *
+ * Tasks are stackless coroutines on one thread. The VM keeps every call of a
+ * function in its own Frame and value stacks, never on the C stack, so a task
+ * is just a set of those stacks: switching tasks swaps a few pointers in the
+ * VM and vm_run continues at the instruction the task stopped at. A task only
+ * gives up the thread at `await` on an unfinished task and at `sleep`.
+ *
+ * Sleeping and GUI events go through the thread-default GLib main context,
+ * which the scheduler iterates whenever no task is ready, so timers, input and
+ * widgets all make progress while tasks wait. `gtk run` and `input` keep
+ * running tasks too.
+ *
+ * The script itself is task 0. It can suspend like any task when it runs on
+ * the bytecode VM and the statement is not nested inside a native call (a
+ * library statement, the tree-walker, a builtin). There, and anywhere else a
+ * task cannot unwind, await and sleep run the scheduler in place until they
+ * can go on. Tasks still running when the script ends are finished before the
+ * run returns.
+ */
+
+typedef enum { TASK_READY, TASK_RUNNING, TASK_WAITING, TASK_SLEEPING, TASK_BLOCKED, TASK_DONE } TaskState;
+
+typedef struct Task {
+    int id;
+    TaskState state;
+    Instr *resume;      // where vm_run continues, NULL: the start of the first frame
+    Value result;       // return value once done
+    int finished;       // state is TASK_DONE, as a flag for block_until
+    GPtrArray *waiters; // tasks suspended in `await` on this one
+    CcrpVM *vm;
+
+    // The VM stacks while another task runs
+    struct Frame *frames;
+    int frame_count;
+    int frame_capacity;
+    Value *local_stack;
+    int local_top;
+    int local_capacity;
+    Value *stack;
+    int sp;
+    int stack_capacity;
+    Value *frame_locals;
+} Task;
+
+typedef struct TaskScheduler {
+    GPtrArray *tasks;   // by handle; 0 is the script itself
+    GQueue *ready;
+    Task *current;      // owns the stacks loaded into the VM
+    int live;           // tasks not done yet, the script included
+    int timers;         // sleeps of suspended tasks still pending
+} TaskScheduler;
+
+// ------------------------ Parsing ------------------------
+static int task_keyword(const char *s, const char **rest) {
+    static const struct { const char *word; int op; } words[] = {
+        { "spawn", OP_SPAWN }, { "await", OP_AWAIT }, { "sleep", OP_SLEEP }
+    };
+    for (size_t i = 0; i < G_N_ELEMENTS(words); i++) {
+        size_t n = strlen(words[i].word);
+        if (strncmp(s, words[i].word, n) != 0 || (s[n] != ' ' && s[n] != '\t')) continue;
+        s += n;
+        while (*s == ' ' || *s == '\t') s++;
+        if (!*s || (s[0] == '=' && s[1] != '=')) return -1; // `sleep = 3` assigns a variable
+        *rest = s;
+        return words[i].op;
+    }
+    return -1;
+}
+
+// Recognise `spawn CALL`, `await EXPR` and `sleep EXPR`, the first two also as
+// `NAME = ...`. Returns OP_SPAWN, OP_AWAIT or OP_SLEEP and fills the target
+// (NULL without one) and the operand text, or returns -1.
+int ccrp_task_parse(const char *line, char **target, char **operand) {
+    while (*line == ' ' || *line == '\t') line++;
+    const char *rest = NULL, *name_end = NULL;
+    int op = task_keyword(line, &rest);
+    if (op < 0) {
+        const char *p = line;
+        while (*p == '_' || isalnum((unsigned char)*p)) p++;
+        if (p == line) return -1;
+        name_end = p;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '=' || p[1] == '=') return -1;
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+        op = task_keyword(p, &rest);
+        if (op < 0 || op == OP_SLEEP) return -1;
+    }
+    const char *end = rest + strlen(rest);
+    while (end > rest && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    *operand = g_strndup(rest, (gsize)(end - rest));
+    *target = name_end ? g_strndup(line, (gsize)(name_end - line)) : NULL;
+    return op;
+}
+
+// ------------------------ Scheduler ------------------------
+static Task* task_new(TaskScheduler *s, CcrpVM *vm) {
+    Task *t = calloc(1, sizeof(Task));
+    t->id = (int)s->tasks->len;
+    t->state = TASK_READY;
+    t->result = value_int(0);
+    t->vm = vm;
+    g_ptr_array_add(s->tasks, t);
+    s->live++;
+    return t;
+}
+
+// The scheduler, created with the script as the running task 0
+static TaskScheduler* scheduler(CcrpVM *vm) {
+    if (!vm->scheduler) {
+        TaskScheduler *s = calloc(1, sizeof(TaskScheduler));
+        s->tasks = g_ptr_array_new();
+        s->ready = g_queue_new();
+        vm->scheduler = s;
+        s->current = task_new(s, vm);
+        s->current->state = TASK_RUNNING;
+    }
+    return vm->scheduler;
+}
+
+static void save_stacks(CcrpVM *vm, Task *t) {
+    t->frames = vm->frames;
+    t->frame_count = vm->frame_count;
+    t->frame_capacity = vm->frame_capacity;
+    t->local_stack = vm->local_stack;
+    t->local_top = vm->local_top;
+    t->local_capacity = vm->local_capacity;
+    t->stack = vm->stack;
+    t->sp = vm->sp;
+    t->stack_capacity = vm->stack_capacity;
+    t->frame_locals = vm->frame_locals;
+}
+
+static void load_stacks(CcrpVM *vm, const Task *t) {
+    vm->frames = t->frames;
+    vm->frame_count = t->frame_count;
+    vm->frame_capacity = t->frame_capacity;
+    vm->local_stack = t->local_stack;
+    vm->local_top = t->local_top;
+    vm->local_capacity = t->local_capacity;
+    vm->stack = t->stack;
+    vm->sp = t->sp;
+    vm->stack_capacity = t->stack_capacity;
+    vm->frame_locals = t->frame_locals;
+}
+
+static void switch_to(CcrpVM *vm, Task *t) {
+    TaskScheduler *s = vm->scheduler;
+    if (s->current == t) return;
+    save_stacks(vm, s->current);
+    load_stacks(vm, t);
+    s->current = t;
+}
+
+// Drop what a task that will never run again still holds on its saved stacks
+static void task_discard(Task *t) {
+    while (t->local_top > 0) value_release(t->local_stack[--t->local_top]);
+    while (t->sp > 0) value_release(t->stack[--t->sp]);
+    t->frame_count = 0;
+    t->frame_locals = NULL;
+}
+
+static void task_free_stacks(Task *t) {
+    task_discard(t);
+    free(t->frames);
+    free(t->local_stack);
+    free(t->stack);
+    t->frames = NULL;
+    t->local_stack = t->stack = NULL;
+    t->frame_capacity = t->local_capacity = t->stack_capacity = 0;
+}
+
+static void make_ready(TaskScheduler *s, Task *t) {
+    t->state = TASK_READY;
+    g_queue_push_tail(s->ready, t);
+}
+
+static void finish_task(TaskScheduler *s, Task *t, Value result) {
+    t->state = TASK_DONE;
+    t->finished = 1;
+    value_assign(&t->result, result);
+    s->live--;
+    if (t->waiters) {
+        for (guint i = 0; i < t->waiters->len; i++) make_ready(s, g_ptr_array_index(t->waiters, i));
+        g_ptr_array_free(t->waiters, TRUE);
+        t->waiters = NULL;
+    }
+}
+
+// Run t until it returns or suspends, then give the stacks back to the caller's task
+static void run_task(CcrpVM *vm, Task *t) {
+    TaskScheduler *s = vm->scheduler;
+    Task *prev = s->current;
+    switch_to(vm, t);
+    t->state = TASK_RUNNING;
+    vm->task_resumable = 1;
+    Value result = ccrp_resume(t->resume);
+    if (t->state == TASK_RUNNING) finish_task(s, t, result);
+    else value_release(result);
+    switch_to(vm, prev);
+    if (t->state == TASK_DONE && t->id != 0) task_free_stacks(t);
+}
+
+static GMainContext* task_context(void) {
+    return g_main_context_get_thread_default(); // NULL: the global default context
+}
+
+static void add_timer(int64_t ms, GSourceFunc callback, gpointer data) {
+    GSource *timer = g_timeout_source_new(ms < 0 ? 0 : ms > G_MAXUINT ? G_MAXUINT : (guint)ms);
+    g_source_set_callback(timer, callback, data, NULL);
+    g_source_attach(timer, task_context());
+    g_source_unref(timer);
+}
+
+static gboolean set_flag(gpointer data) {
+    *(int*)data = 1;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean wake_sleeper(gpointer data) {
+    Task *t = data;
+    TaskScheduler *s = t->vm->scheduler;
+    s->timers--;
+    make_ready(s, t);
+    return G_SOURCE_REMOVE;
+}
+
+// Run ready tasks and the main context in place until *flag is set. Without
+// external sources (GUI, input, a timer of the caller's) only tasks can set
+// it, so this gives up and returns 0 once none is ready or sleeping.
+static int block_until(CcrpVM *vm, const int *flag, int external) {
+    TaskScheduler *s = vm->scheduler;
+    Task *self = s ? s->current : NULL;
+    TaskState state = self ? self->state : TASK_RUNNING;
+    if (self) self->state = TASK_BLOCKED;
+    int ok = 1;
+    while (!*flag && !g_atomic_int_get(vm->interrupt)) {
+        if (s && !g_queue_is_empty(s->ready)) { run_task(vm, g_queue_pop_head(s->ready)); continue; }
+        if (!external && !(s && s->timers)) { ok = 0; break; }
+        g_main_context_iteration(task_context(), TRUE);
+    }
+    if (self) self->state = state;
+    return ok;
+}
+
+// ------------------------ Statements ------------------------
+// Start a task running the call `f(args)`; the arguments are evaluated now.
+// Returns its handle, 0 when it could not be started.
+Value ccrp_spawn(const Expr *call) {
+    CcrpVM *vm = ccrp_vm;
+    if (vm->parallel_worker) {
+        ccrp_out_printf("Error: spawn is not available inside a parallel for body.\n");
+        return value_int(0);
+    }
+    Function *fn = call && call->kind == EXPR_CALL ? ccrp_call_target(call->name, call->arg_count) : NULL;
+    if (!fn) {
+        ccrp_out_printf("Error: spawn needs a call of a user function.\n");
+        return value_int(0);
+    }
+    Value small[8];
+    Value *args = call->arg_count <= 8 ? small : malloc(call->arg_count * sizeof(Value));
+    for (int i = 0; i < call->arg_count; i++) args[i] = ccrp_expr_eval(call->args[i]);
+
+    TaskScheduler *s = scheduler(vm);
+    Task *prev = s->current, *t = task_new(s, vm);
+    switch_to(vm, t);
+    int started = ccrp_push_call(fn, args, call->arg_count);
+    switch_to(vm, prev);
+    for (int i = 0; i < call->arg_count; i++) value_release(args[i]);
+    if (args != small) free(args);
+    if (!started) { finish_task(s, t, value_int(0)); return value_int(0); }
+    g_queue_push_tail(s->ready, t);
+    return value_int(t->id);
+}
+
+// Wait for the task behind handle and set *result to its return value.
+// With resume (the await instruction) an unfinished task suspends the caller
+// instead: returns 1, and the await runs again once the task is done.
+int ccrp_await(Value handle, Value *result, Instr *resume) {
+    CcrpVM *vm = ccrp_vm;
+    TaskScheduler *s = vm->scheduler;
+    *result = value_int(0);
+    if (handle.type != VAL_INT || !s || handle.as.i <= 0 || handle.as.i >= (int64_t)s->tasks->len) {
+        ccrp_out_printf("Error: await needs a task handle from spawn.\n");
+        return 0;
+    }
+    Task *t = g_ptr_array_index(s->tasks, handle.as.i);
+    if (t->state != TASK_DONE) {
+        if (t == s->current) {
+            ccrp_out_printf("Error: a task cannot await itself.\n");
+            return 0;
+        }
+        if (resume) {
+            Task *self = s->current;
+            self->state = TASK_WAITING;
+            self->resume = resume;
+            if (!t->waiters) t->waiters = g_ptr_array_new();
+            g_ptr_array_add(t->waiters, self);
+            return 1;
+        }
+        if (!block_until(vm, &t->finished, 0)) {
+            ccrp_out_printf("Error: await on task %d can never finish: no task is ready or sleeping.\n", t->id);
+            return 0;
+        }
+    }
+    *result = value_retain(t->result);
+    return 0;
+}
+
+// Pause for ms milliseconds. With resume (the next instruction) the caller
+// suspends and 1 is returned; otherwise other tasks run in place meanwhile.
+int ccrp_sleep(int64_t ms, Instr *resume) {
+    CcrpVM *vm = ccrp_vm;
+    if (resume) {
+        TaskScheduler *s = scheduler(vm);
+        Task *self = s->current;
+        self->state = TASK_SLEEPING;
+        self->resume = resume;
+        s->timers++;
+        add_timer(ms, wake_sleeper, self);
+        return 1;
+    }
+    if (vm->parallel_worker) {
+        // pool threads do not own a main context
+        if (ms > 0) g_usleep((gulong)ms * 1000);
+        return 0;
+    }
+    int fired = 0;
+    add_timer(ms, set_flag, &fired);
+    block_until(vm, &fired, 1);
+    return 0;
+}
+
+// Tree-walker form of the task statements; returns 0 when line is not one
+int ccrp_task_statement(const char *line) {
+    char *target, *operand;
+    int op = ccrp_task_parse(line, &target, &operand);
+    if (op < 0) return 0;
+    const Expr *e = ccrp_expr_cached(ccrp_vm->current_line_index, -1, operand);
+    Value v = value_int(0);
+    if (op == OP_SPAWN) {
+        v = ccrp_spawn(e);
+    } else {
+        Value x = ccrp_expr_eval(e);
+        if (op == OP_AWAIT) ccrp_await(x, &v, NULL);
+        else ccrp_sleep(value_to_int(x), NULL);
+        value_release(x);
+    }
+    if (target) set_value(target, v);
+    else value_release(v);
+    g_free(target);
+    g_free(operand);
+    return 1;
+}
+
+// ------------------------ Event loop ------------------------
+// `gtk run`: tasks keep running until *flag is set (the main window closes)
+void ccrp_tasks_wait_flag(const int *flag) {
+    block_until(ccrp_vm, flag, 1);
+}
+
+static gboolean input_ready(gint fd, GIOCondition condition, gpointer data) {
+    (void)fd; (void)condition;
+    *(int*)data = 1;
+    return G_SOURCE_REMOVE;
+}
+
+// Before `input` blocks on fd: while other tasks are alive, run them until it is readable
+void ccrp_tasks_wait_input(int fd) {
+    CcrpVM *vm = ccrp_vm;
+    TaskScheduler *s = vm->scheduler;
+    if (!s || s->live <= 1) return;
+    int ready = 0;
+    GSource *watch = g_unix_fd_source_new(fd, G_IO_IN | G_IO_HUP | G_IO_ERR);
+    g_source_set_callback(watch, G_SOURCE_FUNC(input_ready), &ready, NULL);
+    g_source_attach(watch, task_context());
+    block_until(vm, &ready, 1);
+    g_source_destroy(watch);
+    g_source_unref(watch);
+}
+
+// After the script: run what is left of it, if it suspended, and every task
+// it spawned to the end, then drop the scheduler
+void ccrp_tasks_finish(void) {
+    CcrpVM *vm = ccrp_vm;
+    TaskScheduler *s = vm->scheduler;
+    if (!s) return;
+    Task *script = g_ptr_array_index(s->tasks, 0);
+    if (script->state == TASK_RUNNING) finish_task(s, script, value_int(0));
+    int stopped = 0;
+    while (s->live > 0 && !(stopped = g_atomic_int_get(vm->interrupt))) {
+        if (!g_queue_is_empty(s->ready)) { run_task(vm, g_queue_pop_head(s->ready)); continue; }
+        if (!s->timers) break;
+        g_main_context_iteration(task_context(), TRUE);
+    }
+    if (s->live > 0 && !stopped) ccrp_out_printf("Error: %d task(s) never finished: each awaits another.\n", s->live);
+
+    switch_to(vm, script);
+    while (vm->local_top > 0) value_release(vm->local_stack[--vm->local_top]);
+    while (vm->sp > 0) value_release(vm->stack[--vm->sp]);
+    vm->frame_count = 0; // a script suspended for good still has its frame
+    vm->frame_locals = NULL;
+    for (guint i = 0; i < s->tasks->len; i++) {
+        Task *t = g_ptr_array_index(s->tasks, i);
+        if (i > 0) task_free_stacks(t);
+        value_release(t->result);
+        if (t->waiters) g_ptr_array_free(t->waiters, TRUE);
+        free(t);
+    }
+    g_ptr_array_free(s->tasks, TRUE);
+    g_queue_free(s->ready);
+    free(s);
+    vm->scheduler = NULL;
+}
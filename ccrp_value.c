@@ -0,0 +1,253 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/*
+ * CCRP values
+ *
+ * Every variable, local and expression result is a 16-byte tagged Value: a
+ * 64-bit integer, a double, or a pointer to a reference-counted string,
+ * array (ccrp_array.c) or map (ccrp_map.c). Copying a Value only bumps the count, so assignment
+ * never copies text or elements.
+ *
+ * String literals are interned into an arena: each distinct literal exists
+ * once per VM, pinned until the VM is freed. Concatenation appends in place
+ * when the left operand has a single owner, growing the buffer geometrically,
+ * so building a string in a loop is linear rather than quadratic.
+ */
+
+// ------------------------ Strings ------------------------
+static CcrpString* string_alloc(size_t capacity) {
+    CcrpString *s = malloc(sizeof(CcrpString) + capacity + 1);
+    s->refcount = 1;
+    s->length = 0;
+    s->capacity = capacity;
+    s->data[0] = '\0';
+    return s;
+}
+
+CcrpString* ccrp_string_new(const char *text, size_t length) {
+    CcrpString *s = string_alloc(length);
+    memcpy(s->data, text, length);
+    s->data[length] = '\0';
+    s->length = length;
+    return s;
+}
+
+// String of length bytes for the caller to fill in; already terminated
+CcrpString* ccrp_string_sized(size_t length) {
+    CcrpString *s = string_alloc(length);
+    s->length = length;
+    s->data[length] = '\0';
+    return s;
+}
+
+void ccrp_string_free(CcrpString *s) {
+    free(s);
+}
+
+// ------------------------ Interned literals ------------------------
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+static void* arena_alloc(CcrpVM *vm, size_t n) {
+    n = (n + 7) & ~(size_t)7;
+    if (!vm->arena || vm->arena->used + n > vm->arena->size) {
+        size_t size = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+        block->next = vm->arena;
+        block->used = 0;
+        block->size = size;
+        vm->arena = block;
+    }
+    void *p = vm->arena->data + vm->arena->used;
+    vm->arena->used += n;
+    return p;
+}
+
+Value value_string_intern(const char *text, size_t length) {
+    CcrpVM *vm = ccrp_vm;
+    if (!vm->interned) vm->interned = g_hash_table_new(g_str_hash, g_str_equal);
+    char small[128];
+    char *key = length < sizeof(small) ? small : malloc(length + 1);
+    memcpy(key, text, length);
+    key[length] = '\0';
+    CcrpString *s = g_hash_table_lookup(vm->interned, key);
+    if (key != small) free(key);
+    if (!s) {
+        s = arena_alloc(vm, sizeof(CcrpString) + length + 1);
+        s->refcount = CCRP_STRING_PINNED;
+        s->length = length;
+        s->capacity = length;
+        memcpy(s->data, text, length);
+        s->data[length] = '\0';
+        g_hash_table_insert(vm->interned, s->data, s);
+    }
+    Value v;
+    v.type = VAL_STR;
+    v.as.s = s;
+    return v;
+}
+
+// Drop vm's literals; nothing may reference them any more
+void ccrp_interned_free(CcrpVM *vm) {
+    if (vm->interned) g_hash_table_destroy(vm->interned);
+    vm->interned = NULL;
+    while (vm->arena) {
+        ArenaBlock *next = vm->arena->next;
+        free(vm->arena);
+        vm->arena = next;
+    }
+}
+
+// ------------------------ Constructors ------------------------
+Value value_string(const char *text) {
+    return value_string_len(text, strlen(text));
+}
+
+Value value_string_len(const char *text, size_t length) {
+    Value v;
+    v.type = VAL_STR;
+    v.as.s = ccrp_string_new(text, length);
+    return v;
+}
+
+// ------------------------ Concatenation ------------------------
+// Text of a value for concatenation; numbers are formatted into buf
+static const char* value_text(Value v, char *buf, size_t size, size_t *length) {
+    switch (v.type) {
+        case VAL_STR: *length = v.as.s->length; return v.as.s->data;
+        case VAL_INT: *length = (size_t)snprintf(buf, size, "%" PRId64, v.as.i); return buf;
+        case VAL_DOUBLE: *length = (size_t)snprintf(buf, size, "%g", v.as.d); return buf;
+        case VAL_ARRAY:
+        case VAL_MAP: break; // formatted by value_to_string
+    }
+    *length = 0;
+    return "";
+}
+
+static int is_collection(Value v) {
+    return v.type == VAL_ARRAY || v.type == VAL_MAP;
+}
+
+// Text of any value as a new string; arrays print as [1, 2, 3] and maps as
+// {"a": 1, 2: "b"}
+Value value_to_string(Value v) {
+    if (v.type == VAL_STR) return value_retain(v);
+    if (is_collection(v)) {
+        GString *text = g_string_new(NULL);
+        if (v.type == VAL_ARRAY) ccrp_array_format(v.as.a, text);
+        else ccrp_map_format(v.as.m, text);
+        Value s = value_string_len(text->str, text->len);
+        g_string_free(text, TRUE);
+        return s;
+    }
+    char buf[32];
+    size_t length;
+    const char *text = value_text(v, buf, sizeof(buf), &length);
+    return value_string_len(text, length);
+}
+
+// left .. right as a string. Consumes left and borrows right. When left is a
+// string nobody else holds, its buffer is reused and grown by doubling.
+Value value_concat(Value left, Value right) {
+    if (is_collection(left)) {
+        Value text = value_to_string(left);
+        value_release(left);
+        left = text;
+    }
+    if (is_collection(right)) {
+        Value text = value_to_string(right);
+        Value result = value_concat(left, text);
+        value_release(text);
+        return result;
+    }
+    char lbuf[32], rbuf[32];
+    size_t llen, rlen;
+    const char *rtext = value_text(right, rbuf, sizeof(rbuf), &rlen);
+    if (left.type == VAL_STR && left.as.s->refcount == 1) {
+        CcrpString *s = left.as.s;
+        if (s->length + rlen > s->capacity) {
+            size_t capacity = s->capacity * 2;
+            if (capacity < s->length + rlen) capacity = s->length + rlen;
+            if (capacity < 16) capacity = 16;
+            s = realloc(s, sizeof(CcrpString) + capacity + 1);
+            s->capacity = capacity;
+        }
+        memcpy(s->data + s->length, rtext, rlen); // rtext cannot alias s: left is its only owner
+        s->length += rlen;
+        s->data[s->length] = '\0';
+        left.as.s = s;
+        return left;
+    }
+    const char *ltext = value_text(left, lbuf, sizeof(lbuf), &llen);
+    CcrpString *s = string_alloc(llen + rlen);
+    memcpy(s->data, ltext, llen);
+    memcpy(s->data + llen, rtext, rlen);
+    s->length = llen + rlen;
+    s->data[s->length] = '\0';
+    value_release(left);
+    Value v;
+    v.type = VAL_STR;
+    v.as.s = s;
+    return v;
+}
+
+// ------------------------ Conversions ------------------------
+int64_t value_to_int(Value v) {
+    switch (v.type) {
+        case VAL_INT: return v.as.i;
+        case VAL_DOUBLE: return (int64_t)v.as.d;
+        case VAL_STR: return strtoll(v.as.s->data, NULL, 10);
+        case VAL_ARRAY:
+        case VAL_MAP: return 0;
+    }
+    return 0;
+}
+
+double value_to_double(Value v) {
+    switch (v.type) {
+        case VAL_INT: return (double)v.as.i;
+        case VAL_DOUBLE: return v.as.d;
+        case VAL_STR: return strtod(v.as.s->data, NULL);
+        case VAL_ARRAY:
+        case VAL_MAP: return 0.0;
+    }
+    return 0.0;
+}
+
+int value_truthy(Value v) {
+    switch (v.type) {
+        case VAL_INT: return v.as.i != 0;
+        case VAL_DOUBLE: return v.as.d != 0.0;
+        case VAL_STR: return v.as.s->length != 0;
+        case VAL_ARRAY: return v.as.a->length != 0;
+        case VAL_MAP: return v.as.m->count != 0;
+    }
+    return 0;
+}
+
+const char* value_cstr(Value v) {
+    return v.type == VAL_STR ? v.as.s->data : "";
+}
+
+void value_print(Value v) {
+    if (is_collection(v)) {
+        Value text = value_to_string(v);
+        ccrp_out_write(text.as.s->data, text.as.s->length);
+        value_release(text);
+        return;
+    }
+    char buf[32];
+    size_t length;
+    const char *text = value_text(v, buf, sizeof(buf), &length);
+    ccrp_out_write(text, length);
+}
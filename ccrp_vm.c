@@ -0,0 +1,1269 @@
+#include "ccrp.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * CCRP bytecode compiler and VM
+ *
+ * The tree-walker in ccrp.c re-parses every line each time it runs it. Here the
+ * source is compiled once into a flat Instr array: comments are stripped, keywords
+ * are recognised, if/else/while are resolved into jumps, print items are split
+ * up front and every condition and right-hand side is parsed into an Expr tree,
+ * so loop bodies run without touching source text. The VM then dispatches with
+ * computed goto (direct threading) where the compiler supports it and falls back
+ * to a switch otherwise.
+ *
+ * Imports and function definitions at the top level of the script are
+ * declarations: they take effect while compiling, so the optimizer (ccrp_opt.c)
+ * knows which names are user functions and which are builtins. Other statements
+ * without a dedicated op (gtk, style, input, nested definitions) are delegated
+ * to run_line as OP_LINE.
+ *
+ * spawn, await and sleep have ops of their own: a task suspends by returning
+ * from vm_run with its frames left on its stacks (see ccrp_task.c).
+ */
+
+#if defined(__GNUC__)
+#define CCRP_THREADED 1
+#else
+#define CCRP_THREADED 0
+#endif
+
+// ------------------------ Source helpers ------------------------
+// Copy of a source line with `//` comments and surrounding whitespace removed
+static char* clean_line(const char *line) {
+    const char *start = line;
+    while (*start == ' ' || *start == '\t') start++;
+    const char *end = strstr(start, "//");
+    if (!end) end = start + strlen(start);
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    return g_strndup(start, (gsize)(end - start));
+}
+
+static int starts_with_word(const char *s, const char *word) {
+    size_t n = strlen(word);
+    return strncmp(s, word, n) == 0 && (s[n] == '\0' || s[n] == ' ' || s[n] == '\t');
+}
+
+static const char* skip_word(const char *s) {
+    while (*s && *s != ' ' && *s != '\t') s++;
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+// Control keyword: a word, or directly followed by `(` as in if(x > 3)
+static int starts_with_keyword(const char *s, const char *word) {
+    size_t n = strlen(word);
+    return starts_with_word(s, word) || (strncmp(s, word, n) == 0 && s[n] == '(');
+}
+
+// Condition after a control keyword that starts s
+static const char* skip_keyword(const char *s, const char *word) {
+    s += strlen(word);
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+// Index of the line holding the '}' that closes the block opened on start_line
+static int find_block_close(char **lines, int line_count, int start_line) {
+    int depth = 0;
+    for (int i = start_line; i < line_count; i++) {
+        for (const char *p = lines[i]; *p; p++) {
+            if (*p == '{') depth++;
+            else if (*p == '}' && --depth == 0) return i;
+        }
+    }
+    return -1;
+}
+
+// ------------------------ Program building ------------------------
+static int emit(Program *prog, OpCode op, int line) {
+    if (prog->count >= prog->capacity) {
+        prog->capacity = prog->capacity ? prog->capacity * 2 : 64;
+        prog->code = realloc(prog->code, prog->capacity * sizeof(Instr));
+    }
+    Instr *in = &prog->code[prog->count];
+    memset(in, 0, sizeof(*in));
+    in->op = op;
+    in->line = line;
+    in->target = -1;
+    return prog->count++;
+}
+
+// Parse an expression, bind its variables in the scope being compiled and fold it
+static Expr* compile_expr(const char *src, const Function *fn) {
+    Expr *e = ccrp_expr_parse(src);
+    ccrp_resolve_expr_in(e, fn);
+    ccrp_expr_fold(e);
+    return e;
+}
+
+// Bind an assignment target: a local of fn if it has one by that name, else a global
+static void resolve_target(Instr *in, const char *name, const Function *fn) {
+    if (fn) {
+        for (int i = 0; i < fn->local_count; i++) {
+            if (strcmp(fn->local_names[i], name) == 0) { in->local = 1; in->slot = i; return; }
+        }
+    }
+    in->local = 0;
+    in->slot = var_slot(name);
+}
+
+// Split a print argument list at top-level commas (outside quotes and brackets)
+static void compile_print_items(Instr *in, const char *args, const Function *fn) {
+    int capacity = 4;
+    in->items = malloc(capacity * sizeof(PrintItem));
+    in->item_count = 0;
+    const char *p = args;
+    while (*p) {
+        const char *start = p;
+        int depth = 0, in_str = 0;
+        while (*p) {
+            if (*p == '"') in_str = !in_str;
+            else if (!in_str && (*p == '(' || *p == '[' || *p == '{')) depth++;
+            else if (!in_str && (*p == ')' || *p == ']' || *p == '}')) depth--;
+            else if (!in_str && depth == 0 && *p == ',') break;
+            p++;
+        }
+        const char *end = p;
+        while (*start == ' ' || *start == '\t') start++;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (end > start) {
+            if (in->item_count >= capacity) {
+                capacity *= 2;
+                in->items = realloc(in->items, capacity * sizeof(PrintItem));
+            }
+            PrintItem *item = &in->items[in->item_count++];
+            item->is_literal = (end - start >= 2 && *start == '"' && end[-1] == '"');
+            item->text = item->is_literal ? g_strndup(start + 1, (gsize)(end - start - 2))
+                                          : g_strndup(start, (gsize)(end - start));
+            item->expr = item->is_literal ? NULL : compile_expr(item->text, fn);
+        }
+        if (*p == ',') p++;
+    }
+}
+
+// Recognise `name = rhs` (but not comparisons); returns 1 and fills the split parts
+int split_assignment(const char *s, char **name, char **rhs) {
+    const char *eq = strchr(s, '=');
+    if (!eq || eq == s || eq[1] == '=') return 0;
+    if (strchr("<>!=", eq[-1])) return 0;
+    const char *name_end = eq;
+    while (name_end > s && (name_end[-1] == ' ' || name_end[-1] == '\t')) name_end--;
+    for (const char *p = s; p < name_end; p++)
+        if (*p == ' ' || *p == '\t' || *p == '(' || *p == '.' || *p == '[') return 0;
+    const char *r = eq + 1;
+    while (*r == ' ' || *r == '\t') r++;
+    if (name_end == s || !*r) return 0;
+    *name = g_strndup(s, (gsize)(name_end - s));
+    *rhs = g_strdup(r);
+    return 1;
+}
+
+// Open control-flow block during compilation
+typedef struct {
+    BlockKind kind;
+    int line;
+    int pending_false;  // JUMP_IF_FALSE waiting for its target, -1 if none
+    int end_chain;      // linked list (through Instr.target) of jumps to the block end
+    int loop_start;     // first instruction of a while loop, first body instruction of a for loop
+} Block;
+
+static const char *block_names[] = { "if", "while", "for" };
+
+// Name of the hidden variable holding the bound of the for loop on line i
+static char* for_limit_name(int line) {
+    return g_strdup_printf("#for%d", line);
+}
+
+static void patch_chain(Program *prog, int chain, int target) {
+    while (chain != -1) {
+        int next = prog->code[chain].target;
+        prog->code[chain].target = target;
+        chain = next;
+    }
+}
+
+// Compile lines in the scope of fn (NULL for the top-level script)
+static Program* compile_lines(char **lines, int line_count, const Function *fn) {
+    Program *prog = calloc(1, sizeof(Program));
+    prog->lines = lines;
+    prog->line_count = line_count;
+
+    int block_cap = 16, depth = 0;
+    Block *blocks = malloc(block_cap * sizeof(Block));
+
+    for (int i = 0; i < line_count; i++) {
+        char *s = clean_line(lines[i]);
+        if (!*s || (s[0] == '#' && s[1] != '[')) { g_free(s); continue; }
+
+        if (starts_with_keyword(s, "if") || starts_with_keyword(s, "while")) {
+            if (depth >= block_cap) { block_cap *= 2; blocks = realloc(blocks, block_cap * sizeof(Block)); }
+            Block *b = &blocks[depth++];
+            b->kind = s[0] == 'i' ? BLOCK_IF : BLOCK_WHILE;
+            b->line = i;
+            b->end_chain = -1;
+            b->pending_false = emit(prog, OP_JUMP_IF_FALSE, i);
+            b->loop_start = b->pending_false;
+            prog->code[b->pending_false].a = g_strdup(skip_keyword(s, b->kind == BLOCK_IF ? "if" : "while"));
+            prog->code[b->pending_false].expr = compile_expr(prog->code[b->pending_false].a, fn);
+        } else if (starts_with_keyword(s, "for")) {
+            char *var, *start, *end;
+            if (!parse_for_header(s, &var, &start, &end)) {
+                ccrp_out_printf("Error: line %d: expected 'for NAME in START..END'\n", i + 1);
+            } else {
+                if (depth >= block_cap) { block_cap *= 2; blocks = realloc(blocks, block_cap * sizeof(Block)); }
+                Block *b = &blocks[depth++];
+                b->kind = BLOCK_FOR;
+                b->line = i;
+                b->end_chain = -1;
+                int j = emit(prog, OP_FOR_INIT, i);
+                Instr *in = &prog->code[j];
+                char *limit_name = for_limit_name(i);
+                Instr hidden;
+                resolve_target(&hidden, limit_name, fn);
+                in->limit_slot = hidden.slot;
+                g_free(limit_name);
+                in->a = var;
+                in->b = g_strdup(skip_word(skip_word(skip_word(s))));
+                resolve_target(in, var, fn);
+                in->expr = compile_expr(start, fn);
+                in->limit = compile_expr(end, fn);
+                g_free(start);
+                g_free(end);
+                b->pending_false = j;
+                b->loop_start = j + 1;
+            }
+        } else if (starts_with_word(s, "parallel")) {
+            // One statement: handle_parallel_for runs the body in worker VMs
+            int close = ccrp_parallel_end(lines, line_count, i);
+            if (close < 0) {
+                ccrp_out_printf("Error: line %d: 'parallel for' block is never closed\n", i + 1);
+            } else {
+                int j = emit(prog, OP_LINE, i);
+                prog->code[j].a = s;
+                s = NULL;
+                i = close;
+            }
+        } else if (starts_with_word(s, "else")) {
+            if (depth == 0 || blocks[depth - 1].kind != BLOCK_IF) {
+                ccrp_out_printf("Error: line %d: 'else' without 'if'\n", i + 1);
+            } else {
+                Block *b = &blocks[depth - 1];
+                int j = emit(prog, OP_JUMP, i);
+                prog->code[j].target = b->end_chain;
+                b->end_chain = j;
+                if (b->pending_false != -1) prog->code[b->pending_false].target = prog->count;
+                b->pending_false = -1;
+                // `else if cond` chains onto the same endif
+                const char *rest = skip_word(s);
+                if (starts_with_keyword(rest, "if")) {
+                    b->pending_false = emit(prog, OP_JUMP_IF_FALSE, i);
+                    prog->code[b->pending_false].a = g_strdup(skip_keyword(rest, "if"));
+                    prog->code[b->pending_false].expr = compile_expr(prog->code[b->pending_false].a, fn);
+                }
+            }
+        } else if (strcmp(s, "endif") == 0) {
+            if (depth == 0 || blocks[depth - 1].kind != BLOCK_IF) {
+                ccrp_out_printf("Error: line %d: 'endif' without 'if'\n", i + 1);
+            } else {
+                Block *b = &blocks[--depth];
+                if (b->pending_false != -1) prog->code[b->pending_false].target = prog->count;
+                patch_chain(prog, b->end_chain, prog->count);
+            }
+        } else if (strcmp(s, "endfor") == 0) {
+            if (depth == 0 || blocks[depth - 1].kind != BLOCK_FOR) {
+                ccrp_out_printf("Error: line %d: 'endfor' without 'for'\n", i + 1);
+            } else {
+                Block *b = &blocks[--depth];
+                int j = emit(prog, OP_FOR_NEXT, i);
+                Instr *init = &prog->code[b->pending_false];
+                prog->code[j].slot = init->slot;
+                prog->code[j].local = init->local;
+                prog->code[j].limit_slot = init->limit_slot;
+                prog->code[j].target = b->loop_start;
+                init->target = prog->count;
+            }
+        } else if (strcmp(s, "endwhile") == 0) {
+            if (depth == 0 || blocks[depth - 1].kind != BLOCK_WHILE) {
+                ccrp_out_printf("Error: line %d: 'endwhile' without 'while'\n", i + 1);
+            } else {
+                Block *b = &blocks[--depth];
+                int j = emit(prog, OP_JUMP, i);
+                prog->code[j].target = b->loop_start;
+                prog->code[b->pending_false].target = prog->count;
+            }
+        } else if (starts_with_word(s, "print")) {
+            int j = emit(prog, OP_PRINT, i);
+            compile_print_items(&prog->code[j], skip_word(s), fn);
+        } else if (starts_with_word(s, "return")) {
+            int j = emit(prog, OP_RETURN, i);
+            const char *value = skip_word(s);
+            if (*value) {
+                prog->code[j].b = g_strdup(value);
+                prog->code[j].expr = compile_expr(value, fn);
+            }
+        } else if (!fn && depth == 0 && (starts_with_word(s, "function") || starts_with_word(s, "fn") ||
+                                         strncmp(s, "#[", 2) == 0 || strncmp(s, "[src]", 5) == 0)) {
+            // Top-level declarations run now; run_line skips a definition's body
+            CcrpVM *vm = ccrp_vm;
+            vm->current_lines = lines;
+            vm->current_line_count = line_count;
+            vm->current_line_index = i;
+            run_line(lines[i]);
+            i = vm->current_line_index;
+        } else if (starts_with_word(s, "function") || starts_with_word(s, "fn") ||
+                   (starts_with_word(s, "style") && strchr(s, '{'))) {
+            // Block statements: run_line consumes the body, the VM skips past it
+            int j = emit(prog, OP_LINE, i);
+            prog->code[j].a = s;
+            s = NULL;
+            int close = find_block_close(lines, line_count, i);
+            if (close > i) i = close;
+        } else {
+            char *name = NULL, *rhs = NULL, *index = NULL;
+            int task_op = ccrp_task_parse(s, &name, &rhs);
+            if (task_op >= 0) {
+                int j = emit(prog, (OpCode)task_op, i);
+                prog->code[j].b = rhs;
+                prog->code[j].expr = compile_expr(rhs, fn);
+                if (name) {
+                    prog->code[j].a = name;
+                    prog->code[j].imm = 1;
+                    resolve_target(&prog->code[j], name, fn);
+                }
+            } else if (parse_index_assignment(s, &name, &index, &rhs)) {
+                int j = emit(prog, OP_STORE_INDEX, i);
+                prog->code[j].a = name;
+                prog->code[j].b = rhs;
+                resolve_target(&prog->code[j], name, fn);
+                prog->code[j].limit = compile_expr(index, fn);
+                prog->code[j].expr = compile_expr(rhs, fn);
+                g_free(index);
+            } else if (is_call_statement(s)) {
+                int j = emit(prog, OP_EVAL, i);
+                prog->code[j].expr = compile_expr(s, fn);
+            } else if (split_assignment(s, &name, &rhs)) {
+                int j = emit(prog, OP_ASSIGN, i);
+                prog->code[j].a = name;
+                prog->code[j].b = rhs;
+                resolve_target(&prog->code[j], name, fn);
+                prog->code[j].expr = compile_expr(rhs, fn);
+            } else if (strcmp(s, "{") != 0 && strcmp(s, "}") != 0) {
+                int j = emit(prog, OP_LINE, i);
+                prog->code[j].a = s;
+                s = NULL;
+            }
+        }
+        g_free(s);
+    }
+
+    while (depth > 0) {
+        Block *b = &blocks[--depth];
+        ccrp_out_printf("Error: line %d: '%s' block is never closed\n", b->line + 1, block_names[b->kind]);
+        if (b->pending_false != -1) prog->code[b->pending_false].target = prog->count;
+        patch_chain(prog, b->end_chain, prog->count);
+    }
+    emit(prog, OP_HALT, line_count);
+    free(blocks);
+    ccrp_optimize(prog);
+    return prog;
+}
+
+Program* ccrp_compile(char **lines, int line_count) {
+    Program *prog = compile_lines(lines, line_count, NULL);
+    ccrp_infer_types(prog);
+    return prog;
+}
+
+// Locals are the parameters followed by every name the body assigns to,
+// including for loop variables and their hidden bounds
+static void add_local(Function *fn, int *capacity, char *name) {
+    for (int k = 0; k < fn->local_count; k++) {
+        if (strcmp(fn->local_names[k], name) == 0) { g_free(name); return; }
+    }
+    if (fn->local_count >= *capacity) {
+        *capacity *= 2;
+        fn->local_names = realloc(fn->local_names, *capacity * sizeof(char*));
+    }
+    fn->local_names[fn->local_count++] = name;
+}
+
+static void collect_locals(Function *fn) {
+    int capacity = fn->param_count + 8;
+    fn->local_names = malloc(capacity * sizeof(char*));
+    fn->local_count = 0;
+    for (int i = 0; i < fn->param_count; i++) fn->local_names[fn->local_count++] = g_strdup(fn->params[i]);
+    for (int i = 0; i < fn->line_count; i++) {
+        char *s = clean_line(fn->lines[i]);
+        char *name = NULL, *rhs = NULL, *start = NULL;
+        if (split_assignment(s, &name, &rhs)) {
+            add_local(fn, &capacity, name);
+            g_free(rhs);
+        } else if (parse_for_header(s, &name, &start, &rhs)) {
+            add_local(fn, &capacity, name);
+            add_local(fn, &capacity, for_limit_name(i));
+            g_free(start);
+            g_free(rhs);
+        }
+        g_free(s);
+    }
+}
+
+Program* ccrp_compile_function(Function *fn) {
+    if (!fn->local_names) collect_locals(fn);
+    return compile_lines(fn->lines, fn->line_count, fn);
+}
+
+void ccrp_instr_free(Instr *in) {
+    g_free(in->a);
+    g_free(in->b);
+    ccrp_expr_free(in->expr);
+    ccrp_expr_free(in->limit);
+    for (int k = 0; k < in->item_count; k++) {
+        g_free(in->items[k].text);
+        ccrp_expr_free(in->items[k].expr);
+    }
+    free(in->items);
+}
+
+void ccrp_program_free(Program *prog) {
+    if (!prog) return;
+    for (int i = 0; i < prog->count; i++) ccrp_instr_free(&prog->code[i]);
+    free(prog->code);
+    free(prog);
+}
+
+// ------------------------ Call lowering ------------------------
+// Expressions that call user functions are rewritten into stack code before a
+// program first runs, so a call pushes an interpreter frame instead of
+// recursing through ccrp_expr_eval. Call-free subtrees stay as single OP_PUSH
+// trees, and `return f(args)` becomes OP_TAILCALL, which reuses the frame.
+static int has_user_call(const Expr *e) {
+    if (!e) return 0;
+    if (e->kind == EXPR_CALL && ccrp_call_target(e->name, e->arg_count)) return 1;
+    if (has_user_call(e->left) || has_user_call(e->right)) return 1;
+    for (int i = 0; i < e->arg_count; i++)
+        if (has_user_call(e->args[i])) return 1;
+    return 0;
+}
+
+// Emit code that leaves the value of e on the stack; takes ownership of e
+static void lower_expr(Program *out, Expr *e, int line) {
+    if (!has_user_call(e)) {
+        int j = emit(out, OP_PUSH, line);
+        out->code[j].expr = e;
+        return;
+    }
+    int j;
+    switch (e->kind) {
+        case EXPR_ARRAY:
+        case EXPR_MAP:
+        case EXPR_INDEX:
+        case EXPR_SLICE:
+            // evaluated as one tree; calls inside go through ccrp_call
+            j = emit(out, OP_PUSH, line);
+            out->code[j].expr = e;
+            return;
+        case EXPR_CALL: {
+            Function *fn = ccrp_call_target(e->name, e->arg_count);
+            for (int i = 0; i < e->arg_count; i++) { lower_expr(out, e->args[i], line); e->args[i] = NULL; }
+            j = emit(out, fn ? OP_CALL : OP_BUILTIN, line);
+            out->code[j].callee = fn;
+            out->code[j].imm = e->arg_count;
+            out->code[j].a = g_strdup(e->name);
+            break;
+        }
+        case EXPR_NEG:
+        case EXPR_NOT:
+            lower_expr(out, e->left, line);
+            j = emit(out, OP_UNARY, line);
+            out->code[j].imm = e->kind;
+            break;
+        default:
+            lower_expr(out, e->left, line);
+            if (e->op == BIN_AND || e->op == BIN_OR) {
+                j = emit(out, e->op == BIN_AND ? OP_AND_JUMP : OP_OR_JUMP, line);
+                lower_expr(out, e->right, line);
+                emit(out, OP_TRUTHY, line);
+                out->code[j].target = out->count;
+            } else {
+                lower_expr(out, e->right, line);
+                j = emit(out, OP_BINARY, line);
+                out->code[j].imm = e->op;
+            }
+            break;
+    }
+    e->left = e->right = NULL;
+    ccrp_expr_free(e);
+}
+
+static void append(Program *out, const Instr *in) {
+    int j = emit(out, in->op, in->line);
+    out->code[j] = *in;
+}
+
+// Print item by item so output interleaves with whatever the calls print
+static void lower_print(Program *out, Instr *in) {
+    for (int k = 0; k < in->item_count; k++) {
+        PrintItem *item = &in->items[k];
+        if (!item->is_literal && has_user_call(item->expr)) {
+            lower_expr(out, item->expr, in->line);
+            g_free(item->text);
+            emit(out, OP_PRINT_POP, in->line);
+        } else {
+            int j = emit(out, OP_PRINT, in->line);
+            out->code[j].items = malloc(sizeof(PrintItem));
+            out->code[j].items[0] = *item;
+            out->code[j].item_count = 1;
+            out->code[j].imm = 1;
+        }
+    }
+    emit(out, OP_PRINT, in->line); // the newline
+    free(in->items);
+    g_free(in->a);
+    g_free(in->b);
+}
+
+void ccrp_lower(Program *prog) {
+    prog->lowered = 1;
+    int n = prog->count, needed = 0;
+    for (int i = 0; i < n && !needed; i++) {
+        const Instr *in = &prog->code[i];
+        needed = has_user_call(in->expr) || has_user_call(in->limit);
+        for (int k = 0; k < in->item_count; k++)
+            if (!in->items[k].is_literal && has_user_call(in->items[k].expr)) needed = 1;
+    }
+    if (!needed) return;
+
+    Program out = { 0 };
+    int *new_index = malloc(((size_t)n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        Instr in = prog->code[i];
+        new_index[i] = out.count;
+        switch (in.op) {
+            case OP_ASSIGN:
+            case OP_ASSIGN_INT:
+                if (has_user_call(in.expr)) {
+                    lower_expr(&out, in.expr, in.line);
+                    in.expr = NULL;
+                    in.op = OP_STORE;
+                }
+                break;
+            case OP_STORE_INDEX:
+                if (has_user_call(in.expr) || has_user_call(in.limit)) {
+                    lower_expr(&out, in.limit, in.line);
+                    lower_expr(&out, in.expr, in.line);
+                    in.expr = in.limit = NULL;
+                    in.op = OP_STORE_INDEX_POP;
+                }
+                break;
+            case OP_EVAL:
+                if (has_user_call(in.expr)) {
+                    lower_expr(&out, in.expr, in.line);
+                    in.expr = NULL;
+                }
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_FALSE_INT:
+            case OP_CMP_JUMP_INT:
+                if (has_user_call(in.expr)) {
+                    lower_expr(&out, in.expr, in.line);
+                    in.expr = NULL;
+                    in.op = OP_JUMP_IF_FALSE_POP;
+                }
+                break;
+            case OP_RETURN:
+                if (!has_user_call(in.expr)) break;
+                if (in.expr->kind == EXPR_CALL && ccrp_call_target(in.expr->name, in.expr->arg_count)) {
+                    Expr *call = in.expr;
+                    for (int k = 0; k < call->arg_count; k++) { lower_expr(&out, call->args[k], in.line); call->args[k] = NULL; }
+                    in.op = OP_TAILCALL;
+                    in.callee = ccrp_call_target(call->name, call->arg_count);
+                    in.imm = call->arg_count;
+                    in.a = g_strdup(call->name);
+                    ccrp_expr_free(call);
+                } else {
+                    lower_expr(&out, in.expr, in.line);
+                    in.op = OP_RETURN_POP;
+                }
+                in.expr = NULL;
+                break;
+            case OP_FOR_INIT:
+                if (has_user_call(in.expr) || has_user_call(in.limit)) {
+                    lower_expr(&out, in.expr, in.line);
+                    lower_expr(&out, in.limit, in.line);
+                    in.expr = in.limit = NULL;
+                    in.imm = 1;
+                }
+                break;
+            case OP_PRINT: {
+                int calls = 0;
+                for (int k = 0; k < in.item_count; k++)
+                    if (!in.items[k].is_literal && has_user_call(in.items[k].expr)) calls = 1;
+                if (calls) { lower_print(&out, &in); continue; }
+                break;
+            }
+            default:
+                break;
+        }
+        append(&out, &in);
+    }
+    new_index[n] = out.count;
+
+    // Carried-over jumps still hold old indices; short-circuit jumps are already new
+    for (int i = 0; i < out.count; i++) {
+        Instr *in = &out.code[i];
+        switch (in->op) {
+            case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_FALSE_INT: case OP_CMP_JUMP_INT:
+            case OP_FOR_INIT: case OP_FOR_NEXT: case OP_JUMP_IF_FALSE_POP:
+                if (in->target >= 0) in->target = new_index[in->target];
+                break;
+            default:
+                break;
+        }
+    }
+    free(new_index);
+    free(prog->code);
+    prog->code = out.code;
+    prog->count = out.count;
+    prog->capacity = out.capacity;
+    prog->threaded = 0;
+}
+
+// ------------------------ Execution ------------------------
+// Calls never recurse on the C stack. Each call pushes a Frame, its locals
+// live on one growable Value stack and intermediate results of lowered
+// expressions on another, so recursion depth is bounded by memory
+// (MAX_STACK_DEPTH) rather than by the native stack. The stacks belong to the VM.
+typedef struct Frame {
+    Program *prog;
+    Function *fn;       // NULL for the script itself
+    Instr *resume;      // caller instruction to continue at
+    int locals_base;    // first local in local_stack
+} Frame;
+
+static void stack_push(CcrpVM *vm, Value v) {
+    if (vm->sp >= vm->stack_capacity) {
+        vm->stack_capacity = vm->stack_capacity ? vm->stack_capacity * 2 : 256;
+        vm->stack = realloc(vm->stack, vm->stack_capacity * sizeof(Value));
+    }
+    vm->stack[vm->sp++] = v;
+}
+
+static void stack_drop(CcrpVM *vm, int n) {
+    while (n-- > 0) value_release(vm->stack[--vm->sp]);
+}
+
+// Check a call of fn with arg_count arguments, printing why it cannot be made
+static int can_call(CcrpVM *vm, Function *fn, int arg_count) {
+    if (arg_count != fn->param_count) {
+        ccrp_out_printf("Error: %s expects %d argument(s), got %d.\n", fn->name, fn->param_count, arg_count);
+        return 0;
+    }
+    if (vm->frame_count >= MAX_STACK_DEPTH) {
+        ccrp_out_printf("Error: maximum call depth (%d) exceeded in %s.\n", MAX_STACK_DEPTH, fn->name);
+        return 0;
+    }
+    return 1;
+}
+
+// Push a frame for prog; fn's arguments are moved from the operand stack into its locals
+static void push_frame(CcrpVM *vm, Program *prog, Function *fn, Instr *resume) {
+    int local_count = fn ? fn->local_count : 0;
+    if (vm->local_top + local_count > vm->local_capacity) {
+        while (vm->local_top + local_count > vm->local_capacity)
+            vm->local_capacity = vm->local_capacity ? vm->local_capacity * 2 : 256;
+        vm->local_stack = realloc(vm->local_stack, vm->local_capacity * sizeof(Value));
+    }
+    if (vm->frame_count >= vm->frame_capacity) {
+        vm->frame_capacity = vm->frame_capacity ? vm->frame_capacity * 2 : 64;
+        vm->frames = realloc(vm->frames, vm->frame_capacity * sizeof(Frame));
+    }
+    int base = vm->local_top, arg_count = fn ? fn->param_count : 0;
+    if (arg_count) memcpy(vm->local_stack + base, vm->stack + vm->sp - arg_count, arg_count * sizeof(Value));
+    vm->sp -= arg_count;
+    for (int i = arg_count; i < local_count; i++) vm->local_stack[base + i] = value_int(0);
+    vm->local_top += local_count;
+    vm->frames[vm->frame_count++] = (Frame){ prog, fn, resume, base };
+    if (vm->profiling && fn) ccrp_profile_enter(fn);
+    vm->frame_locals = vm->local_stack + base;
+}
+
+void ccrp_stacks_free(CcrpVM *vm) {
+    free(vm->frames);
+    free(vm->local_stack);
+    free(vm->stack);
+    vm->frames = NULL;
+    vm->local_stack = vm->stack = NULL;
+    vm->frame_count = vm->frame_capacity = vm->local_top = vm->local_capacity = vm->sp = vm->stack_capacity = 0;
+}
+
+static void release_locals(CcrpVM *vm, int base) {
+    while (vm->local_top > base) value_release(vm->local_stack[--vm->local_top]);
+}
+
+// Operand of a fused int instruction: variables and literals are read directly
+static inline int64_t operand_int(const Expr *e) {
+    if (e->kind == EXPR_VAR) return value_as_int(CCRP_VAR(e->local, e->slot));
+    if (e->kind == EXPR_NUM) return e->value.as.i;
+    return ccrp_expr_eval_int(e);
+}
+
+static void print_items(const Instr *in) {
+    for (int k = 0; k < in->item_count; k++) {
+        const PrintItem *item = &in->items[k];
+        if (item->is_literal) ccrp_out_str(item->text);
+        else {
+            Value v = ccrp_expr_eval(item->expr);
+            value_print(v);
+            value_release(v);
+        }
+    }
+    if (!in->imm) ccrp_out_char('\n');
+}
+
+// Run the frame on top of the vm->stack until it returns, starting at resume
+// (NULL: the first instruction). A task's outermost run may instead suspend
+// at await or sleep, leaving its frames in place for ccrp_resume.
+static Value vm_run(Instr *resume) {
+    CcrpVM *vm = ccrp_vm;
+    int suspendable = vm->task_resumable;
+    vm->task_resumable = 0;
+    // a task's frames start at the bottom of its own stacks, also when it resumes further up
+    int entry = suspendable ? 0 : vm->frame_count - 1;
+    int base_sp = suspendable ? 0 : vm->sp;
+    char **saved_lines = vm->current_lines;
+    int saved_line_count = vm->current_line_count;
+    int saved_line_index = vm->current_line_index;
+    Program *prog;
+    Instr *code, *ip;
+    Value result;
+
+#if CCRP_THREADED
+    static const void *labels[OP_COUNT] = {
+        [OP_LINE] = &&do_line,
+        [OP_PRINT] = &&do_print,
+        [OP_ASSIGN] = &&do_assign,
+        [OP_ASSIGN_INT] = &&do_assign_int,
+        [OP_JUMP] = &&do_jump,
+        [OP_JUMP_IF_FALSE] = &&do_jump_if_false,
+        [OP_JUMP_IF_FALSE_INT] = &&do_jump_if_false_int,
+        [OP_CMP_JUMP_INT] = &&do_cmp_jump_int,
+        [OP_ADD_INT] = &&do_add_int,
+        [OP_FOR_INIT] = &&do_for_init,
+        [OP_FOR_NEXT] = &&do_for_next,
+        [OP_RETURN] = &&do_return,
+        [OP_HALT] = &&do_halt,
+        [OP_PUSH] = &&do_push,
+        [OP_CALL] = &&do_call,
+        [OP_TAILCALL] = &&do_tailcall,
+        [OP_BUILTIN] = &&do_builtin,
+        [OP_UNARY] = &&do_unary,
+        [OP_BINARY] = &&do_binary,
+        [OP_AND_JUMP] = &&do_and_jump,
+        [OP_OR_JUMP] = &&do_or_jump,
+        [OP_TRUTHY] = &&do_truthy,
+        [OP_STORE] = &&do_store,
+        [OP_JUMP_IF_FALSE_POP] = &&do_jump_if_false_pop,
+        [OP_PRINT_POP] = &&do_print_pop,
+        [OP_RETURN_POP] = &&do_return_pop,
+        [OP_STORE_INDEX] = &&do_store_index,
+        [OP_STORE_INDEX_POP] = &&do_store_index_pop,
+        [OP_EVAL] = &&do_eval,
+        [OP_SPAWN] = &&do_spawn,
+        [OP_AWAIT] = &&do_await,
+        [OP_SLEEP] = &&do_sleep,
+    };
+#define DISPATCH() goto *ip->handler
+#else
+#define DISPATCH() goto dispatch
+#endif
+    // Polled on back edges and calls, so every loop and recursion can be stopped
+#define CHECK_INTERRUPT() do { if (G_UNLIKELY(g_atomic_int_get(vm->interrupt))) goto interrupted; } while (0)
+
+    // Make the program of the top frame current; code is lowered and threaded on first use
+#define ENTER(resume_at) do { \
+        prog = vm->frames[vm->frame_count - 1].prog; \
+        if (!prog->lowered) ccrp_lower(prog); \
+        ENTER_THREAD(); \
+        code = prog->code; \
+        ip = (resume_at) ? (resume_at) : code; \
+        vm->current_lines = prog->lines; \
+        vm->current_line_count = prog->line_count; \
+    } while (0)
+#if CCRP_THREADED
+    // Under --profile every instruction is threaded to the profiling hook,
+    // which then jumps to the real handler; otherwise the hook costs nothing
+#define ENTER_THREAD() do { \
+        if (!prog->threaded) { \
+            for (int i = 0; i < prog->count; i++) \
+                prog->code[i].handler = vm->profiling ? &&do_profile : labels[prog->code[i].op]; \
+            prog->threaded = 1; \
+        } \
+    } while (0)
+#else
+#define ENTER_THREAD() do { } while (0)
+#endif
+
+    ENTER(resume);
+    DISPATCH();
+
+#if CCRP_THREADED
+do_profile:
+    ccrp_profile_line(vm->frames[vm->frame_count - 1].fn, prog->lines, prog->line_count, ip->line);
+    goto *labels[ip->op];
+#else
+dispatch:
+    if (vm->profiling) ccrp_profile_line(vm->frames[vm->frame_count - 1].fn, prog->lines, prog->line_count, ip->line);
+    switch (ip->op) {
+        case OP_LINE: goto do_line;
+        case OP_PRINT: goto do_print;
+        case OP_ASSIGN: goto do_assign;
+        case OP_ASSIGN_INT: goto do_assign_int;
+        case OP_JUMP: goto do_jump;
+        case OP_JUMP_IF_FALSE: goto do_jump_if_false;
+        case OP_JUMP_IF_FALSE_INT: goto do_jump_if_false_int;
+        case OP_CMP_JUMP_INT: goto do_cmp_jump_int;
+        case OP_ADD_INT: goto do_add_int;
+        case OP_FOR_INIT: goto do_for_init;
+        case OP_FOR_NEXT: goto do_for_next;
+        case OP_RETURN: goto do_return;
+        case OP_PUSH: goto do_push;
+        case OP_CALL: goto do_call;
+        case OP_TAILCALL: goto do_tailcall;
+        case OP_BUILTIN: goto do_builtin;
+        case OP_UNARY: goto do_unary;
+        case OP_BINARY: goto do_binary;
+        case OP_AND_JUMP: goto do_and_jump;
+        case OP_OR_JUMP: goto do_or_jump;
+        case OP_TRUTHY: goto do_truthy;
+        case OP_STORE: goto do_store;
+        case OP_JUMP_IF_FALSE_POP: goto do_jump_if_false_pop;
+        case OP_PRINT_POP: goto do_print_pop;
+        case OP_RETURN_POP: goto do_return_pop;
+        case OP_STORE_INDEX: goto do_store_index;
+        case OP_STORE_INDEX_POP: goto do_store_index_pop;
+        case OP_EVAL: goto do_eval;
+        case OP_SPAWN: goto do_spawn;
+        case OP_AWAIT: goto do_await;
+        case OP_SLEEP: goto do_sleep;
+        default: goto do_halt;
+    }
+#endif
+
+do_line:
+    vm->current_line_index = ip->line;
+    run_line(ip->a);
+    ip++;
+    DISPATCH();
+
+do_print:
+    print_items(ip);
+    ip++;
+    DISPATCH();
+
+do_assign:
+    ccrp_expr_assign(ip->expr, ip->local, ip->slot);
+    ip++;
+    DISPATCH();
+
+do_assign_int:
+    {
+        int64_t x = ccrp_expr_eval_int(ip->expr); // before taking the slot: a call may grow vars[]
+        value_assign(CCRP_VAR(ip->local, ip->slot), value_int(x));
+    }
+    ip++;
+    DISPATCH();
+
+do_jump:
+    CHECK_INTERRUPT();
+    ip = code + ip->target;
+    DISPATCH();
+
+do_jump_if_false:
+    {
+        Value c = ccrp_expr_eval(ip->expr);
+        int taken = value_truthy(c);
+        value_release(c);
+        ip = taken ? ip + 1 : code + ip->target;
+    }
+    DISPATCH();
+
+do_jump_if_false_int:
+    ip = ccrp_expr_eval_int(ip->expr) ? ip + 1 : code + ip->target;
+    DISPATCH();
+
+do_cmp_jump_int:
+    {
+        int64_t a = operand_int(ip->expr->left), b = operand_int(ip->expr->right);
+        int taken;
+        switch (ip->imm) {
+            case BIN_LT: taken = a < b; break;
+            case BIN_LE: taken = a <= b; break;
+            case BIN_GT: taken = a > b; break;
+            case BIN_GE: taken = a >= b; break;
+            case BIN_EQ: taken = a == b; break;
+            default: taken = a != b; break;
+        }
+        ip = taken ? ip + 1 : code + ip->target;
+    }
+    DISPATCH();
+
+do_add_int:
+    {
+        Value *v = CCRP_VAR(ip->local, ip->slot);
+        if (v->type == VAL_INT) v->as.i = (int64_t)((uint64_t)v->as.i + (uint64_t)ip->imm);
+        else value_assign(v, value_int((int64_t)((uint64_t)value_to_int(*v) + (uint64_t)ip->imm)));
+    }
+    ip++;
+    DISPATCH();
+
+do_for_init:
+    {
+        Value from, to;
+        if (ip->imm) { to = vm->stack[--vm->sp]; from = vm->stack[--vm->sp]; }
+        else { from = ccrp_expr_eval(ip->expr); to = ccrp_expr_eval(ip->limit); }
+        int64_t a = value_to_int(from), b = value_to_int(to);
+        value_release(from);
+        value_release(to);
+        value_assign(CCRP_VAR(ip->local, ip->limit_slot), value_int(b));
+        value_assign(CCRP_VAR(ip->local, ip->slot), value_int(a));
+        ip = a < b ? ip + 1 : code + ip->target;
+    }
+    DISPATCH();
+
+do_for_next:
+    {
+        // the body may have stored a non-int into the loop variable
+        Value *v = CCRP_VAR(ip->local, ip->slot);
+        int64_t next;
+        if (v->type == VAL_INT) next = v->as.i = (int64_t)((uint64_t)v->as.i + 1);
+        else { next = value_to_int(*v) + 1; value_assign(v, value_int(next)); }
+        ip = next < CCRP_VAR(ip->local, ip->limit_slot)->as.i ? code + ip->target : ip + 1;
+    }
+    CHECK_INTERRUPT();
+    DISPATCH();
+
+do_push:
+    stack_push(vm, ccrp_expr_eval(ip->expr));
+    ip++;
+    DISPATCH();
+
+do_call:
+    CHECK_INTERRUPT();
+    if (!can_call(vm, ip->callee, (int)ip->imm)) {
+        stack_drop(vm, (int)ip->imm);
+        stack_push(vm, value_int(0));
+        ip++;
+        DISPATCH();
+    }
+    if (!ip->callee->program) ip->callee->program = ccrp_compile_function(ip->callee);
+    push_frame(vm, ip->callee->program, ip->callee, ip + 1);
+    ENTER(NULL);
+    DISPATCH();
+
+do_tailcall:
+    CHECK_INTERRUPT();
+    {
+        Function *fn = ip->callee;
+        if (!can_call(vm, fn, (int)ip->imm)) {
+            stack_drop(vm, (int)ip->imm);
+            result = value_int(0);
+            goto leave;
+        }
+        if (!fn->program) fn->program = ccrp_compile_function(fn);
+        // the arguments are already on the operand stack, so the frame can go
+        Frame f = vm->frames[--vm->frame_count];
+        release_locals(vm, f.locals_base);
+        if (vm->profiling && f.fn) ccrp_profile_leave();
+        push_frame(vm, fn->program, fn, f.resume);
+        ENTER(NULL);
+    }
+    DISPATCH();
+
+do_builtin:
+    {
+        int n = (int)ip->imm;
+        vm->sp -= n;
+        if (!ip->builtin) ip->builtin = ccrp_builtin_resolve(ip->a, n);
+        Value v = ip->builtin ? ip->builtin->fn(vm->stack + vm->sp) : value_int(0);
+        for (int i = 0; i < n; i++) value_release(vm->stack[vm->sp + i]);
+        stack_push(vm, v);
+    }
+    ip++;
+    DISPATCH();
+
+do_unary:
+    vm->stack[vm->sp - 1] = ccrp_apply_unary((ExprKind)ip->imm, vm->stack[vm->sp - 1]);
+    ip++;
+    DISPATCH();
+
+do_binary:
+    vm->sp--;
+    vm->stack[vm->sp - 1] = ccrp_apply_binary((int)ip->imm, vm->stack[vm->sp - 1], vm->stack[vm->sp]);
+    ip++;
+    DISPATCH();
+
+do_and_jump:
+    if (!value_truthy(vm->stack[vm->sp - 1])) {
+        value_assign(&vm->stack[vm->sp - 1], value_int(0));
+        ip = code + ip->target;
+    } else {
+        stack_drop(vm, 1);
+        ip++;
+    }
+    DISPATCH();
+
+do_or_jump:
+    if (value_truthy(vm->stack[vm->sp - 1])) {
+        value_assign(&vm->stack[vm->sp - 1], value_int(1));
+        ip = code + ip->target;
+    } else {
+        stack_drop(vm, 1);
+        ip++;
+    }
+    DISPATCH();
+
+do_truthy:
+    value_assign(&vm->stack[vm->sp - 1], value_int(value_truthy(vm->stack[vm->sp - 1])));
+    ip++;
+    DISPATCH();
+
+do_store:
+    value_assign(CCRP_VAR(ip->local, ip->slot), vm->stack[--vm->sp]);
+    ip++;
+    DISPATCH();
+
+do_jump_if_false_pop:
+    {
+        Value c = vm->stack[--vm->sp];
+        int taken = value_truthy(c);
+        value_release(c);
+        ip = taken ? ip + 1 : code + ip->target;
+    }
+    DISPATCH();
+
+do_print_pop:
+    {
+        Value v = vm->stack[--vm->sp];
+        value_print(v);
+        value_release(v);
+    }
+    ip++;
+    DISPATCH();
+
+do_store_index:
+    {
+        Value x = ccrp_expr_eval(ip->limit), v = ccrp_expr_eval(ip->expr);
+        ccrp_index_store(CCRP_VAR(ip->local, ip->slot), ip->a, x, v); // slot taken after the calls above
+        value_release(x);
+        value_release(v);
+    }
+    ip++;
+    DISPATCH();
+
+do_store_index_pop:
+    {
+        Value v = vm->stack[--vm->sp], x = vm->stack[--vm->sp];
+        ccrp_index_store(CCRP_VAR(ip->local, ip->slot), ip->a, x, v);
+        value_release(x);
+        value_release(v);
+    }
+    ip++;
+    DISPATCH();
+
+do_eval:
+    value_release(ip->expr ? ccrp_expr_eval(ip->expr) : vm->stack[--vm->sp]);
+    ip++;
+    DISPATCH();
+
+do_spawn:
+    {
+        Value t = ccrp_spawn(ip->expr);
+        if (ip->imm) value_assign(CCRP_VAR(ip->local, ip->slot), t);
+    }
+    ip++;
+    DISPATCH();
+
+do_await:
+    {
+        Value t = ccrp_expr_eval(ip->expr), v;
+        int suspended = ccrp_await(t, &v, suspendable ? ip : NULL); // runs again when resumed
+        value_release(t);
+        if (suspended) goto suspend;
+        if (ip->imm) value_assign(CCRP_VAR(ip->local, ip->slot), v);
+        else value_release(v);
+    }
+    ip++;
+    DISPATCH();
+
+do_sleep:
+    {
+        Value ms = ccrp_expr_eval(ip->expr);
+        int suspended = ccrp_sleep(value_to_int(ms), suspendable ? ip + 1 : NULL);
+        value_release(ms);
+        if (suspended) goto suspend;
+    }
+    ip++;
+    DISPATCH();
+
+interrupted:
+    // ccrp_vm_interrupt: drop this run's frames and pending values; an
+    // enclosing run stops at its own next check
+    while (vm->frame_count > entry) {
+        Frame f = vm->frames[--vm->frame_count];
+        release_locals(vm, f.locals_base);
+        if (vm->profiling && f.fn) ccrp_profile_leave();
+    }
+    stack_drop(vm, vm->sp - base_sp);
+    vm->frame_locals = vm->frame_count > 0 ? vm->local_stack + vm->frames[vm->frame_count - 1].locals_base : NULL;
+    vm->current_lines = saved_lines;
+    vm->current_line_count = saved_line_count;
+    vm->current_line_index = saved_line_index;
+    return value_int(0);
+
+suspend:
+    // the frames stay on the task's stacks until the scheduler resumes it
+    vm->current_lines = saved_lines;
+    vm->current_line_count = saved_line_count;
+    vm->current_line_index = saved_line_index;
+    return value_int(0);
+
+do_return:
+    result = ccrp_expr_eval(ip->expr);
+    goto leave;
+
+do_return_pop:
+    result = vm->stack[--vm->sp];
+    goto leave;
+
+do_halt:
+    result = value_int(0);
+    goto leave;
+
+leave:
+    {
+        Frame f = vm->frames[--vm->frame_count];
+        release_locals(vm, f.locals_base);
+        if (vm->profiling && f.fn) ccrp_profile_leave();
+        vm->frame_locals = vm->frame_count > 0 ? vm->local_stack + vm->frames[vm->frame_count - 1].locals_base : NULL;
+        if (vm->frame_count == entry) {
+            vm->current_lines = saved_lines;
+            vm->current_line_count = saved_line_count;
+            vm->current_line_index = saved_line_index;
+            return result;
+        }
+        stack_push(vm, result);
+        ENTER(f.resume);
+    }
+    DISPATCH();
+#undef ENTER
+#undef ENTER_THREAD
+#undef DISPATCH
+#undef CHECK_INTERRUPT
+}
+
+Value ccrp_execute(Program *prog) {
+    CcrpVM *vm = ccrp_vm;
+    push_frame(vm, prog, NULL, NULL);
+    return vm_run(NULL);
+}
+
+// Continue the frames on the stacks at resume (NULL: start the top frame)
+Value ccrp_resume(Instr *resume) {
+    return vm_run(resume);
+}
+
+// Function whose code is running, NULL at the top level of the script
+Function* ccrp_current_function(void) {
+    CcrpVM *vm = ccrp_vm;
+    return vm->frame_count > 0 ? vm->frames[vm->frame_count - 1].fn : NULL;
+}
+
+// ------------------------ Calls ------------------------
+// Push a frame calling fn with args (borrowed) for vm_run to start; 0 if the call cannot be made
+int ccrp_push_call(Function *fn, const Value *args, int arg_count) {
+    CcrpVM *vm = ccrp_vm;
+    if (!can_call(vm, fn, arg_count)) return 0;
+    if (!fn->program) fn->program = ccrp_compile_function(fn);
+    for (int i = 0; i < arg_count; i++) stack_push(vm, value_retain(args[i]));
+    push_frame(vm, fn->program, fn, NULL);
+    return 1;
+}
+
+// Entry from C (eval_call, run_line, the tree-walker). Calls made by the
+// called function stay inside the same vm_run; only these entries nest.
+Value ccrp_call(Function *fn, const Value *args, int arg_count) {
+    CcrpVM *vm = ccrp_vm;
+    if (vm->native_depth >= MAX_NATIVE_DEPTH) {
+        ccrp_out_printf("Error: maximum nested call depth (%d) exceeded in %s.\n", MAX_NATIVE_DEPTH, fn->name);
+        return value_int(0);
+    }
+    if (!ccrp_push_call(fn, args, arg_count)) return value_int(0);
+    vm->native_depth++;
+    Value result = vm_run(NULL);
+    vm->native_depth--;
+    return result;
+}
+
+Value call_function(const char *name, char **args, int arg_count) {
+    Function *fn = get_function(name);
+    if (!fn) {
+        ccrp_out_printf("Error: Unknown function '%s'.\n", name);
+        return value_int(0);
+    }
+    Value small[8] = { { 0 } };
+    Value *values = arg_count <= 8 ? small : malloc(arg_count * sizeof(Value));
+    for (int i = 0; i < arg_count; i++) values[i] = eval_value_at(args[i], -1);
+    Value result = ccrp_call(fn, values, arg_count);
+    for (int i = 0; i < arg_count; i++) value_release(values[i]);
+    if (values != small) free(values);
+    return result;
+}
+
+void interpret_vm_source(char **lines, int line_count) {
+    CcrpVM *vm = ccrp_vm;
+    memset(&vm->control_state, 0, sizeof(vm->control_state));
+    Program *prog = ccrp_compile(lines, line_count);
+    vm->task_resumable = 1; // the script is task 0: it may suspend at await or sleep
+    value_release(ccrp_execute(prog));
+    ccrp_tasks_finish();
+    ccrp_program_free(prog);
+    vm->current_lines = NULL; vm->current_line_count = 0;
+}
+
+void interpret_vm(const gchar *code) {
+    int line_count; char **lines = split_lines(code, &line_count);
+    interpret_vm_source(lines, line_count);
+    free_lines(lines, line_count);
+}
+
+// Compile without running and list the optimized program and every function
+void dump_optimized_source(char **lines, int line_count) {
+    CcrpVM *vm = ccrp_vm;
+    memset(&vm->control_state, 0, sizeof(vm->control_state));
+    Program *prog = ccrp_compile(lines, line_count);
+    ccrp_lower(prog);
+    ccrp_out_flush(); // compile errors come before the listing
+    ccrp_program_dump(prog, "main", stdout);
+    // library functions the script never looked up have no record yet and are not listed
+    for (int i = 0; i < vm->function_count; i++) {
+        Function *fn = vm->functions[i];
+        if (!fn->program) fn->program = ccrp_compile_function(fn);
+        if (!fn->program->lowered) ccrp_lower(fn->program);
+        ccrp_out_flush();
+        printf("\n");
+        ccrp_program_dump(fn->program, fn->name, stdout);
+    }
+    ccrp_program_free(prog);
+    vm->current_lines = NULL; vm->current_line_count = 0;
+}
+
+void dump_optimized_vm(const gchar *code) {
+    int line_count; char **lines = split_lines(code, &line_count);
+    dump_optimized_source(lines, line_count);
+    free_lines(lines, line_count);
+}
@@ -1,40 +1,61 @@
 #include "ccrp.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static int usage(const char *prog) {
+    printf("Usage: %s [--vm | --dump-optimized] [--output FILE] [--buffer-size BYTES]\n"
+           "          [--profile] [--profile-output PREFIX] <filename.crp | ->\n", prog);
+    return 1;
+}
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("Usage: %s <filename.crp>\n", argv[0]);
-        return 1;
+    int use_vm = 0, dump = 0, profile = 0;
+    const char *path = NULL, *output = NULL, *profile_output = NULL;
+    size_t buffer_size = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--vm") == 0) use_vm = 1;
+        else if (strcmp(argv[i], "--dump-optimized") == 0) dump = 1;
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0) profile = 1;
+        else if (strcmp(argv[i], "--profile-output") == 0 && i + 1 < argc) { profile = 1; profile_output = argv[++i]; }
+        else if (strcmp(argv[i], "--buffer-size") == 0 && i + 1 < argc) {
+            char *end;
+            long long n = strtoll(argv[++i], &end, 10);
+            if (*end || n <= 0) return usage(argv[0]);
+            buffer_size = (size_t)n;
+        }
+        else if ((argv[i][0] == '-' && argv[i][1]) || path) return usage(argv[0]);
+        else path = argv[i];
     }
-    
-    // Read the file
-    FILE *f = fopen(argv[1], "r");
-    if (!f) {
-        printf("Error: Could not open file %s\n", argv[1]);
-        return 1;
+    if (!path) return usage(argv[0]);
+
+    CcrpVM *vm = ccrp_vm_new();
+
+    // Script output: buffered stdout, or write(2) straight to a file
+    if (output) {
+        if (!ccrp_output_open(vm, output, buffer_size)) {
+            printf("Error: Could not open output file %s\n", output);
+            return 1;
+        }
+    } else {
+        ccrp_output_init(vm, 1, buffer_size);
     }
-    
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    // Allocate buffer and read file
-    char *code = malloc(file_size + 1);
-    if (!code) {
-        printf("Error: Memory allocation failed\n");
-        fclose(f);
+
+    // Map the file, or stream the script from stdin when the path is "-"
+    Source *src = strcmp(path, "-") == 0 ? ccrp_source_read(0) : ccrp_source_open(path);
+    if (!src) {
+        printf("Error: Could not open file %s\n", path);
         return 1;
     }
-    
-    size_t bytes_read = fread(code, 1, file_size, f);
-    code[bytes_read] = '\0';
-    fclose(f);
-    
-    // Interpret the code
-    interpret(code);
-    
-    free(code);
+
+    // Interpret the code: bytecode VM or the line-by-line tree-walker.
+    // --profile writes PREFIX.txt and PREFIX.folded (default ccrp-profile).
+    if (profile && !dump) ccrp_profile_start(vm, strcmp(path, "-") == 0 ? "stdin" : path, profile_output);
+    ccrp_vm_run(vm, src->lines, src->line_count, dump ? CCRP_RUN_DUMP : use_vm ? CCRP_RUN_BYTECODE : CCRP_RUN_TREE);
+
+    ccrp_profile_finish(); // the report quotes the script's lines, so before they are freed
+    ccrp_vm_free(vm);
+    ccrp_source_free(src);
     return 0;
-} 
\ No newline at end of file
+}
@@ -5,9 +5,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include <unistd.h>
+#include "ccrp.h"
 
-// Minimal Cryptic IDE: one editor, open/save, run in external terminal using cride_interpreter
+// Minimal Cryptic IDE: one editor, open/save, run in-process with an output pane
 
 typedef enum {
 	COL_DISPLAY = 0,
@@ -16,6 +18,8 @@ typedef enum {
 	COL_COUNT
 } TreeCols;
 
+typedef struct RunJob RunJob;
+
 typedef struct {
 	GtkWidget *window;
 	GtkWidget *header;
@@ -23,6 +27,7 @@ typedef struct {
 	GtkWidget *open_folder_button;
 	GtkWidget *save_button;
 	GtkWidget *run_button;
+	GtkWidget *stop_button;
 	GtkWidget *pick_interp_button;
 	GtkWidget *scroller;
 	GtkSourceView *source_view;
@@ -36,6 +41,16 @@ typedef struct {
 	GtkTreeStore *store;
 	GtkWidget *tree;
 	gchar *root_dir;
+	// Output pane and the running script
+	GtkWidget *editor_paned;
+	GtkWidget *output_view;
+	GtkTextBuffer *output_buffer;
+	GtkTextMark *output_end;
+	RunJob *job; // NULL when nothing runs
+	guint drain_id;
+	// Diagnostics of the editor buffer
+	CcrpChecker *checker;
+	guint check_id;
 } App;
 
 static void status(App *app, const gchar *fmt, ...) {
@@ -201,83 +216,389 @@ static void on_save(GtkButton *btn, gpointer user_data) {
 	g_free(path);
 }
 
-static gboolean launch_in_terminal(const gchar *cmdline) {
-	// Try common terminals
-	const gchar *templates[] = {
-		"gnome-terminal -- bash -lc '%s; echo; echo Press Enter to close; read'",
-		"xterm -e bash -lc '%s; echo; echo Press Enter to close; read'",
-		"konsole -e bash -lc '%s; echo; echo Press Enter to close; read'",
-		NULL
-	};
-
-	for (int i = 0; templates[i]; i++) {
-		gchar *full = g_strdup_printf(templates[i], cmdline);
-		int rc = system(full);
-		g_free(full);
-		if (rc == 0) return TRUE;
+// ------------------------ Running scripts ------------------------
+// Run executes the buffer in-process: a worker thread gets a VM of its own and
+// the text straight from the editor. The VM's output sink copies into a ring
+// buffer that the GTK thread drains into the output pane every DRAIN_MS, and
+// neither side takes a lock to hand bytes over. Stop interrupts the VM.
+#define RING_SIZE (256 * 1024) // a power of two
+#define DRAIN_MS 30
+#define OUTPUT_MAX_LINES 10000 // the pane keeps the most recent lines
+
+typedef struct {
+	char data[RING_SIZE];
+	volatile gint head; // bytes ever written, stored only by the producer
+	volatile gint tail; // bytes ever read, stored only by the consumer
+} Ring;
+
+struct RunJob {
+	Ring ring;
+	GMutex write_lock; // parallel for workers print from several threads
+	volatile gint stop;
+	volatile gint done;
+	CcrpVM *vm;
+	GMainContext *context; // the worker's thread-default context: sleep and tasks wait on it
+	gchar *text;
+	GThread *thread;
+	gint64 started;
+	GString *pending; // output not shown yet: a UTF-8 sequence split between drains
+};
+
+static void ring_write(RunJob *job, const char *data, size_t len) {
+	Ring *r = &job->ring;
+	while (len > 0) {
+		guint head = (guint)g_atomic_int_get(&r->head);
+		guint space = RING_SIZE - (head - (guint)g_atomic_int_get(&r->tail));
+		if (space == 0) {
+			if (g_atomic_int_get(&job->stop)) return; // stopping: drop the rest
+			g_usleep(1000); // the pane is behind; wait for the next drain
+			continue;
+		}
+		guint n = len < space ? (guint)len : space;
+		guint at = head & (RING_SIZE - 1), first = MIN(n, RING_SIZE - at);
+		memcpy(r->data + at, data, first);
+		memcpy(r->data, data + first, n - first);
+		g_atomic_int_set(&r->head, (gint)(head + n)); // publishes the bytes
+		data += n;
+		len -= n;
 	}
-	return FALSE;
 }
 
-static void on_run(GtkButton *btn, gpointer user_data) {
+static gsize ring_read(Ring *r, char *out, gsize max) {
+	guint tail = (guint)g_atomic_int_get(&r->tail);
+	guint n = (guint)g_atomic_int_get(&r->head) - tail;
+	if (n > max) n = (guint)max;
+	guint at = tail & (RING_SIZE - 1), first = MIN(n, RING_SIZE - at);
+	memcpy(out, r->data + at, first);
+	memcpy(out + first, r->data, n - first);
+	g_atomic_int_set(&r->tail, (gint)(tail + n)); // frees the space
+	return n;
+}
+
+// Output sink of the script's VM (worker threads)
+static void run_output(const char *data, size_t length, void *user_data) {
+	RunJob *job = (RunJob *)user_data;
+	g_mutex_lock(&job->write_lock);
+	ring_write(job, data, length);
+	g_mutex_unlock(&job->write_lock);
+}
+
+static gpointer run_thread(gpointer user_data) {
+	RunJob *job = (RunJob *)user_data;
+	g_main_context_push_thread_default(job->context);
+	int line_count;
+	char **lines = split_lines(job->text, &line_count);
+	ccrp_vm_run(job->vm, lines, line_count, CCRP_RUN_BYTECODE);
+	free_lines(lines, line_count);
+	g_main_context_pop_thread_default(job->context);
+	g_atomic_int_set(&job->done, 1);
+	return NULL;
+}
+
+// Append script output to the pane, holding back a UTF-8 sequence cut off at
+// the end; other invalid bytes are shown as replacement characters
+static void append_output(App *app, const char *data, gsize len, gboolean last) {
+	GString *pending = app->job->pending;
+	g_string_append_len(pending, data, (gssize)len);
+	const gchar *end = NULL;
+	gsize keep = 0;
+	if (!last && !g_utf8_validate(pending->str, (gssize)pending->len, &end)) {
+		gsize tail = pending->len - (gsize)(end - pending->str);
+		if (tail < 4 && g_utf8_get_char_validated(end, (gssize)tail) == (gunichar)-2) keep = tail;
+	}
+	if (pending->len == keep) return;
+	gchar *valid = g_utf8_make_valid(pending->str, (gssize)(pending->len - keep));
+	GtkTextIter iter;
+	gtk_text_buffer_get_end_iter(app->output_buffer, &iter);
+	gtk_text_buffer_insert(app->output_buffer, &iter, valid, -1);
+	g_free(valid);
+	g_string_erase(pending, 0, (gssize)(pending->len - keep));
+
+	int extra = gtk_text_buffer_get_line_count(app->output_buffer) - OUTPUT_MAX_LINES;
+	if (extra > 0) {
+		GtkTextIter from, to;
+		gtk_text_buffer_get_start_iter(app->output_buffer, &from);
+		gtk_text_buffer_get_iter_at_line(app->output_buffer, &to, extra);
+		gtk_text_buffer_delete(app->output_buffer, &from, &to);
+	}
+	gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(app->output_view), app->output_end);
+}
+
+static void finish_run(App *app) {
+	RunJob *job = app->job;
+	g_thread_join(job->thread);
+	append_output(app, "", 0, TRUE);
+	double ms = (double)(g_get_monotonic_time() - job->started) / 1000.0;
+	if (g_atomic_int_get(&job->stop)) status(app, "Stopped after %.0f ms", ms);
+	else status(app, "Finished in %.1f ms", ms);
+	ccrp_vm_free(job->vm);
+	g_main_context_unref(job->context);
+	g_mutex_clear(&job->write_lock);
+	g_string_free(job->pending, TRUE);
+	g_free(job->text);
+	g_free(job);
+	app->job = NULL;
+	app->drain_id = 0;
+	gtk_widget_set_sensitive(app->run_button, TRUE);
+	gtk_widget_set_sensitive(app->stop_button, FALSE);
+}
+
+// Timer on the GTK thread: move what the script printed into the pane
+static gboolean drain_output(gpointer user_data) {
 	App *app = (App *)user_data;
+	RunJob *job = app->job;
+	gboolean done = g_atomic_int_get(&job->done); // before reading: all its output is in the ring then
+	char chunk[16384];
+	gsize n, total = 0;
+	while (total < RING_SIZE && (n = ring_read(&job->ring, chunk, sizeof(chunk))) > 0) {
+		append_output(app, chunk, n, FALSE);
+		total += n;
+	}
+	if (!done || g_atomic_int_get(&job->ring.head) != g_atomic_int_get(&job->ring.tail)) return G_SOURCE_CONTINUE;
+	finish_run(app);
+	return G_SOURCE_REMOVE;
+}
+
+// Interpreter for scripts run outside the IDE: user-selected, APPDIR/usr/bin, local ./, or PATH
+static gchar *interpreter_path(App *app) {
+	if (app->interp_path && g_file_test(app->interp_path, G_FILE_TEST_IS_EXECUTABLE)) {
+		return g_strdup(app->interp_path);
+	}
+	const gchar *appdir = g_getenv("APPDIR");
+	if (appdir) return g_build_filename(appdir, "usr", "bin", "cride_interpreter", NULL);
+	if (g_file_test("./cride_interpreter", G_FILE_TEST_IS_EXECUTABLE)) return g_strdup("./cride_interpreter");
+	return g_strdup("cride_interpreter");
+}
 
-	// Ensure we have content saved to a temp file
+// GTK scripts open windows of their own, which needs a main thread: they run
+// in the interpreter, which reads the buffer from a pipe
+static void run_external(App *app, const gchar *text) {
+	gchar *interp = interpreter_path(app);
+	gchar *argv[] = { interp, "-", NULL };
+	GPid pid;
+	gint in_fd = -1;
 	GError *err = NULL;
-	gint fd = -1;
-	gchar *tmp_path = NULL;
-	fd = g_file_open_tmp("ccrp_temp_XXXXXX.crp", &tmp_path, &err);
-	if (fd == -1 || tmp_path == NULL) {
-		status(app, "Temp file error: %s", err ? err->message : "unknown");
+	if (!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, &pid, &in_fd, NULL, NULL, &err)) {
+		status(app, "Could not start %s: %s", interp, err ? err->message : "unknown error");
 		if (err) g_error_free(err);
+		g_free(interp);
 		return;
 	}
-	close(fd);
+	gsize left = strlen(text);
+	while (left > 0) {
+		ssize_t n = write(in_fd, text, left);
+		if (n <= 0) break;
+		text += n;
+		left -= (gsize)n;
+	}
+	close(in_fd);
+	g_spawn_close_pid(pid);
+	status(app, "Started GTK script in %s", interp);
+	g_free(interp);
+}
+
+static void on_run(GtkButton *btn, gpointer user_data) {
+	App *app = (App *)user_data;
+	if (app->job) return;
 
-	// Write current buffer into tmp_path
 	GtkTextIter start, end;
 	gtk_text_buffer_get_start_iter(GTK_TEXT_BUFFER(app->source_buffer), &start);
 	gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(app->source_buffer), &end);
 	gchar *text = gtk_text_buffer_get_text(GTK_TEXT_BUFFER(app->source_buffer), &start, &end, FALSE);
-	if (!g_file_set_contents(tmp_path, text, -1, &err)) {
-		status(app, "Write temp failed: %s", err ? err->message : "unknown");
-		if (err) g_error_free(err);
+	if (strstr(text, "#[gtk]") || strstr(text, "#[use gtk]")) {
+		run_external(app, text);
 		g_free(text);
-		g_free(tmp_path);
 		return;
 	}
-	g_free(text);
 
-	// Resolve interpreter path: user-selected, APPDIR/usr/bin, local ./, or PATH
-	gchar *interp = NULL;
-	if (app->interp_path && g_file_test(app->interp_path, G_FILE_TEST_IS_EXECUTABLE)) {
-		interp = g_strdup(app->interp_path);
-	} else {
-		const gchar *appdir = g_getenv("APPDIR");
-		if (appdir) {
-			interp = g_build_filename(appdir, "usr", "bin", "cride_interpreter", NULL);
-		} else if (g_file_test("./cride_interpreter", G_FILE_TEST_IS_EXECUTABLE)) {
-			interp = g_strdup("./cride_interpreter");
-		} else {
-			interp = g_strdup("cride_interpreter");
-		}
+	gtk_text_buffer_set_text(app->output_buffer, "", 0);
+	RunJob *job = g_new0(RunJob, 1);
+	g_mutex_init(&job->write_lock);
+	job->text = text;
+	job->pending = g_string_new(NULL);
+	job->context = g_main_context_new();
+	job->vm = ccrp_vm_new();
+	ccrp_output_sink(job->vm, run_output, job, 0);
+	job->started = g_get_monotonic_time();
+	app->job = job;
+	job->thread = g_thread_new("ccrp-run", run_thread, job);
+	app->drain_id = g_timeout_add(DRAIN_MS, drain_output, app);
+	gtk_widget_set_sensitive(app->run_button, FALSE);
+	gtk_widget_set_sensitive(app->stop_button, TRUE);
+	status(app, "Running…");
+}
+
+static void stop_job(RunJob *job) {
+	g_atomic_int_set(&job->stop, 1);
+	ccrp_vm_interrupt(job->vm);
+	g_main_context_wakeup(job->context); // a sleeping script notices at once
+}
+
+static void on_stop(GtkButton *btn, gpointer user_data) {
+	App *app = (App *)user_data;
+	if (!app->job) return;
+	stop_job(app->job);
+	status(app, "Stopping…");
+}
+
+// ------------------------ Script input ------------------------
+// input / input_text while a script runs: the worker asks on the GTK thread
+// with a dialog and waits for the answer
+typedef struct {
+	const char *prompt;
+	char *answer; // malloc'd: the interpreter frees it
+	gboolean answered;
+	GMutex lock;
+	GCond cond;
+} InputRequest;
+
+static GtkWindow *input_parent;
+
+static gboolean ask_input(gpointer user_data) {
+	InputRequest *req = (InputRequest *)user_data;
+	GtkWidget *dialog = gtk_dialog_new_with_buttons("Input", input_parent,
+		GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+		"_Cancel", GTK_RESPONSE_CANCEL,
+		"_OK", GTK_RESPONSE_ACCEPT,
+		NULL);
+	GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+	GtkWidget *entry = gtk_entry_new();
+	gtk_entry_set_activates_default(GTK_ENTRY(entry), TRUE);
+	gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+	gtk_container_add(GTK_CONTAINER(content), gtk_label_new(req->prompt));
+	gtk_container_add(GTK_CONTAINER(content), entry);
+	gtk_widget_show_all(dialog);
+
+	char *answer = NULL;
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+		const gchar *t = gtk_entry_get_text(GTK_ENTRY(entry));
+		size_t n = strlen(t) + 1;
+		answer = malloc(n);
+		memcpy(answer, t, n);
 	}
+	gtk_widget_destroy(dialog);
 
-	gchar *q_interp = g_shell_quote(interp);
-	gchar *q_tmp = g_shell_quote(tmp_path);
-	gchar *cmdline = g_strdup_printf("%s %s", q_interp, q_tmp);
-	g_free(q_interp);
-	g_free(q_tmp);
-	g_free(interp);
+	g_mutex_lock(&req->lock);
+	req->answer = answer;
+	req->answered = TRUE;
+	g_cond_signal(&req->cond);
+	g_mutex_unlock(&req->lock);
+	return G_SOURCE_REMOVE;
+}
 
-	if (!launch_in_terminal(cmdline)) {
-		status(app, "No compatible terminal found to run code.");
-	} else {
-		status(app, "Running…");
+static char *request_input(const char *prompt) {
+	InputRequest req = { 0 };
+	req.prompt = prompt;
+	g_mutex_init(&req.lock);
+	g_cond_init(&req.cond);
+	g_main_context_invoke(NULL, ask_input, &req); // the global default context is the GTK thread's
+	g_mutex_lock(&req.lock);
+	while (!req.answered) g_cond_wait(&req.cond, &req.lock);
+	g_mutex_unlock(&req.lock);
+	g_mutex_clear(&req.lock);
+	g_cond_clear(&req.cond);
+	return req.answer;
+}
+
+static int ide_input(const char *prompt) {
+	char *answer = request_input(prompt);
+	int value = answer ? atoi(answer) : 0;
+	free(answer);
+	return value;
+}
+
+static char *ide_input_text(const char *prompt) {
+	return request_input(prompt);
+}
+
+// ------------------------ Diagnostics ------------------------
+// The buffer's edits are reported to a CcrpChecker before they happen, with
+// line numbers of the text as it was. An idle callback parses the lines they
+// left dirty, a time slice at a time, then puts an error mark on each line
+// whose message changed. The message is the mark's tooltip.
+
+#define CHECK_CATEGORY "ccrp-error"
+#define CHECK_SLICE_US 4000 // parsing per idle call, so a large file never stalls typing
+
+static gboolean check_idle(gpointer user_data);
+
+static void schedule_check(App *app) {
+	if (!app->check_id) app->check_id = g_idle_add(check_idle, app);
+}
+
+static void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location, gchar *text, gint len, gpointer user_data) {
+	App *app = (App *)user_data;
+	int newlines = 0;
+	for (gint i = 0; i < len; i++) {
+		if (text[i] == '\n' || (text[i] == '\r' && (i + 1 == len || text[i + 1] != '\n'))) newlines++;
+	}
+	ccrp_checker_edit(app->checker, gtk_text_iter_get_line(location), 1, 1 + newlines);
+	schedule_check(app);
+}
+
+static void on_delete_range(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+	App *app = (App *)user_data;
+	int first = gtk_text_iter_get_line(start);
+	ccrp_checker_edit(app->checker, first, gtk_text_iter_get_line(end) - first + 1, 1);
+	schedule_check(app);
+}
+
+static void show_check(App *app, int line) {
+	GtkTextBuffer *buffer = GTK_TEXT_BUFFER(app->source_buffer);
+	GtkTextIter start, end;
+	gtk_text_buffer_get_iter_at_line(buffer, &start, line);
+	end = start;
+	if (!gtk_text_iter_ends_line(&end)) gtk_text_iter_forward_to_line_end(&end);
+	gtk_source_buffer_remove_source_marks(app->source_buffer, &start, &end, CHECK_CATEGORY);
+	if (ccrp_checker_message(app->checker, line)) {
+		gtk_source_buffer_create_source_mark(app->source_buffer, NULL, CHECK_CATEGORY, &start);
+	}
+}
+
+static gboolean check_idle(gpointer user_data) {
+	App *app = (App *)user_data;
+	GtkTextBuffer *buffer = GTK_TEXT_BUFFER(app->source_buffer);
+	int lines = gtk_text_buffer_get_line_count(buffer);
+	if (ccrp_checker_line_count(app->checker) != lines) {
+		// out of step with the buffer: check it all again
+		ccrp_checker_edit(app->checker, 0, ccrp_checker_line_count(app->checker), lines);
+	}
+	gint64 deadline = g_get_monotonic_time() + CHECK_SLICE_US;
+	for (int i = ccrp_checker_next_dirty(app->checker, 0); i >= 0; i = ccrp_checker_next_dirty(app->checker, i + 1)) {
+		if (g_get_monotonic_time() > deadline) return G_SOURCE_CONTINUE;
+		GtkTextIter start, end;
+		gtk_text_buffer_get_iter_at_line(buffer, &start, i);
+		end = start;
+		if (!gtk_text_iter_ends_line(&end)) gtk_text_iter_forward_to_line_end(&end);
+		gchar *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+		ccrp_checker_set_line(app->checker, i, text);
+		g_free(text);
 	}
-	g_free(cmdline);
-	// Keep tmp file so terminal can access; user can clean later
-	g_free(tmp_path);
+	const GArray *changed = ccrp_checker_update(app->checker);
+	for (guint i = 0; i < changed->len; i++) show_check(app, g_array_index(changed, int, i));
+	app->check_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static gchar *check_tooltip(GtkSourceMarkAttributes *attributes, GtkSourceMark *mark, gpointer user_data) {
+	App *app = (App *)user_data;
+	GtkTextIter iter;
+	gtk_text_buffer_get_iter_at_mark(GTK_TEXT_BUFFER(app->source_buffer), &iter, GTK_TEXT_MARK(mark));
+	return g_strdup(ccrp_checker_message(app->checker, gtk_text_iter_get_line(&iter)));
+}
+
+static void setup_diagnostics(App *app) {
+	app->checker = ccrp_checker_new();
+	GtkSourceMarkAttributes *attributes = gtk_source_mark_attributes_new();
+	gtk_source_mark_attributes_set_icon_name(attributes, "dialog-error");
+	g_signal_connect(attributes, "query-tooltip-text", G_CALLBACK(check_tooltip), app);
+	gtk_source_view_set_mark_attributes(app->source_view, CHECK_CATEGORY, attributes, 0);
+	g_object_unref(attributes);
+	gtk_source_view_set_show_line_marks(app->source_view, TRUE);
+	// before the default handlers, while the lines still have their old numbers
+	g_signal_connect(app->source_buffer, "insert-text", G_CALLBACK(on_insert_text), app);
+	g_signal_connect(app->source_buffer, "delete-range", G_CALLBACK(on_delete_range), app);
+	schedule_check(app);
 }
 
 static void on_pick_interpreter(GtkButton *btn, gpointer user_data) {
@@ -380,6 +701,20 @@ static void on_open_folder(GtkButton *btn, gpointer user_data) {
 	status(app, "Opened folder %s", app->root_dir);
 }
 
+// A script still running is stopped; the process exits with the window
+static void on_window_destroy(GtkWidget *widget, gpointer user_data) {
+	App *app = (App *)user_data;
+	input_parent = NULL;
+	if (app->check_id) g_source_remove(app->check_id);
+	app->check_id = 0;
+	g_signal_handlers_disconnect_by_data(app->source_buffer, app);
+	ccrp_checker_free(app->checker);
+	app->checker = NULL;
+	if (!app->job) return;
+	stop_job(app->job);
+	g_source_remove(app->drain_id);
+}
+
 static void activate(GtkApplication *gapp, gpointer user_data) {
 	App *app = g_new0(App, 1);
 
@@ -411,6 +746,11 @@ static void activate(GtkApplication *gapp, gpointer user_data) {
 	gtk_header_bar_pack_end(GTK_HEADER_BAR(app->header), app->pick_interp_button);
 	g_signal_connect(app->pick_interp_button, "clicked", G_CALLBACK(on_pick_interpreter), app);
 
+	app->stop_button = gtk_button_new_with_label("Stop");
+	gtk_header_bar_pack_end(GTK_HEADER_BAR(app->header), app->stop_button);
+	gtk_widget_set_sensitive(app->stop_button, FALSE);
+	g_signal_connect(app->stop_button, "clicked", G_CALLBACK(on_stop), app);
+
 	app->run_button = gtk_button_new_with_label("Run");
 	gtk_header_bar_pack_end(GTK_HEADER_BAR(app->header), app->run_button);
 	g_signal_connect(app->run_button, "clicked", G_CALLBACK(on_run), app);
@@ -431,10 +771,26 @@ static void activate(GtkApplication *gapp, gpointer user_data) {
 	gtk_paned_add1(GTK_PANED(app->paned), tree_scroller);
 	g_signal_connect(app->tree, "row-activated", G_CALLBACK(on_tree_row_activated), app);
 
-	// Editor
+	// Editor above the output pane
+	app->editor_paned = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
+	gtk_paned_add2(GTK_PANED(app->paned), app->editor_paned);
 	app->scroller = gtk_scrolled_window_new(NULL, NULL);
 	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(app->scroller), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
-	gtk_paned_add2(GTK_PANED(app->paned), app->scroller);
+	gtk_paned_pack1(GTK_PANED(app->editor_paned), app->scroller, TRUE, FALSE);
+
+	// Output pane
+	app->output_view = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(app->output_view), FALSE);
+	gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(app->output_view), FALSE);
+	gtk_text_view_set_monospace(GTK_TEXT_VIEW(app->output_view), TRUE);
+	app->output_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app->output_view));
+	GtkTextIter output_iter;
+	gtk_text_buffer_get_end_iter(app->output_buffer, &output_iter);
+	app->output_end = gtk_text_buffer_create_mark(app->output_buffer, "end", &output_iter, FALSE);
+	GtkWidget *output_scroller = gtk_scrolled_window_new(NULL, NULL);
+	gtk_container_add(GTK_CONTAINER(output_scroller), app->output_view);
+	gtk_widget_set_size_request(output_scroller, -1, 160);
+	gtk_paned_pack2(GTK_PANED(app->editor_paned), output_scroller, FALSE, TRUE);
 
 	app->source_buffer = GTK_SOURCE_BUFFER(gtk_source_buffer_new(NULL));
 	app->source_view = GTK_SOURCE_VIEW(gtk_source_view_new_with_buffer(app->source_buffer));
@@ -443,6 +799,7 @@ static void activate(GtkApplication *gapp, gpointer user_data) {
 	gtk_container_add(GTK_CONTAINER(app->scroller), GTK_WIDGET(app->source_view));
 	gtk_source_view_set_show_line_numbers(app->source_view, TRUE);
 	gtk_source_view_set_highlight_current_line(app->source_view, TRUE);
+	setup_diagnostics(app);
 
 	// Load settings and language/theme
 	load_config(app);
@@ -453,6 +810,12 @@ static void activate(GtkApplication *gapp, gpointer user_data) {
 	app->status_ctx = gtk_statusbar_get_context_id(GTK_STATUSBAR(app->statusbar), "main");
 	status(app, "Ready");
 
+	// Scripts ask for input with a dialog over the IDE
+	input_parent = GTK_WINDOW(app->window);
+	get_input_from_gui = ide_input;
+	get_text_input_from_gui = ide_input_text;
+	g_signal_connect(app->window, "destroy", G_CALLBACK(on_window_destroy), app);
+
 	g_object_set_data_full(G_OBJECT(app->window), "app", app, (GDestroyNotify)g_free);
 	gtk_widget_show_all(app->window);
 }
@@ -460,6 +823,7 @@ static void activate(GtkApplication *gapp, gpointer user_data) {
 int main(int argc, char **argv) {
 	GtkApplication *app = gtk_application_new("com.cryptic.ide", G_APPLICATION_FLAGS_NONE);
 	int status_code;
+	signal(SIGPIPE, SIG_IGN); // an interpreter that exits early must not take the IDE with it
 	g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
 	status_code = g_application_run(G_APPLICATION(app), argc, argv);
 	g_object_unref(app);